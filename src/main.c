@@ -59,7 +59,7 @@ int main(int argc, char **argv) {
     load_string_table(string_table, csv_name);
 
     /* assign ops respectively. */
-    dialogue->strings        = string_table;
+    yarn_bind_string_table(dialogue, string_table); /* dialogue->strings = string_table, resolving every line once. */
 
     /* dialogue->log_debug = imaginary_debug_function; -- Optional */
     /* dialogue->log_error = imaginary_error_function; -- Optional */
@@ -160,15 +160,17 @@ struct yarn_value {
  *   it is actually storing the SIZE of the type. more on that below.
  * 
  * overview of how it's implemented:
- *   linear-probing, djb2 hashing.
+ *   swisstable-ish open addressing, wyhash hashing, power-of-two capacity.
  *   only supports char* as key, and key will be cloned on push.
- * 
- *   internal data is stored in char* buffer.
- *   like the diagram shown below;
  *
- * |================= entire buffer ==================|
- * [header-data|actual value][header-data|actual value]
- * |===== one "chunk"  =====|
+ *   every bucket has one control byte: empty, deleted (tombstone), or 7 bits of the key's hash.
+ *   probing compares 16 control bytes at once (sse2 when available), and only buckets whose
+ *   tag matches get their key compared. header and value live in separate arrays,
+ *   so probing never touches them until it has a candidate.
+ *
+ *   control:  [c0][c1][c2]...[c(n-1)][c0]..[c14]   <- first 15 repeated, so a group can run off the end.
+ *   entries:  [header][header][header]...          <- hash, keylen, key.
+ *   values:   [value ][value ][value ]...          <- element_size each.
  *
  * with map->element_size being set to the size of actual value.
  * on kvpush, it will take the size of passed value, and check against the map it's being inserted to,
@@ -195,6 +197,10 @@ struct yarn_value {
  *
  *  once you're done:
  *    yarn_kvdestroy(&map); // every value stored inside will be unreachable.
+ *
+ *  keys are cloned on push by default. if they're guaranteed to outlive the map
+ *  (e.g. they live in an allocator), set map.borrowed_keys = 1 right after creating it;
+ *  map will keep the key pointers as-is and never free them.
  */
 
 typedef struct {
@@ -204,10 +210,14 @@ typedef struct {
 } yarn_kvpair_header;
 
 typedef struct {
-    char   *entries;
+    yarn_kvpair_header *entries; /* [capacity] */
+    char               *values;  /* [capacity * element_size] */
+    uint8_t            *control; /* [capacity + 15] */
     size_t used;
-    size_t capacity;
-    size_t element_size; /* size of the actual value it's made for, not the size of chunk */
+    size_t deleted;      /* tombstones, cleared on rehash. */
+    size_t capacity;     /* power of two; asked capacity is rounded up. */
+    size_t element_size; /* size of the actual value it's made for */
+    int    borrowed_keys; /* keys are owned by someone else. */
 } yarn_kvmap;
 
 #define yarn_kvcreate(element, caps) \
@@ -294,34 +304,406 @@ typedef struct {
 /* =============================================
  * Yarn line:
  * Same as C# implementation.
- * 
+ *
+ * substitutions are the values as they were on the stack; they're only turned into text
+ * when the line is formatted (yarn_format_line_into...), so a line that's never shown costs nothing.
+ * yarn_tostring / yarn_format_number give text of one of them.
+ *
  * TODO: @allocator the lifetime of substitions array cannot be trusted right now.
  * do not copy the pointer, clone the entire array if you want the lifetime to be certain.
+ * string values point to where the value came from (program, storage, dialogue),
+ * format the line before changing a variable if your storage frees its old strings.
  */
 
 typedef struct {
     char *id;
+    int   line_index; /* dense index of id in the dialogue (see yarn_bind_string_table). -1 if it has none. */
 
-    int  n_substitutions;
-    char **substitutions; /* TODO: @allocator fragmentation disaster */
+    int         n_substitutions;
+    yarn_value *substitutions;
 } yarn_line;
 
 /*
- * TODO: @allocator recipe for fragmentation disaster. fix it
+ * strings are owned by string table's allocator; valid until the table is destroyed.
+ *
+ * file and node are interned: every line sharing a file / node name gets the same id.
+ *   yarn_get_interned_string(table, entry.node); // "Start"
+ *   entry.node == yarn_find_interned_string(table, "Start"); // filter by node without strcmp.
+ *
+ * in lazy / compressed table, text is 0 until it's needed; read it through yarn_get_line_text.
+ * */
+
+/*
+ * markup (yarn 2):
+ *   [b]bold[/b] [wave size=2 speed=1.5]wavy[/wave]  open / close marker; attribute covers the text between.
+ *   [/]                                               closes every open attribute.
+ *   [pause=500/]                                      self closing; same as [pause pause=500/], covers nothing.
+ *   \[ \]                                             literal brackets.
+ *   [nomarkup]...[/nomarkup]                          nothing inside is markup.
+ *   Name: text                                        implicit `character` attribute, with the name as `name` property.
+ *
+ * with table->markup set, every text is parsed once at load: entry's text becomes plain text (markers taken out)
+ * and entry's markup lists attributes by position in that text. yarn_format_line_markup_into gives back
+ * where each attribute ended up in the formatted line, so renderers never parse the text themselves.
+ * self closing marker eats one whitespace after it, if there's one before it too (unless trimwhitespace=false).
+ * select / plural / ordinal aren't attributes; they're formatted into the text (see yarn_line_template).
+ * */
+enum {
+    YARN_MARKUP_STRING = 0,
+    YARN_MARKUP_INTEGER,
+    YARN_MARKUP_FLOAT,
+    YARN_MARKUP_BOOL,
+};
+
+typedef struct {
+    const char *name;
+    const char *value;   /* as written (quotes and escapes taken out). */
+    int         type;    /* YARN_MARKUP_* */
+    float       number;  /* value of integer / float / bool (1 or 0). */
+    int32_t     slot;    /* value is exactly `{n}`: n (use the line's n-th substitution). -1 otherwise. */
+} yarn_markup_property;
+
+typedef struct {
+    const char *name;
+    uint32_t    position;       /* in plain text, before substitution. */
+    uint32_t    length;
+    uint32_t    first_property; /* into markup's properties. */
+    uint32_t    n_properties;
+} yarn_markup_attribute;
+
+typedef struct {
+    uint32_t               n_attributes;
+    uint32_t               n_properties;
+    yarn_markup_attribute *attributes; /* ordered by where they open. */
+    yarn_markup_property  *properties;
+} yarn_line_markup;
+
+/* attribute, where it is in formatted line. */
+typedef struct {
+    const yarn_markup_attribute *attribute;
+    uint32_t                     position;
+    uint32_t                     length;
+} yarn_markup_span;
+
+/*
+ * line template: text split into literal runs, `{n}` placeholders and format functions once, when table is loaded.
+ * formatting is then a memcpy per segment, with the exact size known before writing anything.
+ * not built for lazy table (text isn't there at load); those are scanned when formatted (without format functions).
+ *
+ * format functions pick one of their cases by the value of a substitution; `%` in the case stands for the value:
+ *   [select value={0} male="he" female="she" other="they"/]     case named as the value.
+ *   [plural value={0} one="% apple" other="% apples"/]          case named as the CLDR plural category of the value.
+ *   [ordinal value={0} one="%st" two="%nd" few="%rd" other="%th"/]
+ * falls back to `other` case; writes nothing if there's none.
  * */
+enum {
+    YARN_FORMAT_NONE = 0,
+    YARN_FORMAT_SELECT,
+    YARN_FORMAT_PLURAL,
+    YARN_FORMAT_ORDINAL,
+};
+
+typedef struct {
+    uint32_t offset;     /* into text. */
+    uint32_t length;     /* of the literal, or of the whole `{n}` / function (written as is when there's no n-th substitution). */
+    int32_t  slot;       /* substitution index, -1 for literal. */
+    int32_t  function;   /* YARN_FORMAT_*; slot is its value. */
+    uint32_t first_case; /* into template's cases. */
+    uint32_t n_cases;
+} yarn_template_segment;
+
+typedef struct {
+    uint32_t               literal_length; /* of every literal segment together. */
+    uint32_t               n_segments;
+    uint32_t               n_cases;
+    yarn_template_segment *segments;       /* right after the template, in table's allocator. */
+    yarn_markup_property  *cases;          /* of format functions; name is the case, value is its text. */
+} yarn_line_template;
+
 typedef struct {
     char *text;
-    char *file;         /* TODO: @intern can be interned. */
-    char *node;         /* TODO: @intern can be interned. */
+    int   file;
+    int   node;
     int   line_number;
+    yarn_line_template *format; /* 0 if text has no placeholder (or table is lazy). */
+    yarn_line_markup   *markup; /* 0 if text has no markup, or table->markup isn't set. */
+
+    /* lazy table: raw (still escaped) text field inside the csv.
+     * compressed table: text inside the raw (decompressed) block. */
+    uint32_t text_offset;
+    uint32_t text_length;
+    int      text_slot;   /* lazy: slot in lazy cache, -1 if none. compressed: block of the text. */
 } yarn_parsed_entry;
 
+/*
+ * plural rules (CLDR), compiled into decision tables for [plural] / [ordinal].
+ * conditions are checked in order; the category of the first one that holds (together with the ones
+ * it's and-ed with) is picked, and YARN_PLURAL_OTHER ends the table. e.g. english ordinals:
+ *   one: n % 10 = 1 and n % 100 != 11  ->  { ONE, N, 0, 1, 10, 1, 1 }, { ONE, N, 1, 0, 100, 11, 11 }
+ *
+ * operands are the CLDR ones, read off the formatted number: n absolute value, i integer digits,
+ * v number of fraction digits, f fraction digits, t fraction digits without trailing zeros.
+ * */
+enum {
+    YARN_PLURAL_ZERO = 0,
+    YARN_PLURAL_ONE,
+    YARN_PLURAL_TWO,
+    YARN_PLURAL_FEW,
+    YARN_PLURAL_MANY,
+    YARN_PLURAL_OTHER,
+};
+
+enum {
+    YARN_PLURAL_OPERAND_N = 0,
+    YARN_PLURAL_OPERAND_I,
+    YARN_PLURAL_OPERAND_V,
+    YARN_PLURAL_OPERAND_F,
+    YARN_PLURAL_OPERAND_T,
+};
+
+typedef struct {
+    uint8_t  category;  /* YARN_PLURAL_* it leads to. */
+    uint8_t  operand;   /* YARN_PLURAL_OPERAND_* */
+    uint8_t  negate;    /* `!=` instead of `=`. */
+    uint8_t  and_next;  /* only holds together with the next condition. */
+    uint16_t mod;       /* operand % mod; 0 if none. */
+    uint16_t from;      /* operand must be in from..to (and an integer). */
+    uint16_t to;
+} yarn_plural_condition;
+
+typedef struct {
+    const char *language;                  /* "en", "fr"... matched against locale up to `-` / `_`. */
+    const yarn_plural_condition *cardinal;
+    const yarn_plural_condition *ordinal;
+} yarn_plural_rules;
+
+/*
+ * columns of csv that string table keeps on load. set table->columns before loading.
+ * columns are matched by the header name, so order doesn't matter and unknown ones (lock, comment...) are skipped.
+ * id column is always required.
+ *
+ *   table->columns = YARN_COLUMN_TEXT; // only id and text. file / node are -1, line_number is 0.
+ * */
+enum {
+    YARN_COLUMN_TEXT        = 1 << 0,
+    YARN_COLUMN_FILE        = 1 << 1,
+    YARN_COLUMN_NODE        = 1 << 2,
+    YARN_COLUMN_LINE_NUMBER = 1 << 3,
+    YARN_COLUMN_ALL         = YARN_COLUMN_TEXT | YARN_COLUMN_FILE | YARN_COLUMN_NODE | YARN_COLUMN_LINE_NUMBER,
+};
+
+/*
+ * lazy string table:
+ *   only records where each line's text is in the csv, and unescapes it the first time it's asked for.
+ *   csv buffer is NOT copied, so it must outlive the table (e.g. memory mapped file).
+ *
+ *     table->lazy = 1;
+ *     table->lazy_cache_lines = 1024; // optional. 0 keeps every decoded text until the table is destroyed.
+ *     yarn_load_string_table(table, mapped_csv, mapped_csv_size);
+ *
+ *   with lazy_cache_lines > 0, decoded texts live in a LRU of that many lines, and pointer from
+ *   yarn_get_line_text is only valid until the next yarn_get_line_text on the table.
+ *   lazy table can be loaded only once, and csv must be smaller than 4GB.
+ * */
+typedef struct {
+    char *line_id;  /* owner of the slot, borrowed from table. */
+    char *text;     /* YARN_MALLOC'd */
+    int   prev;
+    int   next;
+} yarn_lazy_slot;
+
+/*
+ * compressed string table:
+ *   packs texts into blocks of about YARN_TEXT_BLOCK_SIZE bytes and keeps each one LZ compressed.
+ *   block is decompressed when one of its lines is asked for, into a cache of YARN_TEXT_BLOCK_CACHE blocks.
+ *
+ *     table->compress = 1;
+ *     yarn_load_string_table(table, csv, csv_size); // or feed / finish.
+ *
+ *   pointer from yarn_get_line_text is only valid until the next yarn_get_line_text on the table.
+ *   can't be combined with lazy. bigger blocks compress better, but cost more to decompress one line.
+ * */
+#if !defined(YARN_TEXT_BLOCK_SIZE)
+#define YARN_TEXT_BLOCK_SIZE 4096
+#endif
+
+#if !defined(YARN_TEXT_BLOCK_CACHE)
+#define YARN_TEXT_BLOCK_CACHE 4
+#endif
+
+typedef struct {
+    size_t   offset;          /* into compressed_text. */
+    uint32_t compressed_size;
+    uint32_t raw_size;
+} yarn_text_block;
+
+typedef struct {
+    int      block;     /* block decompressed in text. */
+    uint64_t last_used;
+    char    *text;      /* YARN_MALLOC'd, 0 if slot was never used. */
+    size_t   capacity;
+} yarn_text_block_slot;
+
+/*
+ * bound string table:
+ *   yarn_bind_string_table looks up every line of a dialogue once, and remembers where each is
+ *   by the line's dense index; so yarn_line.line_index finds text without hashing the id again.
+ *   id is kept to make sure a yarn_line really is from the bound dialogue.
+ * */
+typedef struct {
+    const char *line_id; /* dialogue's line_ids entry. */
+    int         bucket;  /* of table->table, -1 if table doesn't have the line. */
+} yarn_bound_line;
+
+/*
+ * frozen string table:
+ *   once loading is done, yarn_freeze_string_table builds a minimal perfect hash over line ids.
+ *   ids are split into buckets of ~3, and each bucket gets a displacement that sends all of its ids
+ *   to free slots (hash and displace); n ids fill exactly n slots. lookup then hashes once,
+ *   probes one slot and compares one key, instead of walking the kvmap. costs ~5 bytes per line.
+ *   frozen table can't be loaded / fed into anymore.
+ * */
+typedef struct {
+    uint32_t  n_lines;
+    uint32_t  n_buckets;
+    uint32_t  seed;
+    uint32_t *displacements; /* per bucket. top bit set: the rest is the slot itself. */
+    uint32_t *slots;         /* slot -> bucket of table->table. 0 if not frozen. */
+} yarn_frozen_index;
+
+/*
+ * formatted line cache:
+ *   lines that are asked for over and over (typewriter effect, re-layout, backlog) are formatted once.
+ *
+ *     table->format_cache_lines = 256; // 0 (default) formats on every acquire.
+ *
+ *     const yarn_formatted_line *formatted = yarn_acquire_formatted_line(table, line);
+ *     draw(formatted->text, formatted->spans, formatted->n_spans);
+ *     yarn_release_formatted_line(table, formatted);
+ *
+ *   entries are keyed by line, values of its substitutions and plural rules of the table
+ *   (a table is one locale, so that's all of the locale that matters). past format_cache_lines,
+ *   least recently used entries are dropped; an acquired one stays valid until it's released.
+ *   format_cache_lines can change any time; the next acquire resizes the cache (and drops what's over).
+ *   release every line before destroying / loading into the table: spans point into it.
+ *   loading into a table with acquired lines fails; otherwise it empties the cache.
+ * */
+typedef struct {
+    const char             *text;
+    int                     length;
+    const yarn_markup_span *spans;   /* 0 if line has no markup. */
+    int                     n_spans;
+} yarn_formatted_line;
+
+typedef struct yarn_cached_line {
+    yarn_formatted_line view; /* first: what acquire hands out is the entry itself. */
+
+    const char              *line_id; /* key of table entry. */
+    const yarn_plural_rules *plurals;
+    uint32_t                 hash;
+    int                      n_values;
+    yarn_value              *values;  /* copy, strings included. */
+
+    int    refs;
+    int    cached;   /* still in the cache; otherwise freed on last release. */
+    size_t size;     /* of the whole allocation. */
+
+    struct yarn_cached_line *next_in_bucket;
+    struct yarn_cached_line *prev; /* more recently used. */
+    struct yarn_cached_line *next; /* less recently used. */
+} yarn_cached_line;
+
 typedef struct {
-    /* TODO: @intern string interner for files, and nodes. */
-    /* TODO: locale identifier could be nice parhaps? */
-    yarn_kvmap table;
+    char          *locale;    /* set by locale manager, 0 otherwise. */
+    const yarn_plural_rules *plurals; /* for [plural] / [ordinal]. 0 picks them by locale (english without one) when first needed. */
+    int            columns;   /* YARN_COLUMN_* to keep. YARN_COLUMN_ALL by default. */
+
+    int            lazy;              /* set before loading. */
+    int            lazy_cache_lines;  /* set before loading. */
+    const char    *lazy_source;       /* csv, in lazy mode. */
+    yarn_lazy_slot *lazy_slots;
+    int            lazy_used;
+    int            lazy_head;         /* most recently used. */
+    int            lazy_tail;         /* least recently used. */
+
+    int            markup;            /* set before loading: parse markup of every line (see yarn_line_markup). */
+
+    int            compress;          /* set before loading. */
+    YARN_DYN_ARRAY(yarn_text_block) text_blocks;
+    YARN_DYN_ARRAY(uint8_t) compressed_text;  /* every block, back to back. */
+    YARN_DYN_ARRAY(char) staged_text;         /* raw texts of the block being filled, while loading. */
+    yarn_text_block_slot block_cache[YARN_TEXT_BLOCK_CACHE];
+    uint64_t       block_clock;
+
+    yarn_kvmap     table;     /* borrows keys from allocator. */
+    yarn_allocator allocator; /* every id, text and interned string of the table. */
+    yarn_frozen_index frozen; /* built by yarn_freeze_string_table. */
+
+    /* by yarn_bind_string_table: dense line index of bound_to -> line. loading into the table drops it. */
+    yarn_dialogue *bound_to;  /* only compared, never followed. */
+    YARN_DYN_ARRAY(yarn_bound_line) bound_lines;
+
+    yarn_kvmap interned_ids;          /* string -> int id. borrows keys from allocator. */
+    YARN_DYN_ARRAY(char *) interned;  /* id -> string */
+
+    int               format_cache_lines; /* set any time: how many formatted lines are kept (see yarn_formatted_line). */
+    int               format_cache_sized; /* format_cache_lines the cache was last resized for. */
+    int               format_acquired;    /* lines acquired and not released yet. */
+    int               format_used;
+    uint32_t          n_format_buckets;   /* power of two. */
+    yarn_cached_line **format_buckets;
+    yarn_cached_line *format_head;        /* most recently used. */
+    yarn_cached_line *format_tail;
+
+    struct yarn__csv_parser *feeding; /* between yarn_string_table_feed and finish. */
 } yarn_string_table;
 
+/* =============================================
+ * Locale manager:
+ *   keeps string tables of several locales resident at once, within a memory budget.
+ *
+ *     yarn_locale_manager *locales = yarn_create_locale_manager(64 * 1024 * 1024); // 0 for no budget.
+ *     locales->lazy = 1;                           // optional: tables are created with these settings (or compress).
+ *     yarn_add_locale(locales, "en", en_csv, en_csv_size); // csv buffers must outlive the manager.
+ *     yarn_add_locale(locales, "fr", fr_csv, fr_csv_size);
+ *
+ *     yarn_switch_locale(locales, dialogue, "en"); // loads "en", dialogue->strings = its table.
+ *     yarn_load_locale(locales, "fr");             // optional: warm it up ahead of time.
+ *     yarn_switch_locale(locales, dialogue, "fr"); // resident: just swaps the pointer.
+ *
+ *   when a load pushes resident tables over the budget, least recently used ones are
+ *   destroyed until it fits. current locale, and tables with formatted lines still acquired,
+ *   are never evicted; so the budget may be exceeded when those and the new locale don't fit.
+ *   tables grow after load (lazy texts, format cache, bound lines), so every load / switch
+ *   measures resident tables again before comparing them against the budget.
+ *   only point dialogues at the current locale; other tables can be destroyed at any load.
+ */
+typedef struct {
+    char              *name;       /* YARN_MALLOC'd */
+    const char        *csv;        /* borrowed */
+    size_t             csv_length; /* including '\0' */
+    yarn_string_table *table;      /* 0 while not resident */
+    size_t             bytes;      /* memory of the table, as of the last load / switch */
+    uint64_t           last_used;
+} yarn_locale;
+
+typedef struct {
+    YARN_DYN_ARRAY(yarn_locale) locales;
+    int      current;        /* index into locales, -1 if none. */
+    size_t   memory_budget;  /* 0 means unlimited. */
+    size_t   resident_bytes;
+    uint64_t clock;
+
+    /* settings for created tables. same as yarn_string_table's. */
+    int columns;
+    int lazy;
+    int lazy_cache_lines;
+    int compress;
+    int markup;
+    int format_cache_lines;
+    int freeze;  /* freeze every table after loading it. */
+} yarn_locale_manager;
+
 
 /* =============================================
  * Yarn options:
@@ -377,6 +759,55 @@ typedef struct {
 
 typedef yarn_kvmap yarn_library;
 
+/* =============================================
+ * Yarn commands:
+ *   RUN_COMMAND text is split into name and arguments when a chapter is loaded,
+ *   so a registered command is called straight away with typed arguments.
+ *
+ *     // <<move Sally {$x} 4>>
+ *     void move(yarn_dialogue *dialogue, yarn_value *args, int n_args) {
+ *         char *who = yarn_value_as_string(args[0]); // "Sally"
+ *         float x   = yarn_value_as_float(args[1]);  // $x, as it was on the stack
+ *         float y   = yarn_value_as_float(args[2]);  // 4
+ *     }
+ *
+ *     yarn_register_command(dialogue, "move", move, 3); // -1 takes any number of arguments.
+ *
+ *   arguments are split at spaces, "double quoted" arguments can have spaces in them (and \" inside).
+ *   numbers, true and false become float / bool, anything else is string.
+ *   substitution that is the whole argument keeps its type; one inside an argument ("{0}px") is formatted into it.
+ *
+ *   commands that are not registered go to command_handler as text, like before.
+ *   arguments only live during the call.
+ */
+#define YARN_MAX_COMMAND_ARGS 32
+
+typedef void yarn_command_function(yarn_dialogue *dialogue, yarn_value *args, int n_args);
+
+typedef struct {
+    yarn_command_function *function;
+    int                    param_count;
+} yarn_command_entry;
+
+enum {
+    YARN_COMMAND_ARG_VALUE = 0,    /* literal, value is it. */
+    YARN_COMMAND_ARG_SUBSTITUTION, /* whole argument is {slot}. */
+    YARN_COMMAND_ARG_TEXT,         /* string value with {n} in it. */
+};
+
+typedef struct {
+    int        kind;
+    int        slot;
+    yarn_value value;
+} yarn_command_arg;
+
+/* tokenized RUN_COMMAND. lives in chapter. */
+typedef struct {
+    char             *name;
+    int               n_args;
+    yarn_command_arg *args;
+} yarn_command;
+
 /* =============================================
  * Yarn delegates:
  * TODO: @deviation match it to C# implementation. SUBJECT TO CHANGE
@@ -391,6 +822,109 @@ typedef void yarn_prepare_for_lines_handler_func(yarn_dialogue *dialogue, char *
 
 
 
+/* =============================================
+ * Yarn chapters:
+ *   a program loaded under a name, so that multiple `.yarnc` can live inside one dialogue.
+ *   (e.g. one per chapter / DLC)
+ *
+ *   every chapter shares the same node namespace; node names must be unique across chapters,
+ *   and RUN_NODE / yarn_set_node can jump into a node that lives in another chapter.
+ *
+ *   load/unload with:
+ *     yarn_load_chapter(dialogue, "chapter1", yarnc_bytes, yarnc_length);
+ *     yarn_unload_chapter(dialogue, "chapter1"); // frees the program.
+ *
+ *   yarn_load_program is the same as unloading every chapter,
+ *   then loading the program as a chapter named YARN_DEFAULT_CHAPTER.
+ *
+ *   decoded program lives in the chapter's allocators (one per decoding thread),
+ *   so unloading a chapter is just destroying them.
+ *
+ *   parallel decoding:
+ *     #define YARN_C99_THREADS before the implementation, then set
+ *       dialogue->load_threads = 4;
+ *     nodes are split into byte-balanced ranges and decoded on that many threads.
+ *     without YARN_C99_THREADS, load_threads is ignored and decoding happens on the caller.
+ */
+#define YARN_DEFAULT_CHAPTER "main"
+
+/* =============================================
+ * Node manifests:
+ *   line ids a node can show (RUN_LINE / ADD_OPTION), built once when its chapter is loaded.
+ *   prepare_for_lines_handler gets the manifest of every node that's entered.
+ *
+ *   with dialogue->manifest_depth = N (set before loading the chapter), lines of nodes it jumps to
+ *   (PUSH_STRING + RUN_NODE, what `<<jump>>` compiles to) within N jumps follow the node's own,
+ *   nearest first. only jumps inside the same chapter are followed.
+ */
+typedef struct {
+    int    n_ids;
+    int    n_own; /* first n_own ids are of the node itself. */
+    char **ids;   /* owned by chapter. */
+} yarn_node_manifest;
+
+/* =============================================
+ * Prefetch queue:
+ *   hands manifests of entered nodes over to worker threads, so text / voice / whatever
+ *   can be warmed up before the VM gets there.
+ *
+ *     dialogue->prefetch = yarn_create_prefetch_queue(64);
+ *
+ *     // on worker thread:
+ *     yarn_prefetch_request request;
+ *     while (yarn_prefetch_pop(queue, &request, 1)) {
+ *         for (int i = 0; i < request.manifest->n_ids; ++i) load_voice(request.manifest->ids[i]);
+ *         yarn_prefetch_done(queue, &request);
+ *     }
+ *
+ *     // shutting down:
+ *     yarn_close_prefetch_queue(queue); // pop returns 0 from now on. join workers, then destroy it.
+ *
+ *   pushing (every yarn_set_node) and popping are thread safe with YARN_C99_THREADS;
+ *   without it, queue is just a queue and pop never waits.
+ *   when it's full, the oldest request is dropped: newer nodes are nearer.
+ *   unloading a chapter (yarn_load_program and yarn_destroy_dialogue unload all of them)
+ *   drops its queued requests, and waits until popped ones of that chapter are done
+ *   (requests of other chapters don't hold it up). so a worker must not unload the
+ *   chapter of a request it hasn't marked done yet; that waits for itself.
+ */
+typedef struct yarn_prefetch_queue yarn_prefetch_queue;
+
+typedef struct {
+    const char               *node_name; /* owned by chapter, like manifest. */
+    const yarn_node_manifest *manifest;
+} yarn_prefetch_request;
+
+/* below this many nodes per thread, extra threads are not worth spawning. */
+#define YARN_MIN_NODES_PER_LOAD_THREAD 16
+#define YARN_MAX_LOAD_THREADS 64
+
+typedef struct {
+    char *name;
+    struct Yarn__Program *program;
+
+    int             n_allocators;
+    yarn_allocator *allocators; /* owns everything inside program. */
+
+    /* [node][instruction]: dense line index of RUN_LINE / ADD_OPTION, -1 for other instructions.
+     * built when the chapter meets a bound string table; 0 before that. */
+    int **line_indexes;
+
+    /* [node][instruction]: tokenized RUN_COMMAND, 0 for other instructions.
+     * [node] is 0 when node has no commands. */
+    yarn_command ***commands;
+
+    yarn_node_manifest *manifests; /* [node] */
+} yarn_chapter;
+
+typedef YARN_DYN_ARRAY(yarn_chapter) yarn_chapter_set;
+
+/* where the node lives. value type of yarn_dialogue.node_index. */
+typedef struct {
+    int chapter;
+    int node;
+} yarn_node_ref;
+
 /* =============================================
  * Yarn Dialogue:
  * A ported runtime from C# implementation.
@@ -418,7 +952,7 @@ typedef void yarn_logger_func(char *message);
 struct yarn_dialogue {
     // ProtobufCAllocator *program_allocator;
 
-    struct Yarn__Program *program;
+    struct Yarn__Program *program; /* program of the chapter that is currently running. */
     yarn_string_table  *strings;
     yarn_exec_state     execution_state;
     yarn_allocator      dialogue_allocator;
@@ -438,15 +972,68 @@ struct yarn_dialogue {
 
     yarn_variable_storage storage;
     yarn_library library;
+    yarn_kvmap   commands; /* command name -> yarn_command_entry. */
+
+    yarn_chapter_set chapters;
+    yarn_kvmap       node_index; /* node name -> yarn_node_ref, merged across chapters. */
+    int              load_threads; /* threads used to decode a program. needs YARN_C99_THREADS. */
+    int              manifest_depth; /* jumps followed by node manifests. 0 by default. */
+    yarn_prefetch_queue *prefetch;   /* optional. every node entered gets queued. not owned. */
+
+    /* every line id any chapter has used gets a dense index, that stays for the dialogue's lifetime. */
+    yarn_kvmap             line_index;     /* line id -> dense index. borrows keys from line_allocator. */
+    YARN_DYN_ARRAY(char *) line_ids;       /* dense index -> line id. */
+    yarn_allocator         line_allocator;
 
     yarn_option_set current_options;
     yarn_value stack[YARN_STACK_CAPACITY];
 
     int stack_ptr;
-    int current_node;
+    int current_chapter;
+    int current_node;        /* index into the current chapter's program->nodes. */
     int current_instruction;
 };
 
+/* =============================================
+ * Memory stats:
+ *   how much memory an object holds, broken down by category.
+ *
+ *     yarn_memory_stats stats;
+ *     yarn_get_dialogue_memory_stats(dialogue, &stats);
+ *     printf("%zu bytes\n", stats.total.bytes);
+ *
+ *   bytes are what's reserved for the category, allocations are how many objects it's made of.
+ *   objects that live inside an allocator (program, storage strings, ...) are counted
+ *   in their own category, and YARN_MEMORY_ARENA holds whatever is left in the allocator:
+ *   chunk headers, alignment padding, unused space. so total.bytes is what's actually reserved.
+ *
+ *   dialogue stats include every loaded chapter, but not the string table / storage;
+ *   those can be shared, query them separately.
+ *   malloc's own bookkeeping is not included.
+ */
+typedef enum {
+    YARN_MEMORY_INSTRUCTIONS = 0, /* instructions, and nodes holding them. */
+    YARN_MEMORY_OPERANDS,
+    YARN_MEMORY_STRINGS,
+    YARN_MEMORY_LABELS,           /* label tables of nodes. */
+    YARN_MEMORY_KVMAP,            /* hashmap buckets (keys are in STRINGS). */
+    YARN_MEMORY_ARENA,            /* allocator chunk overhead and free space. */
+    YARN_MEMORY_SCRATCH,          /* substitution / option scratch of dialogue. */
+    YARN_MEMORY_OTHER,            /* top level structs, arrays. */
+    YARN_MEMORY_TEMPLATES,        /* markup / templates of string table lines, with their properties. */
+    YARN_MEMORY_CATEGORY_COUNT,
+} yarn_memory_category;
+
+typedef struct {
+    size_t bytes;
+    size_t allocations;
+} yarn_memory_usage;
+
+typedef struct {
+    yarn_memory_usage categories[YARN_MEMORY_CATEGORY_COUNT];
+    yarn_memory_usage total;
+} yarn_memory_stats;
+
 /* ====================================================
  * Function declarations.
  * */
@@ -468,6 +1055,61 @@ YARN_C99_DEF void               yarn_destroy_allocator(yarn_allocator allocator)
 YARN_C99_DEF int yarn_load_program(yarn_dialogue *dialogue, void *program_buffer, size_t program_length);
 YARN_C99_DEF int yarn_load_string_table(yarn_string_table *table, void *csv_buffer, size_t csv_length);
 
+/* incremental loading: feed csv in chunks of any size (a field or quote can be split anywhere),
+ * then finish. chunk can be reused / freed right after feed returns. doesn't work with lazy table.
+ *
+ *   while ((n = inflate_some(stream, buffer, sizeof(buffer))) > 0) {
+ *       if (!yarn_string_table_feed(table, buffer, n)) break;
+ *   }
+ *   yarn_string_table_finish(table);
+ *
+ * both return 0 on error; feeding again after an error starts over from the header. */
+YARN_C99_DEF int yarn_string_table_feed(yarn_string_table *table, const void *chunk, size_t chunk_length);
+YARN_C99_DEF int yarn_string_table_finish(yarn_string_table *table);
+
+/* builds perfect hash index over line ids, so every lookup is a single probe (see yarn_frozen_index).
+ * call after the table is fully loaded. returns 0 if it couldn't; table still works without it. */
+YARN_C99_DEF int yarn_freeze_string_table(yarn_string_table *table);
+
+/* makes table the dialogue's string table (dialogue->strings), and resolves every line of every loaded
+ * chapter against it by dense index. lines of chapters loaded later are resolved as they load.
+ * missing lines are logged here, once; returns 0 if there were any (the rest is still bound).
+ * a table is bound to one dialogue at a time; loading more into it drops the binding. */
+YARN_C99_DEF int yarn_bind_string_table(yarn_dialogue *dialogue, yarn_string_table *table);
+
+/* text by yarn_line.line_index of the dialogue that table is bound to. 0 if it's out of range or missing. */
+YARN_C99_DEF const char *yarn_get_line_text_by_index(yarn_string_table *table, int line_index);
+
+/* interned file / node names of string table.
+ * get returns 0 if the id is out of range, find returns -1 if nothing in the table uses the name. */
+YARN_C99_DEF const char *yarn_get_interned_string(yarn_string_table *table, int id);
+YARN_C99_DEF int         yarn_find_interned_string(yarn_string_table *table, const char *name);
+
+/* Locale functions. returns 1 on success, 0 otherwise. */
+YARN_C99_DEF yarn_locale_manager *yarn_create_locale_manager(size_t memory_budget);
+YARN_C99_DEF void                 yarn_destroy_locale_manager(yarn_locale_manager *manager);
+
+YARN_C99_DEF int yarn_add_locale(yarn_locale_manager *manager, const char *locale, const void *csv_buffer, size_t csv_length);
+YARN_C99_DEF int yarn_load_locale(yarn_locale_manager *manager, const char *locale);   /* makes it resident. */
+YARN_C99_DEF int yarn_unload_locale(yarn_locale_manager *manager, const char *locale); /* fails on current locale, or one with formatted lines acquired. */
+YARN_C99_DEF int yarn_switch_locale(yarn_locale_manager *manager, yarn_dialogue *dialogue, const char *locale);
+YARN_C99_DEF yarn_string_table *yarn_get_locale_table(yarn_locale_manager *manager, const char *locale); /* 0 if not resident. */
+
+/* Chapter functions. returns 1 on success, 0 otherwise. */
+YARN_C99_DEF int yarn_load_chapter(yarn_dialogue *dialogue, const char *chapter_name, void *program_buffer, size_t program_length);
+YARN_C99_DEF int yarn_unload_chapter(yarn_dialogue *dialogue, const char *chapter_name);
+
+/* manifest of node, 0 if there's no such node. */
+YARN_C99_DEF const yarn_node_manifest *yarn_get_node_manifest(yarn_dialogue *dialogue, const char *node_name);
+
+/* Prefetch functions. */
+YARN_C99_DEF yarn_prefetch_queue *yarn_create_prefetch_queue(int capacity);
+YARN_C99_DEF void                 yarn_destroy_prefetch_queue(yarn_prefetch_queue *queue);
+YARN_C99_DEF void                 yarn_close_prefetch_queue(yarn_prefetch_queue *queue);
+/* takes the oldest request. with wait, blocks until there's one. returns 0 if there's none, or queue is closed. */
+YARN_C99_DEF int                  yarn_prefetch_pop(yarn_prefetch_queue *queue, yarn_prefetch_request *request, int wait);
+YARN_C99_DEF void                 yarn_prefetch_done(yarn_prefetch_queue *queue, const yarn_prefetch_request *request); /* popped request is no longer used. */
+
 /* value related helpers. */
 /* makes value. */
 YARN_C99_DEF yarn_value yarn_none(void);
@@ -487,6 +1129,10 @@ YARN_C99_DEF float yarn_value_as_float(yarn_value value);
 YARN_C99_DEF char *yarn_tostring(yarn_value value);
 YARN_C99_DEF void  yarn_free_tostring(char *string);
 
+/* shortest text that reads back as the same float: 3 is "3", 0.1f is "0.1".
+ * scientific notation below 1E-05 and from 1E+15 up, like C# does. works like snprintf; never longer than 16 characters. */
+YARN_C99_DEF int yarn_format_number(float value, char *buffer, size_t capacity);
+
 /* check if yarn vm is currently running. */
 YARN_C99_DEF int yarn_is_active(yarn_dialogue *dialogue);
 
@@ -506,20 +1152,71 @@ YARN_C99_DEF void       yarn_push_value(yarn_dialogue *dialogue, yarn_value valu
 YARN_C99_DEF yarn_value yarn_load_variable(yarn_dialogue *dialogue, char *var_name);
 YARN_C99_DEF void       yarn_store_variable(yarn_dialogue *dialogue, char *var_name, yarn_value value);
 
+/* text of the line (before substitution), or 0 if table doesn't have it.
+ * decodes / decompresses it first in lazy / compressed table. see yarn_string_table for how long the pointer lives. */
+YARN_C99_DEF const char *yarn_get_line_text(yarn_string_table *table, const char *line_id);
+
 /* loads line, and performs substitution.
  * returned value must be freed with yarn_destroy_displayable_line.
  * */
 YARN_C99_DEF char *yarn_convert_to_displayable_line(yarn_string_table *table, yarn_line *line);
 YARN_C99_DEF void  yarn_destroy_displayable_line(char *line);
 
+/* same as above, but writes into buffer instead; never allocates. works like snprintf:
+ * returns length of the whole formatted line (without '\0'), writes as much as fits, and always
+ * null terminates if capacity > 0. so a return value >= capacity means it was cut short.
+ * returns -1 if table doesn't have the line.
+ *
+ *   char buffer[256];
+ *   int length = yarn_format_line_into(table, line, buffer, sizeof(buffer));
+ *   if (length >= (int)sizeof(buffer)) { ... retry with length + 1 bytes ... }
+ * */
+YARN_C99_DEF int yarn_format_line_into(yarn_string_table *table, yarn_line *line, char *buffer, size_t capacity);
+
+/* plural rules of locale ("en", "pt-BR"...); english for 0, and rules with only `other` for unknown languages. */
+YARN_C99_DEF const yarn_plural_rules *yarn_find_plural_rules(const char *locale);
+
+/* YARN_PLURAL_* of number (as text, e.g. "1.50"), cardinal or ordinal. YARN_PLURAL_OTHER if it isn't a number. */
+YARN_C99_DEF int         yarn_plural_category(const yarn_plural_rules *rules, const char *number, int ordinal);
+YARN_C99_DEF const char *yarn_plural_category_name(int category); /* "zero", "one"... "other" */
+
+/* markup of the line, or 0 if it has none (table must be loaded with table->markup set). owned by table. */
+YARN_C99_DEF const yarn_line_markup *yarn_get_line_markup(yarn_string_table *table, yarn_line *line);
+
+/* yarn_format_line_into, plus where each attribute of the line is in the formatted text.
+ * writes up to max_spans spans (markup's n_attributes is always enough), and sets *n_spans to how many.
+ *
+ *   yarn_markup_span spans[16];
+ *   int n_spans = 0;
+ *   int length = yarn_format_line_markup_into(table, line, buffer, sizeof(buffer), spans, 16, &n_spans);
+ *   // spans[i].attribute->name is "b", spans[i].position / length are in buffer.
+ * */
+YARN_C99_DEF int yarn_format_line_markup_into(yarn_string_table *table, yarn_line *line, char *buffer, size_t capacity,
+                                              yarn_markup_span *spans, int max_spans, int *n_spans);
+
+/* formatted line (with its markup spans) out of table's cache, formatting it if it's not there.
+ * 0 if line isn't in the table. must be given back with yarn_release_formatted_line. */
+YARN_C99_DEF const yarn_formatted_line *yarn_acquire_formatted_line(yarn_string_table *table, yarn_line *line);
+YARN_C99_DEF void                       yarn_release_formatted_line(yarn_string_table *table, const yarn_formatted_line *formatted);
+
 /* Function related stuff. */
 YARN_C99_DEF yarn_function_entry  yarn_get_function_with_name(yarn_dialogue *dialogue, char *funcname);
 YARN_C99_DEF int                  yarn_load_functions(yarn_dialogue *dialogue, yarn_func_reg *functions);
 
+/* registers command handler (see Yarn commands). returns 0 if name is already registered. */
+YARN_C99_DEF int yarn_register_command(yarn_dialogue *dialogue, const char *name, yarn_command_function *function, int param_count);
+
 /* allocator related stuff. */
 YARN_C99_DEF void *yarn_allocate(yarn_allocator *allocator, size_t size);
 YARN_C99_DEF void  yarn_clear_allocator(yarn_allocator *allocator);
 
+/* memory accounting. overwrites stats. returns 0 when it can't be measured. */
+YARN_C99_DEF int yarn_get_dialogue_memory_stats(yarn_dialogue *dialogue, yarn_memory_stats *stats);
+YARN_C99_DEF int yarn_get_chapter_memory_stats(yarn_dialogue *dialogue, const char *chapter_name, yarn_memory_stats *stats);
+YARN_C99_DEF int yarn_get_string_table_memory_stats(yarn_string_table *table, yarn_memory_stats *stats);
+YARN_C99_DEF int yarn_get_storage_memory_stats(yarn_variable_storage storage, yarn_memory_stats *stats); /* default storage only. */
+YARN_C99_DEF const char *yarn_memory_category_name(int category);
+
 /*
  * ====================================================
  * Internals
@@ -531,9 +1228,13 @@ YARN_C99_DEF void  yarn_clear_allocator(yarn_allocator *allocator);
  * TODO: string is not supported yet. */
 extern yarn_func_reg yarn__standard_libs[];
 
-/* Hashes string. */
+/* Hashes string of given length. */
 YARN_C99_DEF uint32_t yarn__hashstr(const char *str, size_t strlength);
 
+/* hash of frozen index. both halves are used: high one picks the bucket, low one the slot. */
+YARN_C99_DEF uint64_t yarn__mph_hash(const char *key, size_t length, uint32_t seed);
+YARN_C99_DEF uint32_t yarn__mph_slot(uint64_t hash, uint32_t displacement, uint32_t n_lines);
+
 /* strndup implementation that uses YARN_MALLOC. */
 YARN_C99_DEF char *yarn__strndup(const char *original, size_t length);
 
@@ -546,6 +1247,10 @@ YARN_C99_DEF char *yarn__tostring_alloc(yarn_allocator *allocator, yarn_value va
 /* Allocates new chunk with given size. */
 YARN_C99_DEF yarn_allocator_chunk *yarn__create_new_chunk(size_t size);
 
+/* returns last chunk of allocator with at least `size` bytes unused past chunk->used, appends one if needed.
+ * for building things in place; bump chunk->used yourself once it's done. */
+YARN_C99_DEF yarn_allocator_chunk *yarn__allocator_reserve(yarn_allocator *allocator, size_t size);
+
 /* tries to extend dynamic array. */
 YARN_C99_DEF int yarn__maybe_extend_dyn_array(void **ptr, size_t elem_size, size_t used, size_t *caps);
 
@@ -559,18 +1264,119 @@ YARN_C99_DEF int yarn__kvmap_pushsize(yarn_kvmap *map, const char *key, void *va
 /* get element from map, and write into value if given valid pointer. returns -1 if does not exist. */
 YARN_C99_DEF int yarn__kvmap_get(yarn_kvmap *map, const char *key, void *value, size_t element_size);
 
-/* delete element from map, and rearrange. */
+/* delete element from map, leaving a tombstone. */
 YARN_C99_DEF int yarn__kvmap_delete(yarn_kvmap *map, const char *key);
 
 /* recreate the whole map if the current map's used up space meets certain threshold. */
 YARN_C99_DEF int yarn__kvmap_maybe_rehash(yarn_kvmap *map);
 
+/* grows map so that count more keys fit without rehashing on the way. */
+YARN_C99_DEF void yarn__kvmap_reserve(yarn_kvmap *map, size_t count);
+YARN_C99_DEF void yarn__kvmap_resize(yarn_kvmap *map, size_t capacity);
+
 /* checks hashmap entry specified by at, and writes key/value into pointers.
  * returns at + 1 if it can be continued, -1 otherwise. */
 YARN_C99_DEF int yarn__kvmap_iternext(yarn_kvmap *map, char **key, void *value, size_t element_size, int at);
 
-/* allocates new string with substituted value for {0}, {1}, {2}... format. */
-YARN_C99_DEF char *yarn__substitute_string(char *format, char **substs, int n_substs);
+/* bucket holding key, -1 if there's none. */
+YARN_C99_DEF int yarn__kvmap_find(yarn_kvmap *map, const char *key, size_t keylen, uint32_t hash);
+
+/* lowest set bit. */
+YARN_C99_DEF uint32_t yarn__ctz32(uint32_t mask);
+
+/* memory accounting helpers. */
+YARN_C99_DEF void   yarn__stats_add(yarn_memory_stats *stats, int category, size_t bytes, size_t allocations);
+YARN_C99_DEF size_t yarn__stats_add_allocator(yarn_memory_stats *stats, yarn_allocator *allocator, size_t accounted_bytes); /* returns reserved bytes. */
+YARN_C99_DEF void   yarn__stats_add_kvmap(yarn_memory_stats *stats, yarn_kvmap *map);
+YARN_C99_DEF size_t yarn__stats_add_program(yarn_memory_stats *stats, struct Yarn__Program *program); /* returns counted bytes. */
+YARN_C99_DEF void   yarn__stats_sum(yarn_memory_stats *stats);
+
+/* unescapes raw csv field (with its quotes, if it was quoted) into dest. returns written length, without '\0'. */
+YARN_C99_DEF size_t yarn__csv_unescape(char *dest, const char *field, size_t length);
+
+/* frees the parser of yarn_string_table_feed, if there's any. */
+YARN_C99_DEF void yarn__stop_feeding(yarn_string_table *table);
+
+/* header of line in string table (through frozen index, if there's one), 0 if there's no such line. */
+YARN_C99_DEF yarn_kvpair_header *yarn__find_line(yarn_string_table *table, const char *line_id);
+
+/* one attempt at frozen index with given seed. returns 0 (and leaves index empty) if some bucket couldn't be placed. */
+YARN_C99_DEF int yarn__build_frozen_index(yarn_frozen_index *index, yarn_kvmap *map, uint32_t seed);
+
+/* text of line (decoding / decompressing it if needed). */
+YARN_C99_DEF const char *yarn__line_text(yarn_string_table *table, yarn_kvpair_header *header);
+
+/* gives every line id of chapter a dense index in dialogue, and fills chapter->line_indexes. */
+YARN_C99_DEF void yarn__index_chapter_lines(yarn_dialogue *dialogue, yarn_chapter *chapter);
+
+/* resolves dense line indexes of dialogue that table hasn't seen yet. returns 0 if some were missing. */
+YARN_C99_DEF int yarn__bind_lines(yarn_dialogue *dialogue, yarn_string_table *table);
+
+/* dense line index of the instruction being run. */
+YARN_C99_DEF int yarn__current_line_index(yarn_dialogue *dialogue);
+
+/* tokenizes every RUN_COMMAND of chapter into chapter->commands. */
+YARN_C99_DEF void yarn__tokenize_chapter_commands(yarn_chapter *chapter);
+
+/* builds chapter->manifests, following jumps up to depth. */
+YARN_C99_DEF void yarn__build_manifests(yarn_chapter *chapter, int depth);
+
+/* queues request, dropping the oldest one if queue is full. */
+YARN_C99_DEF void yarn__prefetch_push(yarn_prefetch_queue *queue, const char *node_name, const yarn_node_manifest *manifest);
+
+/* drops queued requests for manifests of chapter, and waits until none of its popped ones is being worked on. */
+YARN_C99_DEF void yarn__prefetch_forget(yarn_prefetch_queue *queue, yarn_chapter *chapter);
+
+/* runs RUN_COMMAND: registered command if there's one, command_handler otherwise. */
+YARN_C99_DEF void yarn__run_command(yarn_dialogue *dialogue, struct Yarn__Instruction *inst, yarn_value *substitutions, int n_substitutions);
+
+/* adds markup / template of entry to stats. returns bytes they take in table allocator. */
+YARN_C99_DEF size_t yarn__stats_add_line_format(yarn_memory_stats *stats, yarn_parsed_entry *entry);
+
+/* decodes text of entry in lazy table, keeping it in cache or allocator. */
+YARN_C99_DEF char *yarn__decode_lazy_text(yarn_string_table *table, char *line_id, yarn_parsed_entry *entry);
+
+/* decompresses block of entry in compressed table (if it's not cached), and returns the text inside. */
+YARN_C99_DEF char *yarn__decode_compressed_text(yarn_string_table *table, yarn_parsed_entry *entry);
+
+/* text of value as it's substituted; number is scratch of YARN__NUMBER_CAPACITY bytes. */
+YARN_C99_DEF const char *yarn__value_text(yarn_value value, char *number, size_t *length);
+
+/* new string in allocator, with values substituted for {0}, {1}, {2}... of format. */
+YARN_C99_DEF char *yarn__substitute_values(yarn_allocator *allocator, const char *format, yarn_value *values, int n_values);
+
+/* writes shortest round trip text of value into out (at least YARN__NUMBER_CAPACITY bytes). returns its length. */
+YARN_C99_DEF size_t yarn__format_float(float value, char *out);
+#define YARN__NUMBER_CAPACITY 32
+
+/* substitutes into buffer, snprintf-like (see yarn_format_line_into). returns full length.
+ * `{` that doesn't start a valid placeholder ({digits} below n_substs) is kept as it is. */
+YARN_C99_DEF size_t yarn__substitute_into(const char *format, yarn_value *substs, int n_substs, char *buffer, size_t capacity);
+
+/* table entry of the line; through the bound index if line is from the bound dialogue. */
+YARN_C99_DEF yarn_kvpair_header *yarn__displayable_line(yarn_string_table *table, yarn_line *line, int *bound);
+
+/* formats text of the line into buffer, snprintf-like, through its template if it has one. returns full length. */
+YARN_C99_DEF size_t yarn__format_text(const char *text, yarn_line_template *format, yarn_line *line, const yarn_plural_rules *plurals, char *buffer, size_t capacity);
+
+/* position in template text -> position in text formatted with substitutions of line. */
+YARN_C99_DEF uint32_t yarn__format_position(yarn_line_template *format, yarn_line *line, const yarn_plural_rules *plurals, uint32_t position);
+
+/* spans of markup attributes in text formatted with line. writes up to max_spans, returns how many. */
+YARN_C99_DEF int yarn__markup_spans(yarn_parsed_entry *entry, yarn_line *line, const yarn_plural_rules *plurals, yarn_markup_span *spans, int max_spans);
+
+/* drops every formatted line in table's cache; acquired ones live until they're released. */
+YARN_C99_DEF void yarn__flush_format_cache(yarn_string_table *table);
+
+/* drops formatted lines over format_cache_lines, and sizes buckets for it. */
+YARN_C99_DEF void yarn__resize_format_cache(yarn_string_table *table);
+
+/* table->plurals, picking them by table's locale if they aren't yet. */
+YARN_C99_DEF const yarn_plural_rules *yarn__table_plurals(yarn_string_table *table);
+
+/* writes template with substitutions into buffer, snprintf-like. returns full length. */
+YARN_C99_DEF size_t yarn__format_template(const char *text, yarn_line_template *format, yarn_value *substs, int n_substs,
+                                          const yarn_plural_rules *plurals, char *buffer, size_t capacity);
 
 /* parses csv and loads up into string repo. */
 YARN_C99_DEF int yarn__load_string_table(yarn_string_table *table, void *string_table_buffer, size_t string_table_length);
@@ -584,6 +1390,25 @@ YARN_C99_DEF void yarn__run_instruction(yarn_dialogue *dialogue, struct Yarn__In
  */
 YARN_C99_DEF int yarn__find_instruction_point_for_label(yarn_dialogue *dialogue, char *label);
 
+/* finds locale index by it's name. returns -1 if not found. */
+YARN_C99_DEF int yarn__find_locale(yarn_locale_manager *manager, const char *locale);
+
+/* measures resident tables, then destroys least recently used ones until they fit the budget. never touches `keep` and current. */
+YARN_C99_DEF void yarn__evict_locales(yarn_locale_manager *manager, int keep);
+
+/* finds chapter index by it's name. returns -1 if not found. */
+YARN_C99_DEF int yarn__find_chapter(yarn_dialogue *dialogue, const char *chapter_name);
+
+/* decodes program into chapter->program, allocating from chapter->allocators.
+ * node entries are decoded on up to n_threads threads. returns 1 on success, 0 otherwise. */
+YARN_C99_DEF int yarn__decode_program(yarn_chapter *chapter, const uint8_t *buffer, size_t length, int n_threads);
+
+/* frees everything chapter owns. */
+YARN_C99_DEF void yarn__destroy_chapter(yarn_chapter *chapter);
+
+/* recreates dialogue->node_index from every loaded chapter. */
+YARN_C99_DEF void yarn__rebuild_node_index(yarn_dialogue *dialogue);
+
 /* Resets the state of the dialogue. */
 YARN_C99_DEF void yarn__reset_state(yarn_dialogue *dialogue);
 
@@ -636,8 +1461,33 @@ YARN_C99_DEF void       yarn__save_into_default_storage(void *istorage, char *va
 #include <assert.h>
 #include <stdarg.h> /* for logging */
 #include <string.h> /* for strncmp, memset */
+#include <stdlib.h> /* for strtof */
 #include <stdio.h>  /* TODO: @cleanup cleanup. basically here for printf debugging */
 
+#if defined(YARN_C99_THREADS)
+  #if defined(_WIN32)
+    #include <windows.h>
+  #else
+    #include <pthread.h>
+  #endif
+#endif
+
+/* vector scanning for csv and kvmap probing. #define YARN_C99_NO_SIMD to force scalar path. */
+#if !defined(YARN_C99_NO_SIMD)
+  #if defined(__AVX2__)
+    #include <immintrin.h>
+    #define YARN__SIMD_AVX2
+    #define YARN__SIMD_SSE2
+  #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define YARN__SIMD_SSE2
+  #endif
+#endif
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
 #if !defined(YARN_MALLOC) || !defined(YARN_FREE) || !defined(YARN_REALLOC)
   #if !defined(YARN_MALLOC) && !defined(YARN_FREE) && !defined(YARN_REALLOC)
     #include <stdlib.h>
@@ -657,6 +1507,10 @@ YARN_C99_DEF void       yarn__save_into_default_storage(void *istorage, char *va
 #define YARN_STATIC_ASSERT(cond, ident_message) \
     typedef char YARN_CONCAT(yarn_static_assert_line_, YARN_CONCAT(ident_message, __LINE__))[(cond) ? 1 : -1];
 
+/* header of the bucket, and value of the bucket header belongs to. */
+#define YARN__KV_INDEXOF(pmap, idx) (&(pmap)->entries[(idx)])
+#define YARN__KV_VALUEOF(pmap, header) (void *)((pmap)->values + (size_t)((header) - (pmap)->entries) * (pmap)->element_size)
+
 /*
  * Dynamic array stuff.
  */
@@ -680,9 +1534,6 @@ YARN_C99_DEF void       yarn__save_into_default_storage(void *istorage, char *va
 
 
 yarn_function_entry yarn_get_function_with_name(yarn_dialogue *dialogue, char *funcname) {
-    size_t length = strlen(funcname);
-    uint32_t hash = yarn__hashstr(funcname, length);
-
     yarn_function_entry entry = {0};
     int exists = yarn_kvget(&dialogue->library, funcname, &entry);
 
@@ -764,12 +1615,8 @@ char *yarn_tostring(yarn_value value) {
 
         case YARN_VALUE_FLOAT:
         {
-            char temp[1024] = {0};
-            int _length = snprintf(temp, sizeof(temp)-1, "%f", value.values.v_float);
-
-            assert(_length > 0);
-            size_t length = _length;
-
+            char temp[YARN__NUMBER_CAPACITY];
+            size_t length = yarn__format_float(value.values.v_float, temp);
             return yarn__strndup(temp, length);
         } break;
 
@@ -850,29 +1697,72 @@ int yarn_continue(yarn_dialogue *dialogue) {
 
 /* TODO: subject to cleanup. */
 char *yarn_convert_to_displayable_line(yarn_string_table *table, yarn_line *line) {
-    size_t given_id_length = strlen(line->id);
-    char *result = 0;
-
-    yarn_parsed_entry entry = {0};
-    if (yarn_kvget(&table->table, line->id, &entry) != -1) {
-        result = entry.text;
-    }
-
-    if (result) {
-        if (line->n_substitutions > 0) {
-            result = yarn__substitute_string(result, line->substitutions, line->n_substitutions);
-        } else {
-            /* so you can still free it with `yarn_destroy_displayable_line` */
-            result = yarn__strndup(result, strlen(result));
+    int bound = 0;
+    yarn_kvpair_header *header = yarn__displayable_line(table, line, &bound);
+    const char *text = header ? yarn__line_text(table, header) : 0;
+
+    if (!text) {
+        if (!bound) {
+            printf("error: line id %s does not exist in table.\n", line->id);
+            printf("error: the line will still be consumed\n");
         }
-    } else {
-        printf("error: line id %s does not exist in table.\n", line->id);
-        printf("error: the line will still be consumed\n");
+        return 0;
     }
 
+    /* measure, then write into exactly that much. still freed with `yarn_destroy_displayable_line`. */
+    yarn_line_template *format = ((yarn_parsed_entry *)YARN__KV_VALUEOF(&table->table, header))->format;
+    const yarn_plural_rules *plurals = yarn__table_plurals(table);
+    size_t length = yarn__format_text(text, format, line, plurals, 0, 0);
+    char *result  = (char *)YARN_MALLOC(length + 1);
+    yarn__format_text(text, format, line, plurals, result, length + 1);
     return result;
 }
 
+int yarn_format_line_into(yarn_string_table *table, yarn_line *line, char *buffer, size_t capacity) {
+    int bound = 0;
+    yarn_kvpair_header *header = yarn__displayable_line(table, line, &bound);
+    const char *text = header ? yarn__line_text(table, header) : 0;
+    if (!text) return -1;
+
+    return (int)yarn__format_text(text, ((yarn_parsed_entry *)YARN__KV_VALUEOF(&table->table, header))->format, line, yarn__table_plurals(table), buffer, capacity);
+}
+
+const yarn_line_markup *yarn_get_line_markup(yarn_string_table *table, yarn_line *line) {
+    int bound = 0;
+    yarn_kvpair_header *header = yarn__displayable_line(table, line, &bound);
+    return header ? ((yarn_parsed_entry *)YARN__KV_VALUEOF(&table->table, header))->markup : 0;
+}
+
+int yarn_format_line_markup_into(yarn_string_table *table, yarn_line *line, char *buffer, size_t capacity,
+                                 yarn_markup_span *spans, int max_spans, int *n_spans) {
+    *n_spans = 0;
+
+    int bound = 0;
+    yarn_kvpair_header *header = yarn__displayable_line(table, line, &bound);
+    const char *text = header ? yarn__line_text(table, header) : 0;
+    if (!text) return -1;
+
+    yarn_parsed_entry *entry = (yarn_parsed_entry *)YARN__KV_VALUEOF(&table->table, header);
+    const yarn_plural_rules *plurals = yarn__table_plurals(table);
+    size_t length = yarn__format_text(text, entry->format, line, plurals, buffer, capacity);
+
+    *n_spans = yarn__markup_spans(entry, line, plurals, spans, max_spans);
+    return (int)length;
+}
+
+yarn_kvpair_header *yarn__displayable_line(yarn_string_table *table, yarn_line *line, int *bound) {
+    /* line of the bound dialogue: no hashing, and missing lines were already reported at bind. */
+    *bound = line->line_index >= 0 &&
+             (size_t)line->line_index < table->bound_lines.used &&
+             table->bound_lines.entries[line->line_index].line_id == line->id;
+
+    if (*bound) {
+        int bucket = table->bound_lines.entries[line->line_index].bucket;
+        return (bucket == -1) ? 0 : YARN__KV_INDEXOF(&table->table, bucket);
+    }
+    return yarn__find_line(table, line->id);
+}
+
 void yarn_destroy_displayable_line(char *line) {
     YARN_FREE(line);
 }
@@ -882,45 +1772,33 @@ int yarn_is_active(yarn_dialogue *dialogue) {
 }
 
 int yarn_set_node(yarn_dialogue *dialogue, char *node_name) {
-    assert(dialogue->program && dialogue->program->n_nodes > 0);
-    size_t length = strlen(node_name);
-    int index = -1;
-
-    struct Yarn__Node *node = 0;
-    for (int i = 0; i < dialogue->program->n_nodes; ++i) {
-        if (strncmp(dialogue->program->nodes[i]->key, node_name, length) == 0) {
-            index = i;
-            node = dialogue->program->nodes[i]->value;
-            break;
-        }
-    }
+    assert(dialogue->chapters.used > 0);
 
-    if (index == -1) {
+    yarn_node_ref ref = {0};
+    if (yarn_kvget(&dialogue->node_index, node_name, &ref) == -1) {
         yarn__logerror(dialogue, "No node named %s", node_name);
         return -1;
     }
 
+    yarn_chapter *chapter = &dialogue->chapters.entries[ref.chapter];
+    int index = ref.node;
+
     yarn__reset_state(dialogue);
-    dialogue->current_node = index;
+    dialogue->program         = chapter->program;
+    dialogue->current_chapter = ref.chapter;
+    dialogue->current_node    = index;
 
     yarn__logdebug(dialogue, "Running node %s", node_name);
     if (dialogue->node_start_handler) {
         dialogue->node_start_handler(dialogue, node_name);
-        if (dialogue->prepare_for_lines_handler) {
-            char **ids = (char **)YARN_MALLOC(sizeof(void *) * node->n_instructions);
-            int n_ids = 0;
-            for (int i = 0; i < node->n_instructions; ++i) {
-                struct Yarn__Instruction *inst = node->instructions[i];
-                if(inst->opcode == YARN__INSTRUCTION__OP_CODE__RUN_LINE ||
-                   inst->opcode == YARN__INSTRUCTION__OP_CODE__ADD_OPTION)
-                {
-                    ids[n_ids++] = inst->operands[0]->string_value;
-                }
+    }
 
-            }
-            dialogue->prepare_for_lines_handler(dialogue, ids, n_ids);
-            YARN_FREE(ids);
-        }
+    yarn_node_manifest *manifest = &chapter->manifests[index];
+    if (dialogue->prepare_for_lines_handler) {
+        dialogue->prepare_for_lines_handler(dialogue, manifest->ids, manifest->n_ids);
+    }
+    if (dialogue->prefetch) {
+        yarn__prefetch_push(dialogue->prefetch, chapter->program->nodes[index]->key, manifest);
     }
 
     return dialogue->current_node;
@@ -951,6 +1829,10 @@ yarn_dialogue *yarn_create_dialogue(yarn_variable_storage storage) {
     dialogue->storage = storage;
     dialogue->dialogue_allocator = yarn_create_allocator(4 * 1024); /* 4 kb should be enough for initial allocator. */
 
+    dialogue->load_threads        = 1;
+    dialogue->manifest_depth      = 0;
+    dialogue->prefetch            = 0;
+    dialogue->current_chapter     = 0;
     dialogue->current_node        = 0;
     dialogue->current_instruction = 0;
     dialogue->execution_state     = YARN_EXEC_STOPPED;
@@ -968,19 +1850,35 @@ yarn_dialogue *yarn_create_dialogue(yarn_variable_storage storage) {
     dialogue->dialogue_complete_handler = &yarn__stub_dialogue_complete_handler;
     dialogue->prepare_for_lines_handler = &yarn__stub_prepare_for_lines_handler;
 
-    dialogue->library = yarn_kvcreate(yarn_function_entry, 32);
+    dialogue->library    = yarn_kvcreate(yarn_function_entry, 32);
+    dialogue->commands   = yarn_kvcreate(yarn_command_entry, 16);
+    dialogue->node_index = yarn_kvcreate(yarn_node_ref, 64);
+    dialogue->line_index = yarn_kvcreate(int, 64);
+    dialogue->line_index.borrowed_keys = 1;
+    dialogue->line_allocator = yarn_create_allocator(4 * 1024);
+    YARN_MAKE_DYNARRAY(&dialogue->line_ids, char *, 64);
     YARN_MAKE_DYNARRAY(&dialogue->current_options, yarn_option, 32);
+    YARN_MAKE_DYNARRAY(&dialogue->chapters, yarn_chapter, 4);
 
     yarn_load_functions(dialogue, yarn__standard_libs);
     return dialogue;
 }
 
 void yarn_destroy_dialogue(yarn_dialogue *dialogue) {
-    if (dialogue->program)
-        yarn__program__free_unpacked(dialogue->program, 0); /* TODO: @allocator */
+    for (size_t i = 0; i < dialogue->chapters.used; ++i) {
+        yarn_chapter *chapter = &dialogue->chapters.entries[i];
+        if (dialogue->prefetch) yarn__prefetch_forget(dialogue->prefetch, chapter);
+        yarn__destroy_chapter(chapter);
+    }
 
     yarn_destroy_allocator(dialogue->dialogue_allocator);
     yarn_kvdestroy(&dialogue->library);
+    yarn_kvdestroy(&dialogue->commands);
+    yarn_kvdestroy(&dialogue->node_index);
+    yarn_kvdestroy(&dialogue->line_index);
+    yarn_destroy_allocator(dialogue->line_allocator);
+    YARN_FREE(dialogue->line_ids.entries);
+    YARN_FREE(dialogue->chapters.entries);
     YARN_FREE(dialogue->current_options.entries);
     YARN_FREE(dialogue);
 }
@@ -1010,22 +1908,46 @@ void yarn_destroy_default_storage(yarn_variable_storage storage) {
 
 yarn_string_table *yarn_create_string_table() {
     yarn_string_table *table = (yarn_string_table *)YARN_MALLOC(sizeof(yarn_string_table));
+    memset(table, 0, sizeof(yarn_string_table));
 
+    table->columns = YARN_COLUMN_ALL;
     table->table = yarn_kvcreate(yarn_parsed_entry, 512);
+    table->table.borrowed_keys = 1;
+    table->allocator = yarn_create_allocator(4 * 1024); /* grows to the size of csv on load. */
+
+    table->interned_ids = yarn_kvcreate(int, 64);
+    table->interned_ids.borrowed_keys = 1;
+    YARN_MAKE_DYNARRAY(&table->interned, char *, 64);
     return table;
 }
 
 void yarn_destroy_string_table(yarn_string_table *table) {
-    char *key = 0;
-    yarn_parsed_entry value = {0};
+    yarn__stop_feeding(table); /* in case it was never finished. */
+    assert(table->format_acquired == 0);
+    yarn__flush_format_cache(table);
+    if (table->format_buckets) YARN_FREE(table->format_buckets);
+
+    for (int i = 0; i < table->lazy_used; ++i) {
+        YARN_FREE(table->lazy_slots[i].text);
+    }
+    if (table->lazy_slots) YARN_FREE(table->lazy_slots);
 
-    yarn_kvforeach(&table->table, &key, &value) {
-        YARN_FREE(value.text);
-        YARN_FREE(value.file);
-        YARN_FREE(value.node);
+    for (int i = 0; i < YARN_TEXT_BLOCK_CACHE; ++i) {
+        if (table->block_cache[i].text) YARN_FREE(table->block_cache[i].text);
     }
+    if (table->text_blocks.entries)     YARN_FREE(table->text_blocks.entries);
+    if (table->compressed_text.entries) YARN_FREE(table->compressed_text.entries);
+    if (table->staged_text.entries)     YARN_FREE(table->staged_text.entries);
+    if (table->frozen.slots) {
+        YARN_FREE(table->frozen.displacements);
+        YARN_FREE(table->frozen.slots);
+    }
+    if (table->bound_lines.entries) YARN_FREE(table->bound_lines.entries);
 
     yarn_kvdestroy(&table->table);
+    yarn_kvdestroy(&table->interned_ids);
+    YARN_FREE(table->interned.entries);
+    yarn_destroy_allocator(table->allocator);
     YARN_FREE(table);
 }
 
@@ -1097,23 +2019,7 @@ void *yarn_allocate(yarn_allocator *allocator, size_t size) {
         }
     }
 
-    size_t next_cap = allocator->next_caps;
-    allocator->next_caps *= 2;
-    while(next_cap < size) {
-        next_cap = allocator->next_caps;
-        allocator->next_caps *= 2;
-    }
-
-    yarn_allocator_chunk *chunk = YARN_MALLOC(sizeof(yarn_allocator_chunk));
-    chunk->used = 0;
-    chunk->capacity = next_cap;
-    chunk->buffer = YARN_MALLOC(next_cap);
-
-    chunk->prev = allocator->sentinel->prev;
-    chunk->next = allocator->sentinel;
-
-    allocator->sentinel->prev->next = chunk;
-    allocator->sentinel->prev = chunk;
+    yarn_allocator_chunk *chunk = yarn__allocator_reserve(allocator, size + 16);
 
     uintptr_t ptr = (uintptr_t)chunk->buffer;
     if ((ptr & 15) != 0) {
@@ -1126,6 +2032,39 @@ void *yarn_allocate(yarn_allocator *allocator, size_t size) {
     return (void *)ptr;
 }
 
+yarn_allocator_chunk *yarn__create_new_chunk(size_t size) {
+    yarn_allocator_chunk *chunk = YARN_MALLOC(sizeof(yarn_allocator_chunk));
+    chunk->used     = 0;
+    chunk->capacity = size;
+    chunk->buffer   = YARN_MALLOC(size);
+    chunk->prev     = 0;
+    chunk->next     = 0;
+    return chunk;
+}
+
+yarn_allocator_chunk *yarn__allocator_reserve(yarn_allocator *allocator, size_t size) {
+    yarn_allocator_chunk *last = allocator->sentinel->prev;
+    if (last->buffer != 0 && (last->capacity - last->used) >= size) {
+        return last;
+    }
+
+    /* oversized request gets a chunk of its own size, instead of doubling up to it. */
+    size_t next_cap = allocator->next_caps;
+    if (next_cap < size) {
+        next_cap = size;
+    } else {
+        allocator->next_caps *= 2;
+    }
+
+    yarn_allocator_chunk *chunk = yarn__create_new_chunk(next_cap);
+    chunk->prev = allocator->sentinel->prev;
+    chunk->next = allocator->sentinel;
+
+    allocator->sentinel->prev->next = chunk;
+    allocator->sentinel->prev = chunk;
+    return chunk;
+}
+
 void yarn_clear_allocator(yarn_allocator *allocator) {
     /* Clear entire allocator and coalesce. */
     size_t total_size = 0;
@@ -1180,20 +2119,124 @@ int yarn_load_functions(yarn_dialogue *dialogue, yarn_func_reg *loading_function
     return inserted;
 }
 
+int yarn_register_command(yarn_dialogue *dialogue, const char *name, yarn_command_function *function, int param_count) {
+    assert(name && function);
+    if (yarn_kvhas(&dialogue->commands, name)) {
+        yarn__logerror(dialogue, "command `%s` is already registered", name);
+        return 0;
+    }
+
+    yarn_command_entry entry = {0};
+    entry.function    = function;
+    entry.param_count = param_count;
+    yarn_kvpush(&dialogue->commands, name, entry);
+    return 1;
+}
+
 int yarn_load_program(
     yarn_dialogue *dialogue,
     void *program_buffer,
     size_t program_length)
 {
-    if(dialogue->program != 0) {
-        yarn__program__free_unpacked(dialogue->program, 0); /* TODO: @allocator */
+    /* NOTE: replaces everything, as it used to be before chapters. */
+    while(dialogue->chapters.used > 0) {
+        yarn_chapter *chapter = &dialogue->chapters.entries[dialogue->chapters.used - 1];
+        if (dialogue->prefetch) yarn__prefetch_forget(dialogue->prefetch, chapter);
+        yarn__destroy_chapter(chapter);
+        dialogue->chapters.used--;
+    }
+    dialogue->program         = 0;
+    dialogue->current_chapter = 0;
+    dialogue->current_node    = 0;
+    yarn__rebuild_node_index(dialogue);
+
+    return yarn_load_chapter(dialogue, YARN_DEFAULT_CHAPTER, program_buffer, program_length);
+}
+
+int yarn_load_chapter(
+    yarn_dialogue *dialogue,
+    const char *chapter_name,
+    void *program_buffer,
+    size_t program_length)
+{
+    assert(chapter_name);
+    if (yarn__find_chapter(dialogue, chapter_name) != -1) {
+        yarn__logerror(dialogue, "chapter `%s` is already loaded", chapter_name);
+        return 0;
+    }
+
+    yarn_chapter chapter = {0};
+    if (!yarn__decode_program(&chapter, (const uint8_t *)program_buffer, program_length, dialogue->load_threads)) {
+        yarn__logerror(dialogue, "could not unpack program for chapter `%s`", chapter_name);
+        return 0;
+    }
+
+    /* node names are shared across chapters; refuse the whole chapter on conflict. */
+    struct Yarn__Program *program = chapter.program;
+    for (size_t i = 0; i < program->n_nodes; ++i) {
+        if (yarn_kvhas(&dialogue->node_index, program->nodes[i]->key)) {
+            yarn__logerror(dialogue, "chapter `%s` redefines node `%s`", chapter_name, program->nodes[i]->key);
+            yarn__destroy_chapter(&chapter);
+            return 0;
+        }
+    }
+
+    yarn__tokenize_chapter_commands(&chapter);
+    yarn__build_manifests(&chapter, dialogue->manifest_depth);
+    chapter.name = yarn__strndup(chapter_name, strlen(chapter_name));
+    YARN_DYNARR_APPEND(&dialogue->chapters, chapter);
+
+    /* line indexes are only worth building for a bound table. */
+    if (dialogue->strings && dialogue->strings->bound_to == dialogue) {
+        yarn__index_chapter_lines(dialogue, &dialogue->chapters.entries[dialogue->chapters.used - 1]);
+        yarn__bind_lines(dialogue, dialogue->strings);
+    }
+
+    yarn_node_ref ref = {0};
+    ref.chapter = (int)dialogue->chapters.used - 1;
+    for (size_t i = 0; i < program->n_nodes; ++i) {
+        ref.node = (int)i;
+        yarn_kvpush(&dialogue->node_index, program->nodes[i]->key, ref);
     }
 
-    dialogue->program = yarn__program__unpack(
-        0, /* TODO: @allocator */
-        program_length,
-        (const uint8_t *)program_buffer);
+    if (!dialogue->program) {
+        dialogue->program         = program;
+        dialogue->current_chapter = ref.chapter;
+        dialogue->current_node    = 0;
+    }
+
+    return 1;
+}
+
+int yarn_unload_chapter(yarn_dialogue *dialogue, const char *chapter_name) {
+    int index = yarn__find_chapter(dialogue, chapter_name);
+    if (index == -1) {
+        yarn__logerror(dialogue, "chapter `%s` is not loaded", chapter_name);
+        return 0;
+    }
 
+    if (yarn_is_active(dialogue) && dialogue->current_chapter == index) {
+        yarn__logerror(dialogue, "cannot unload chapter `%s` while it's running", chapter_name);
+        return 0;
+    }
+
+    yarn_chapter *chapter = &dialogue->chapters.entries[index];
+    if (dialogue->prefetch) yarn__prefetch_forget(dialogue->prefetch, chapter);
+    yarn__destroy_chapter(chapter);
+
+    size_t remaining = dialogue->chapters.used - (size_t)index - 1;
+    memmove(chapter, chapter + 1, sizeof(yarn_chapter) * remaining);
+    dialogue->chapters.used--;
+
+    if (dialogue->current_chapter > index) {
+        dialogue->current_chapter--;
+    } else if (dialogue->current_chapter == index) {
+        dialogue->current_chapter = 0;
+        dialogue->current_node    = 0;
+        dialogue->program = (dialogue->chapters.used > 0) ? dialogue->chapters.entries[0].program : 0;
+    }
+
+    yarn__rebuild_node_index(dialogue);
     return 1;
 }
 
@@ -1203,15 +2246,300 @@ int yarn_load_string_table(yarn_string_table *str_table, void *csv, size_t csv_s
     return 1;
 }
 
+const char *yarn_get_line_text(yarn_string_table *table, const char *line_id) {
+    yarn_kvpair_header *header = yarn__find_line(table, line_id);
+    if (!header) return 0;
+    return yarn__line_text(table, header);
+}
+
+const char *yarn_get_line_text_by_index(yarn_string_table *table, int line_index) {
+    if (line_index < 0 || (size_t)line_index >= table->bound_lines.used) return 0;
+
+    int bucket = table->bound_lines.entries[line_index].bucket;
+    if (bucket == -1) return 0;
+    return yarn__line_text(table, YARN__KV_INDEXOF(&table->table, bucket));
+}
+
+int yarn_bind_string_table(yarn_dialogue *dialogue, yarn_string_table *table) {
+    for (size_t i = 0; i < dialogue->chapters.used; ++i) {
+        if (!dialogue->chapters.entries[i].line_indexes) yarn__index_chapter_lines(dialogue, &dialogue->chapters.entries[i]);
+    }
+
+    dialogue->strings = table;
+    if (table->bound_to != dialogue) {
+        table->bound_to = dialogue;
+        table->bound_lines.used = 0;
+    }
+    return yarn__bind_lines(dialogue, table);
+}
+
+const char *yarn__line_text(yarn_string_table *table, yarn_kvpair_header *header) {
+    /* in place, so the lazy decode sticks. */
+    yarn_parsed_entry *entry = (yarn_parsed_entry *)YARN__KV_VALUEOF(&table->table, header);
+    if (entry->text) return entry->text;
+    if (table->lazy) return yarn__decode_lazy_text(table, header->key, entry);
+    if (table->compress && entry->text_slot != -1) return yarn__decode_compressed_text(table, entry);
+    return 0;
+}
+
+yarn_kvpair_header *yarn__find_line(yarn_string_table *table, const char *line_id) {
+    yarn_frozen_index *index = &table->frozen;
+    if (!index->slots) {
+        int bucket = yarn__kvmap_get(&table->table, line_id, 0, 0);
+        return (bucket == -1) ? 0 : YARN__KV_INDEXOF(&table->table, bucket);
+    }
+
+    size_t   length = strlen(line_id);
+    uint64_t hash   = yarn__mph_hash(line_id, length, index->seed);
+    uint32_t slot   = yarn__mph_slot(hash, index->displacements[(uint32_t)(hash >> 32) % index->n_buckets], index->n_lines);
+
+    /* every slot is taken, so an unknown id lands on some other line: one compare tells. */
+    yarn_kvpair_header *header = YARN__KV_INDEXOF(&table->table, index->slots[slot]);
+    if (header->keylen != length || memcmp(header->key, line_id, length) != 0) return 0;
+    return header;
+}
+
+int yarn_freeze_string_table(yarn_string_table *table) {
+    if (table->feeding) {
+        printf("error: can't freeze string table in the middle of feeding\n");
+        return 0;
+    }
+    if (table->frozen.slots) return 1;
+    if (table->table.used == 0 || table->table.used > 0x7fffffff) return 0;
+
+    /* a seed fails only if two ids of a bucket collide on the full hash; next one won't. */
+    for (uint32_t seed = 0; seed < 8; ++seed) {
+        if (yarn__build_frozen_index(&table->frozen, &table->table, seed)) return 1;
+    }
+
+    printf("error: couldn't build frozen index of string table\n");
+    return 0;
+}
+
+int yarn__build_frozen_index(yarn_frozen_index *index, yarn_kvmap *map, uint32_t seed) {
+    uint32_t n_lines   = (uint32_t)map->used;
+    uint32_t n_buckets = (n_lines + 2) / 3; /* ~3 keys per bucket: bigger ones make the index smaller, but slower to build. */
+
+    uint64_t *hashes  = (uint64_t *)YARN_MALLOC(sizeof(uint64_t) * n_lines);
+    uint32_t *entries = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * n_lines);       /* key -> bucket of map */
+    uint32_t *members = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * n_lines);       /* keys, grouped by bucket */
+    uint32_t *first   = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * (n_buckets + 1)); /* bucket -> its first member */
+    uint32_t *cursor  = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * n_buckets);
+    uint32_t *order   = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * n_buckets);
+    uint8_t  *taken   = (uint8_t  *)YARN_MALLOC(n_lines);
+
+    index->n_lines       = n_lines;
+    index->n_buckets     = n_buckets;
+    index->seed          = seed;
+    index->displacements = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * n_buckets);
+    index->slots         = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * n_lines);
+
+    uint32_t n = 0;
+    for (size_t b = 0; b < map->capacity; ++b) {
+        yarn_kvpair_header *header = YARN__KV_INDEXOF(map, b);
+        if (!header->key) continue;
+        hashes[n]  = yarn__mph_hash(header->key, header->keylen, seed);
+        entries[n] = (uint32_t)b;
+        n++;
+    }
+
+    /* group keys by bucket (counting sort). */
+    memset(first, 0, sizeof(uint32_t) * (n_buckets + 1));
+    for (uint32_t k = 0; k < n_lines; ++k) first[(uint32_t)(hashes[k] >> 32) % n_buckets + 1]++;
+    uint32_t max_size = 0;
+    for (uint32_t b = 0; b < n_buckets; ++b) {
+        if (first[b + 1] > max_size) max_size = first[b + 1];
+        first[b + 1] += first[b];
+    }
+    memcpy(cursor, first, sizeof(uint32_t) * n_buckets);
+    for (uint32_t k = 0; k < n_lines; ++k) members[cursor[(uint32_t)(hashes[k] >> 32) % n_buckets]++] = k;
+
+    /* biggest buckets first, while most slots are still free. */
+    uint32_t *by_size = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * (max_size + 2));
+    memset(by_size, 0, sizeof(uint32_t) * (max_size + 2));
+    for (uint32_t b = 0; b < n_buckets; ++b) by_size[max_size - (first[b + 1] - first[b]) + 1]++;
+    for (uint32_t s = 0; s <= max_size; ++s) by_size[s + 1] += by_size[s];
+    for (uint32_t b = 0; b < n_buckets; ++b) order[by_size[max_size - (first[b + 1] - first[b])]++] = b;
+
+    uint32_t *positions = (uint32_t *)YARN_MALLOC(sizeof(uint32_t) * (max_size + 1));
+    memset(taken, 0, n_lines);
+
+    int      result    = 1;
+    uint32_t next_free = 0;
+    for (uint32_t o = 0; o < n_buckets && result; ++o) {
+        uint32_t b    = order[o];
+        uint32_t size = first[b + 1] - first[b];
+        index->displacements[b] = 0;
+        if (size == 0) continue;
+
+        if (size == 1) {
+            /* no need to search: point it straight at any free slot. */
+            while (taken[next_free]) next_free++;
+            uint32_t k = members[first[b]];
+            taken[next_free] = 1;
+            index->slots[next_free] = entries[k];
+            index->displacements[b] = 0x80000000u | next_free;
+            continue;
+        }
+
+        uint32_t d = 0;
+        for (; d < (1u << 20); ++d) {
+            uint32_t placed = 0;
+            for (; placed < size; ++placed) {
+                uint32_t p = yarn__mph_slot(hashes[members[first[b] + placed]], d, n_lines);
+                if (taken[p]) break;
+                taken[p] = 2; /* tentatively; catches two keys of this bucket on the same slot. */
+                positions[placed] = p;
+            }
+
+            if (placed == size) break;
+            for (uint32_t i = 0; i < placed; ++i) taken[positions[i]] = 0;
+        }
+
+        if (d == (1u << 20)) {
+            result = 0;
+            break;
+        }
+
+        index->displacements[b] = d;
+        for (uint32_t i = 0; i < size; ++i) {
+            taken[positions[i]] = 1;
+            index->slots[positions[i]] = entries[members[first[b] + i]];
+        }
+    }
+
+    YARN_FREE(hashes);
+    YARN_FREE(entries);
+    YARN_FREE(members);
+    YARN_FREE(first);
+    YARN_FREE(cursor);
+    YARN_FREE(order);
+    YARN_FREE(taken);
+    YARN_FREE(by_size);
+    YARN_FREE(positions);
+
+    if (!result) {
+        YARN_FREE(index->displacements);
+        YARN_FREE(index->slots);
+        memset(index, 0, sizeof(yarn_frozen_index));
+    }
+    return result;
+}
+
+const char *yarn_get_interned_string(yarn_string_table *table, int id) {
+    if (id < 0 || id >= (int)table->interned.used) return 0;
+    return table->interned.entries[id];
+}
+
+int yarn_find_interned_string(yarn_string_table *table, const char *name) {
+    int id = -1;
+    if (yarn_kvget(&table->interned_ids, name, &id) == -1) return -1;
+    return id;
+}
+
+yarn_locale_manager *yarn_create_locale_manager(size_t memory_budget) {
+    yarn_locale_manager *manager = (yarn_locale_manager *)YARN_MALLOC(sizeof(yarn_locale_manager));
+    memset(manager, 0, sizeof(yarn_locale_manager));
+
+    YARN_MAKE_DYNARRAY(&manager->locales, yarn_locale, 4);
+    manager->current       = -1;
+    manager->memory_budget = memory_budget;
+    manager->columns       = YARN_COLUMN_ALL;
+    return manager;
+}
+
+void yarn_destroy_locale_manager(yarn_locale_manager *manager) {
+    for (size_t i = 0; i < manager->locales.used; ++i) {
+        yarn_locale *locale = &manager->locales.entries[i];
+        if (locale->table) yarn_destroy_string_table(locale->table);
+        YARN_FREE(locale->name);
+    }
+
+    YARN_FREE(manager->locales.entries);
+    YARN_FREE(manager);
+}
+
+int yarn_add_locale(yarn_locale_manager *manager, const char *locale_name, const void *csv_buffer, size_t csv_length) {
+    if (yarn__find_locale(manager, locale_name) != -1) {
+        printf("error: locale %s is already added\n", locale_name);
+        return 0;
+    }
+
+    yarn_locale locale = {0};
+    locale.name       = yarn__strndup(locale_name, strlen(locale_name));
+    locale.csv        = (const char *)csv_buffer;
+    locale.csv_length = csv_length;
+
+    YARN_DYNARR_APPEND(&manager->locales, locale);
+    return 1;
+}
+
+int yarn_load_locale(yarn_locale_manager *manager, const char *locale_name) {
+    int index = yarn__find_locale(manager, locale_name);
+    if (index == -1) return 0;
+
+    yarn_locale *locale = &manager->locales.entries[index];
+    locale->last_used = ++manager->clock;
+    if (locale->table) return 1;
+
+    yarn_string_table *table = yarn_create_string_table();
+    table->columns          = manager->columns;
+    table->lazy             = manager->lazy;
+    table->lazy_cache_lines = manager->lazy_cache_lines;
+    table->compress         = manager->compress;
+    table->markup           = manager->markup;
+    table->format_cache_lines = manager->format_cache_lines;
+    table->locale           = yarn__strndup_alloc(&table->allocator, locale->name, strlen(locale->name));
+
+    if (!yarn__load_string_table(table, (void *)locale->csv, locale->csv_length)) {
+        yarn_destroy_string_table(table);
+        return 0;
+    }
+    if (manager->freeze) yarn_freeze_string_table(table);
+
+    locale->table = table;
+    yarn__evict_locales(manager, index);
+    return 1;
+}
+
+int yarn_unload_locale(yarn_locale_manager *manager, const char *locale_name) {
+    int index = yarn__find_locale(manager, locale_name);
+    if (index == -1 || index == manager->current) return 0;
+
+    yarn_locale *locale = &manager->locales.entries[index];
+    if (locale->table && locale->table->format_acquired) return 0; /* views still point into it. */
+    if (locale->table) {
+        yarn_destroy_string_table(locale->table);
+        manager->resident_bytes -= locale->bytes;
+        locale->table = 0;
+        locale->bytes = 0;
+    }
+    return 1;
+}
+
+int yarn_switch_locale(yarn_locale_manager *manager, yarn_dialogue *dialogue, const char *locale_name) {
+    if (!yarn_load_locale(manager, locale_name)) return 0;
+
+    int index = yarn__find_locale(manager, locale_name);
+    manager->current = index;
+    yarn_bind_string_table(dialogue, manager->locales.entries[index].table);
+
+    yarn__evict_locales(manager, index); /* previous one may go now. */
+    return 1;
+}
+
+yarn_string_table *yarn_get_locale_table(yarn_locale_manager *manager, const char *locale_name) {
+    int index = yarn__find_locale(manager, locale_name);
+    if (index == -1) return 0;
+    return manager->locales.entries[index].table;
+}
+
 /*
  * ====================================================
  * Internals
  * ====================================================
  * */
 
-/* for when I'm parsing stuff */
-typedef YARN_DYN_ARRAY(char)  yarn__str_builder;
-
 /* ===========================================
  * Stub 
  */
@@ -1292,68 +2620,124 @@ void yarn__stub_prepare_for_lines_handler(yarn_dialogue *dialogue, char **ids, i
  * Data structure.
  */
 
-#define YARN__KV_INDEXOF(pmap, idx) (yarn_kvpair_header *)((pmap)->entries + ((sizeof(yarn_kvpair_header) + (pmap)->element_size) * idx))
+/* control bytes: full buckets hold top 7 bits of hash, so high bit set means free. */
+#define YARN__KV_GROUP   16
+#define YARN__KV_EMPTY   0x80
+#define YARN__KV_DELETED 0xFE
+#define YARN__KV_TAG(hash) ((uint8_t)((hash) >> 25))
+
+/* bit i set if group[i] == control. */
+uint32_t yarn__kvmap_group_match(const uint8_t *group, uint8_t control) {
+#if defined(YARN__SIMD_SSE2)
+    __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)control)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < YARN__KV_GROUP; ++i) mask |= (uint32_t)(group[i] == control) << i;
+    return mask;
+#endif
+}
+
+/* bit i set if group[i] is empty or deleted. */
+uint32_t yarn__kvmap_group_free(const uint8_t *group) {
+#if defined(YARN__SIMD_SSE2)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < YARN__KV_GROUP; ++i) mask |= (uint32_t)(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+void yarn__kvmap_set_control(yarn_kvmap *map, size_t bucket, uint8_t control) {
+    map->control[bucket] = control;
+    /* and its copies in the tail. more than one when capacity is smaller than a group. */
+    for (size_t i = bucket; i < YARN__KV_GROUP - 1; i += map->capacity) {
+        map->control[map->capacity + i] = control;
+    }
+}
+
+/* first empty or deleted bucket on hash's probe sequence. map is never full, so there's one. */
+size_t yarn__kvmap_free_bucket(yarn_kvmap *map, uint32_t hash) {
+    size_t wrap = map->capacity - 1;
+    size_t at   = hash & wrap;
+    for (;;) {
+        uint32_t mask = yarn__kvmap_group_free(map->control + at);
+        if (mask) return (at + yarn__ctz32(mask)) & wrap;
+        at = (at + YARN__KV_GROUP) & wrap;
+    }
+}
 
 yarn_kvmap yarn__kvmap_create(size_t elem_size, size_t caps) {
     yarn_kvmap map = {0};
+    size_t capacity = 1;
+    while (capacity < caps) capacity *= 2;
+    caps = capacity; /* so buckets are picked by masking. */
 
-    size_t chunk_size  = sizeof(yarn_kvpair_header) + elem_size;
     map.element_size = elem_size;
     map.capacity     = caps;
-    map.entries      = (char *)YARN_MALLOC(chunk_size * caps);
+    map.entries      = (yarn_kvpair_header *)YARN_MALLOC(sizeof(yarn_kvpair_header) * caps);
+    map.values       = (char *)YARN_MALLOC(elem_size * caps);
+    map.control      = (uint8_t *)YARN_MALLOC(caps + YARN__KV_GROUP - 1);
     map.used         = 0;
-    assert(map.entries);
-
-    for (int i = 0; i < map.capacity; ++i) {
-        yarn_kvpair_header *header = YARN__KV_INDEXOF(&map, i);
-
-        header->hash   = 0;
-        header->keylen = 0;
-        header->key    = 0;
-    }
+    map.deleted      = 0;
+    assert(map.entries && map.values && map.control);
 
+    memset(map.entries, 0, sizeof(yarn_kvpair_header) * caps);
+    memset(map.control, YARN__KV_EMPTY, caps + YARN__KV_GROUP - 1);
     return map;
 }
 
 #define YARN__KVMAP_THRESHOLD 0.7
 int yarn__kvmap_maybe_rehash(yarn_kvmap *map) {
-    if ((map->capacity * YARN__KVMAP_THRESHOLD) < map->used) {
-        yarn_kvmap new_map = yarn__kvmap_create(map->element_size, map->capacity * 2);
-
-        for (int i = 0; i < map->capacity; ++i) {
-            yarn_kvpair_header *header = YARN__KV_INDEXOF(map, i);
-            if (header->key) {
-                void *value = (void *)(header + 1);
-                yarn__kvmap_pushsize(&new_map, header->key, value, map->element_size);
-                YARN_FREE(header->key);
-                header->key = 0;
-            }
-        }
-
-        YARN_FREE(map->entries);
-        *map = new_map;
+    if ((map->capacity * YARN__KVMAP_THRESHOLD) < map->used + map->deleted) {
+        /* mostly tombstones: rehashing at the same size gets rid of them. */
+        int grow = (map->capacity * YARN__KVMAP_THRESHOLD) < map->used * 2;
+        yarn__kvmap_resize(map, grow ? map->capacity * 2 : map->capacity);
         return 1;
     }
     return 0;
 }
 
+void yarn__kvmap_reserve(yarn_kvmap *map, size_t count) {
+    size_t capacity = map->capacity;
+    while ((capacity * YARN__KVMAP_THRESHOLD) < map->used + count) capacity *= 2;
+    if (capacity != map->capacity) yarn__kvmap_resize(map, capacity);
+}
+
+void yarn__kvmap_resize(yarn_kvmap *map, size_t capacity) {
+    yarn_kvmap new_map = yarn__kvmap_create(map->element_size, capacity);
+    new_map.borrowed_keys = map->borrowed_keys;
+
+    /* keys are unique already; move headers and values over as-is. */
+    for (size_t i = 0; i < map->capacity; ++i) {
+        if (map->control[i] & YARN__KV_EMPTY) continue;
+
+        yarn_kvpair_header *header = &map->entries[i];
+        size_t bucket = yarn__kvmap_free_bucket(&new_map, header->hash);
+        new_map.entries[bucket] = *header;
+        memcpy(new_map.values + bucket * map->element_size, map->values + i * map->element_size, map->element_size);
+        yarn__kvmap_set_control(&new_map, bucket, YARN__KV_TAG(header->hash));
+        new_map.used += 1;
+    }
+
+    YARN_FREE(map->entries);
+    YARN_FREE(map->values);
+    YARN_FREE(map->control);
+    *map = new_map;
+}
+
 int yarn__kvmap_iternext(yarn_kvmap *map, char **key, void *value, size_t element_size, int at) {
     if (value && element_size == 0) return -1;
     if (element_size != map->element_size && element_size != 0)  return -1;
     if (at < 0 || map->capacity < at)  return -1;
 
-    yarn_kvpair_header *header = YARN__KV_INDEXOF(map, at);
-    while(at < map->capacity) {
-        if (header->key) break;
-
-        at += 1;
-        header = YARN__KV_INDEXOF(map, at);
-    }
+    while (at < map->capacity && (map->control[at] & YARN__KV_EMPTY)) at += 1;
 
     if (at < map->capacity) {
-        assert(header);
+        yarn_kvpair_header *header = &map->entries[at];
         if (key)  *key = header->key;
-        if (value && element_size != 0) memcpy(value, (void*)(header+1), element_size);
+        if (value && element_size != 0) memcpy(value, YARN__KV_VALUEOF(map, header), element_size);
         return at + 1;
     }
 
@@ -1361,15 +2745,42 @@ int yarn__kvmap_iternext(yarn_kvmap *map, char **key, void *value, size_t elemen
 }
 
 void yarn__kvmap_destroy(yarn_kvmap *map) {
-    for (int i = 0; i < map->capacity; ++i) {
-        yarn_kvpair_header *header = YARN__KV_INDEXOF(map, i);
-        if (header->key) {
-            YARN_FREE(header->key);
-            header->key = 0;
+    if (!map->borrowed_keys) {
+        for (size_t i = 0; i < map->capacity; ++i) {
+            if (!(map->control[i] & YARN__KV_EMPTY)) YARN_FREE(map->entries[i].key);
         }
     }
 
     YARN_FREE(map->entries);
+    YARN_FREE(map->values);
+    YARN_FREE(map->control);
+    map->entries = 0;
+    map->values  = 0;
+    map->control = 0;
+}
+
+int yarn__kvmap_find(yarn_kvmap *map, const char *key, size_t keylen, uint32_t hash) {
+    uint8_t tag  = YARN__KV_TAG(hash);
+    size_t  wrap = map->capacity - 1; /* capacity is a power of two. */
+    size_t  at   = hash & wrap;
+
+    /* groups tile the buckets (or one covers all of them, below 16), so this many see every bucket. */
+    size_t n_groups = (map->capacity + YARN__KV_GROUP - 1) / YARN__KV_GROUP;
+    for (size_t g = 0; g < n_groups; ++g) {
+        const uint8_t *group = map->control + at;
+        for (uint32_t mask = yarn__kvmap_group_match(group, tag); mask; mask &= mask - 1) {
+            size_t bucket = (at + yarn__ctz32(mask)) & wrap;
+            yarn_kvpair_header *header = &map->entries[bucket];
+            if (header->hash == hash && header->keylen == keylen && memcmp(header->key, key, keylen) == 0) {
+                return (int)bucket;
+            }
+        }
+
+        /* key would have been put in here at the latest. */
+        if (yarn__kvmap_group_match(group, YARN__KV_EMPTY)) break;
+        at = (at + YARN__KV_GROUP) & wrap;
+    }
+    return -1;
 }
 
 int yarn__kvmap_pushsize(yarn_kvmap *map, const char *key, void *value, size_t element_size) {
@@ -1377,35 +2788,27 @@ int yarn__kvmap_pushsize(yarn_kvmap *map, const char *key, void *value, size_t e
     assert(key && value);
     yarn__kvmap_maybe_rehash(map);
 
-    size_t keylen   = strlen(key);
-    uint32_t hash   = yarn__hashstr(key, keylen);
-    uint32_t bucket = hash % map->capacity;
-    yarn_kvpair_header *header = YARN__KV_INDEXOF(map, bucket);
-
-    while(header->key) {
-        if (header->hash == hash && header->keylen == keylen) {
-            if (strncmp(header->key, key, keylen) == 0) {
-                void *insert_here = (void*)(header + 1);
-                memcpy(insert_here, value, element_size);
-
-                return (int)bucket;
-            }
-        }
-
-        bucket = (bucket + 1) % map->capacity;
-        header = YARN__KV_INDEXOF(map, bucket);
+    size_t keylen = strlen(key);
+    uint32_t hash = yarn__hashstr(key, keylen);
+    int bucket    = yarn__kvmap_find(map, key, keylen, hash);
+    if (bucket != -1) {
+        memcpy(YARN__KV_VALUEOF(map, &map->entries[bucket]), value, element_size);
+        return bucket;
     }
 
     /* New insertion. */
+    bucket = (int)yarn__kvmap_free_bucket(map, hash);
+    if (map->control[bucket] == YARN__KV_DELETED) map->deleted -= 1;
+
+    yarn_kvpair_header *header = &map->entries[bucket];
     header->hash   = hash;
     header->keylen = keylen;
-    header->key    = yarn__strndup(key, keylen);
-
-    void *insert_here = (void*)(header + 1);
-    memcpy(insert_here, value, element_size);
+    header->key    = map->borrowed_keys ? (char *)key : yarn__strndup(key, keylen);
+    memcpy(YARN__KV_VALUEOF(map, header), value, element_size);
+    yarn__kvmap_set_control(map, bucket, YARN__KV_TAG(hash));
 
     map->used += 1;
-    return (int)bucket;
+    return bucket;
 }
 
 int yarn__kvmap_get(yarn_kvmap *map, const char *key, void *value, size_t element_size) {
@@ -1415,94 +2818,124 @@ int yarn__kvmap_get(yarn_kvmap *map, const char *key, void *value, size_t elemen
     else
         assert(element_size == 0);
 
-    size_t keylen   = strlen(key);
-    uint32_t hash   = yarn__hashstr(key, keylen);
-    uint32_t bucket = hash % map->capacity;
-    yarn_kvpair_header *header = YARN__KV_INDEXOF(map, bucket);
-
-    while(header->key) {
-        if (header->hash == hash && header->keylen == keylen) {
-            if (strncmp(header->key, key, keylen) == 0) {
-                if (value) {
-                    void *exists = (void*)(header+1);
-                    memcpy(value, exists, element_size);
-                }
-
-                return (int) bucket;
-            }
-        }
-
-        bucket = (bucket + 1) % map->capacity;
-        header = YARN__KV_INDEXOF(map, bucket);
+    size_t keylen = strlen(key);
+    int bucket    = yarn__kvmap_find(map, key, keylen, yarn__hashstr(key, keylen));
+    if (bucket != -1 && value) {
+        memcpy(value, YARN__KV_VALUEOF(map, &map->entries[bucket]), element_size);
     }
-
-    return -1;
+    return bucket;
 }
 
 int yarn__kvmap_delete(yarn_kvmap *map, const char *key) {
     assert(map && key);
     if (map->used == 0) return -1;
 
-    size_t keylen   = strlen(key);
-    uint32_t hash   = yarn__hashstr(key, keylen);
-    uint32_t bucket = hash % map->capacity;
-    uint32_t previous_bucket = bucket;
-
-    yarn_kvpair_header *emptied = 0;
-    yarn_kvpair_header *header  = YARN__KV_INDEXOF(map, bucket);
-    while(header->key) {
-        if (!emptied) {
-            if (header->hash == hash && header->keylen == keylen) {
-                if (strncmp(header->key, key, keylen) == 0) {
-                    YARN_FREE(header->key);
-                    header->key    = 0;
-                    header->keylen = 0;
-                    header->hash   = 0;
-
-                    emptied = header;
-                    previous_bucket = bucket;
-                }
-            }
-        } else {
-            if ((header->hash % map->capacity) == previous_bucket) {
-                /* move current header's content to emptied cell, then mark current header as emptied */
-                emptied->key    = header->key;
-                emptied->keylen = header->keylen;
-                emptied->hash   = header->hash;
-
-                header->keylen = 0;
-                header->hash   = 0;
-                header->key    = 0; /* don't free, emptied->key holds it */
-
-                emptied = header;
-                previous_bucket = bucket;
-                /* continue probing until actually empty cell is found */
-            }
-        }
-        bucket = (bucket + 1) % map->capacity;
-        header = YARN__KV_INDEXOF(map, bucket);
-    }
+    size_t keylen = strlen(key);
+    int bucket    = yarn__kvmap_find(map, key, keylen, yarn__hashstr(key, keylen));
+    if (bucket == -1) return 0;
 
-    if (emptied) map->used -= 1;
+    /* tombstone keeps probe sequences running past it intact. */
+    yarn_kvpair_header *header = &map->entries[bucket];
+    if (!map->borrowed_keys) YARN_FREE(header->key);
+    header->key    = 0;
+    header->keylen = 0;
+    header->hash   = 0;
+    yarn__kvmap_set_control(map, bucket, YARN__KV_DELETED);
 
-    return (!!emptied); /* return if there's a pointer assigned for once -- meaning if the deletion actually happened or not */
+    map->used    -= 1;
+    map->deleted += 1;
+    return 1;
 }
 
 /* ===========================================
  * Utilities.
  */
+/* 64x64 -> 128 bit multiply; *a gets the low half, *b the high one. */
+void yarn__mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t  = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+uint64_t yarn__mix64(uint64_t a, uint64_t b) {
+    yarn__mum(&a, &b);
+    return a ^ b;
+}
+
+uint64_t yarn__read64(const char *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+uint64_t yarn__read32(const char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
 uint32_t yarn__hashstr(const char *str, size_t length) {
-    (void)sizeof(length); /* UNUSED */
+    /* wyhash (final version, single lane): 8 bytes per multiply instead of one per iteration,
+     * and keys up to 16 bytes (most line ids and variable names) are read in 4 loads, prefix or not. */
+    static const uint64_t p0 = 0xa0761d6478bd642full, p1 = 0xe7037ed1a0b428dbull,
+                          p2 = 0x8ebc6af09c88c6e3ull, p3 = 0x589965cc75374cc3ull;
+    const char *p = str;
+    uint64_t seed = p0 ^ yarn__mix64(p0 ^ p1, p2);
+    uint64_t a = 0, b = 0;
+
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t middle = (length >> 3) << 2;
+            a = (yarn__read32(p) << 32) | yarn__read32(p + middle);
+            b = (yarn__read32(p + length - 4) << 32) | yarn__read32(p + length - 4 - middle);
+        } else if (length > 0) {
+            a = ((uint64_t)(uint8_t)p[0] << 16) | ((uint64_t)(uint8_t)p[length >> 1] << 8) | (uint8_t)p[length - 1];
+        }
+    } else {
+        size_t left = length;
+        while (left > 16) {
+            seed = yarn__mix64(yarn__read64(p) ^ p1, yarn__read64(p + 8) ^ seed);
+            p    += 16;
+            left -= 16;
+        }
+        /* last 16 bytes, overlapping what's already mixed in if need be. */
+        a = yarn__read64(p + left - 16);
+        b = yarn__read64(p + left - 8);
+    }
 
-    /* DJB2 */
-    uint32_t h = 5381;
-    char c = str[0];
-    while((c = *str++)) {
-        h = ((h << 5) + h) + c;
+    a ^= p1;
+    b ^= seed;
+    yarn__mum(&a, &b);
+    uint64_t h = yarn__mix64(a ^ p0 ^ length, b ^ p1 ^ p3);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+uint64_t yarn__mph_hash(const char *key, size_t length, uint32_t seed) {
+    /* FNV-1a, then murmur3 finalizer so every bit of both halves depends on every byte. */
+    uint64_t h = 14695981039346656037ull ^ seed;
+    for (size_t i = 0; i < length; ++i) {
+        h ^= (uint8_t)key[i];
+        h *= 1099511628211ull;
     }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
     return h;
 }
 
+uint32_t yarn__mph_slot(uint64_t hash, uint32_t displacement, uint32_t n_lines) {
+    if (displacement & 0x80000000u) return displacement & 0x7fffffffu;
+
+    uint32_t mixed = displacement * 0x9e3779b1u;
+    mixed ^= mixed >> 15;
+    return ((uint32_t)hash ^ mixed) % n_lines;
+}
+
 /* returns 0 on no-op, 1 on success, -1 on memory allocation failure. */
 int yarn__maybe_extend_dyn_array(void **ptr, size_t elem_size, size_t used, size_t *caps) {
     if (used >= *caps) {
@@ -1552,11 +2985,10 @@ char *yarn__tostring_alloc(yarn_allocator *allocator, yarn_value value) {
 
         case YARN_VALUE_FLOAT:
         {
-            char temp[1024] = {0};
-            int _length = snprintf(temp, sizeof(temp)-1, "%f", value.values.v_float);
-            assert(_length > 0);
-            size_t length = _length;
-            return yarn__strndup_alloc(allocator, temp, length);
+            /* straight into the arena; it rounds up to 16 bytes anyway. */
+            char *result = (char *)yarn_allocate(allocator, YARN__NUMBER_CAPACITY);
+            yarn__format_float(value.values.v_float, result);
+            return result;
         } break;
 
         case YARN_VALUE_BOOL:
@@ -1853,6 +3285,70 @@ int yarn__get_visited_count(yarn_dialogue *dialogue, char *name) {
     return yarn_value_as_int(v);
 }
 
+int yarn__find_locale(yarn_locale_manager *manager, const char *locale) {
+    for (size_t i = 0; i < manager->locales.used; ++i) {
+        if (strcmp(manager->locales.entries[i].name, locale) == 0) return (int)i;
+    }
+    return -1;
+}
+
+void yarn__evict_locales(yarn_locale_manager *manager, int keep) {
+    /* tables grow after load; what they took then says little about now. */
+    manager->resident_bytes = 0;
+    for (size_t i = 0; i < manager->locales.used; ++i) {
+        yarn_locale *locale = &manager->locales.entries[i];
+        if (!locale->table) continue;
+
+        yarn_memory_stats stats;
+        yarn_get_string_table_memory_stats(locale->table, &stats);
+        locale->bytes = stats.total.bytes;
+        manager->resident_bytes += locale->bytes;
+    }
+    if (manager->memory_budget == 0) return;
+
+    while(manager->resident_bytes > manager->memory_budget) {
+        int victim = -1;
+        for (size_t i = 0; i < manager->locales.used; ++i) {
+            yarn_locale *locale = &manager->locales.entries[i];
+            if (!locale->table || (int)i == keep || (int)i == manager->current) continue;
+            if (locale->table->format_acquired) continue;
+            if (victim == -1 || locale->last_used < manager->locales.entries[victim].last_used) {
+                victim = (int)i;
+            }
+        }
+
+        if (victim == -1) break; /* only the ones we can't evict are left. */
+        yarn_unload_locale(manager, manager->locales.entries[victim].name);
+    }
+}
+
+int yarn__find_chapter(yarn_dialogue *dialogue, const char *chapter_name) {
+    size_t length = strlen(chapter_name);
+    for (size_t i = 0; i < dialogue->chapters.used; ++i) {
+        char *name = dialogue->chapters.entries[i].name;
+        if (strlen(name) == length && strncmp(name, chapter_name, length) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void yarn__rebuild_node_index(yarn_dialogue *dialogue) {
+    yarn_kvdestroy(&dialogue->node_index);
+    dialogue->node_index = yarn_kvcreate(yarn_node_ref, 64);
+
+    yarn_node_ref ref = {0};
+    for (size_t c = 0; c < dialogue->chapters.used; ++c) {
+        struct Yarn__Program *program = dialogue->chapters.entries[c].program;
+        ref.chapter = (int)c;
+
+        for (size_t i = 0; i < program->n_nodes; ++i) {
+            ref.node = (int)i;
+            yarn_kvpush(&dialogue->node_index, program->nodes[i]->key, ref);
+        }
+    }
+}
+
 void yarn__reset_state(yarn_dialogue *dialogue) {
     dialogue->stack_ptr = 0;
     dialogue->current_instruction = 0;
@@ -1898,6 +3394,16 @@ int yarn__find_instruction_point_for_label(yarn_dialogue *dialogue, char *label)
     return -1;
 }
 
+/* moves top n values of stack into line, as they are. text is made only if the line gets formatted. */
+void yarn__pop_substitutions(yarn_dialogue *dialogue, yarn_line *line, int n) {
+    assert(n <= dialogue->stack_ptr);
+    dialogue->stack_ptr -= n;
+
+    line->substitutions   = (yarn_value *)yarn_allocate(&dialogue->dialogue_allocator, sizeof(yarn_value) * n);
+    line->n_substitutions = n;
+    memcpy(line->substitutions, dialogue->stack + dialogue->stack_ptr, sizeof(yarn_value) * n);
+}
+
 void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
     switch(inst->opcode) {
         case YARN__INSTRUCTION__OP_CODE__STORE_VARIABLE:
@@ -1921,8 +3427,11 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
                 uint32_t varname_hash = yarn__hashstr(varname, varname_length);
                 Yarn__Program__InitialValuesEntry *iv;
 
-                for (int i = 0; i < dialogue->program->n_initial_values; ++i) {
-                    iv = dialogue->program->initial_values[i];
+                /* initial values are looked up across every chapter,
+                 * a variable declared in one chapter may be read from another. */
+                for (size_t c = 0; c < dialogue->chapters.used && v.type == YARN_VALUE_NONE; ++c)
+                for (int i = 0; i < dialogue->chapters.entries[c].program->n_initial_values; ++i) {
+                    iv = dialogue->chapters.entries[c].program->initial_values[i];
                     size_t iv_length = strlen(iv->key);
                     uint32_t iv_hash = yarn__hashstr(iv->key, iv_length);
 
@@ -2001,36 +3510,20 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
         case YARN__INSTRUCTION__OP_CODE__RUN_COMMAND:
         {
             assert(inst->n_operands >= 1);
-            char *command_text = inst->operands[0]->string_value;
-            int n_substitutions = 0;
-
-            if (inst->n_operands > 1) {
-                int expr_count = (int)inst->operands[1]->float_value;
-
-                /* NOTE: have to check if expr_count is not 0,
-                 * otherwise tries to do malloc(0) therefore implementation-defined */
-                if (expr_count > 0) {
-                    char **substitutions = (char **)yarn_allocate(&dialogue->dialogue_allocator, sizeof(char *) * expr_count);
-                    n_substitutions = expr_count;
-
-                    for (int i = expr_count - 1; i >= 0; --i) {
-                        yarn_value value = yarn_pop_value(dialogue);
-                        char *subst = yarn__tostring_alloc(&dialogue->dialogue_allocator, value);
-                        substitutions[i] = subst;
-                    }
+            int n_substitutions = (inst->n_operands > 1) ? (int)inst->operands[1]->float_value : 0;
+            if (n_substitutions < 0) n_substitutions = 0;
+            assert(n_substitutions <= dialogue->stack_ptr);
 
-                    command_text = yarn__substitute_string(command_text, substitutions, n_substitutions);
-                }
-            }
+            /* popped, but read in place; arguments are made before anything can push again. */
+            dialogue->stack_ptr -= n_substitutions;
+            yarn_value *substitutions = dialogue->stack + dialogue->stack_ptr;
 
             dialogue->execution_state = YARN_EXEC_DELIVERING_CONTENT;
-            dialogue->command_handler(dialogue, command_text);
+            yarn__run_command(dialogue, inst, substitutions, n_substitutions);
 
             if (dialogue->execution_state == YARN_EXEC_DELIVERING_CONTENT) {
                 dialogue->execution_state = YARN_EXEC_WAITING_FOR_CONTINUE;
             }
-
-            if (n_substitutions > 0) YARN_FREE(command_text); /* Command text allocation cannot be ignored */
         } break;
 
         case YARN__INSTRUCTION__OP_CODE__JUMP:
@@ -2080,7 +3573,8 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
             assert(inst->n_operands >= 2);
 
             yarn_option option = { 0 };
-            option.line.id = inst->operands[0]->string_value;
+            option.line.line_index = yarn__current_line_index(dialogue);
+            option.line.id = (option.line.line_index != -1) ? dialogue->line_ids.entries[option.line.line_index] : inst->operands[0]->string_value;
             option.destination_node = inst->operands[1]->string_value;
 
             if (inst->n_operands > 2) {
@@ -2089,15 +3583,7 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
                 /* NOTE: have to check if expr_count is not 0,
                  * otherwise tries to do malloc(0) therefore implementation defined */
                 if (expr_count > 0) {
-                    /* TODO: @allocator stack allocator would work wonderfully here */
-                    option.line.substitutions = (char **)yarn_allocate(&dialogue->dialogue_allocator, sizeof(char *) * expr_count);
-                    option.line.n_substitutions = expr_count;
-
-                    for (int i = expr_count - 1; i >= 0; --i) {
-                        yarn_value value = yarn_pop_value(dialogue);
-                        char *subst = yarn__tostring_alloc(&dialogue->dialogue_allocator, value);
-                        option.line.substitutions[i] = subst;
-                    }
+                    yarn__pop_substitutions(dialogue, &option.line, expr_count);
                 }
             }
             option.is_available = 1; /* defaults to available */
@@ -2141,7 +3627,8 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
             Yarn__Operand *key_operand = inst->operands[0];
             assert(key_operand->value_case == YARN__OPERAND__VALUE_STRING_VALUE);
 
-            line.id = key_operand->string_value;
+            line.line_index = yarn__current_line_index(dialogue);
+            line.id = (line.line_index != -1) ? dialogue->line_ids.entries[line.line_index] : key_operand->string_value;
 
             if (inst->n_operands > 1) {
                 int expr_count = (int)inst->operands[1]->float_value;
@@ -2150,14 +3637,7 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
                  * otherwise tries to do malloc(0) therefore implementation defined */
 
                 if (expr_count > 0) {
-                    line.substitutions = (char **)yarn_allocate(&dialogue->dialogue_allocator, sizeof(char *) * expr_count);
-                    line.n_substitutions = expr_count;
-
-                    for (int i = expr_count - 1; i >= 0; --i) {
-                        yarn_value value = yarn_pop_value(dialogue);
-                        char *subst = yarn__tostring_alloc(&dialogue->dialogue_allocator, value);
-                        line.substitutions[i] = subst;
-                    }
+                    yarn__pop_substitutions(dialogue, &line, expr_count);
                 }
             }
 
@@ -2249,280 +3729,3576 @@ void yarn__run_instruction(yarn_dialogue *dialogue, Yarn__Instruction *inst) {
 }
 
 /* ===========================================
- * Text manipulation / substitutions.
+ * Program decoding.
+ *
+ * protobuf-c can only unpack the whole Program in one go,
+ * so the top level of the message is walked by hand here:
+ * every `nodes` map entry is an independent length-delimited message,
+ * which lets them be unpacked on separate threads into separate allocators.
  */
 
-/* NOTE: returns malloc'ed string. */
-char *yarn__substitute_string(char *format, char **substs, int n_substs) {
-    assert(format && substs);
+typedef struct {
+    const uint8_t *data;
+    size_t         length;
+} yarn__wire_range;
+
+typedef YARN_DYN_ARRAY(yarn__wire_range) yarn__wire_range_set;
+
+typedef struct {
+    yarn__wire_range           *ranges;
+    size_t                      n_ranges;
+    Yarn__Program__NodesEntry **out;
+    yarn_allocator             *allocator;
+    int                         failed;
+} yarn__decode_job;
+
+void *yarn__protobuf_alloc(void *allocator_data, size_t size) {
+    return yarn_allocate((yarn_allocator *)allocator_data, size > 0 ? size : 1);
+}
+
+void yarn__protobuf_free(void *allocator_data, void *pointer) {
+    /* NOTE: freed all at once with the allocator. */
+    (void)allocator_data;
+    (void)pointer;
+}
+
+int yarn__wire_read_varint(const uint8_t *buffer, size_t length, size_t *at, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *at < length; shift += 7) {
+        uint8_t b = buffer[(*at)++];
+        result |= (uint64_t)(b & 0x7f) << shift;
+
+        if (!(b & 0x80)) {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void yarn__run_decode_job(yarn__decode_job *job) {
+    ProtobufCAllocator pb_allocator = {0};
+    pb_allocator.alloc          = &yarn__protobuf_alloc;
+    pb_allocator.free           = &yarn__protobuf_free;
+    pb_allocator.allocator_data = job->allocator;
+
+    for (size_t i = 0; i < job->n_ranges; ++i) {
+        yarn__wire_range r = job->ranges[i];
+        job->out[i] = (Yarn__Program__NodesEntry *)protobuf_c_message_unpack(
+            &yarn__program__nodes_entry__descriptor, &pb_allocator, r.length, r.data);
+
+        if (!job->out[i] || !job->out[i]->value) {
+            job->failed = 1;
+            return;
+        }
+    }
+}
+
+#if defined(YARN_C99_THREADS)
+  #if defined(_WIN32)
+DWORD WINAPI yarn__decode_thread(LPVOID param) {
+    yarn__run_decode_job((yarn__decode_job *)param);
+    return 0;
+}
+  #else
+void *yarn__decode_thread(void *param) {
+    yarn__run_decode_job((yarn__decode_job *)param);
+    return 0;
+}
+  #endif
+#endif
+
+/* runs every job. job 0 always runs on the caller. */
+void yarn__run_decode_jobs(yarn__decode_job *jobs, int n_jobs) {
+#if defined(YARN_C99_THREADS)
+  #if defined(_WIN32)
+    HANDLE threads[YARN_MAX_LOAD_THREADS];
+    for (int i = 1; i < n_jobs; ++i) {
+        threads[i] = CreateThread(0, 0, yarn__decode_thread, &jobs[i], 0, 0);
+        if (!threads[i]) yarn__run_decode_job(&jobs[i]);
+    }
+    yarn__run_decode_job(&jobs[0]);
+    for (int i = 1; i < n_jobs; ++i) {
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+  #else
+    pthread_t threads[YARN_MAX_LOAD_THREADS];
+    int       spawned[YARN_MAX_LOAD_THREADS] = {0};
+    for (int i = 1; i < n_jobs; ++i) {
+        spawned[i] = (pthread_create(&threads[i], 0, yarn__decode_thread, &jobs[i]) == 0);
+        if (!spawned[i]) yarn__run_decode_job(&jobs[i]);
+    }
+    yarn__run_decode_job(&jobs[0]);
+    for (int i = 1; i < n_jobs; ++i) {
+        if (spawned[i]) pthread_join(threads[i], 0);
+    }
+  #endif
+#else
+    for (int i = 0; i < n_jobs; ++i) {
+        yarn__run_decode_job(&jobs[i]);
+    }
+#endif
+}
+
+int yarn__decode_program(yarn_chapter *chapter, const uint8_t *buffer, size_t length, int n_threads) {
+    yarn__wire_range     name = {0};
+    yarn__wire_range_set nodes;
+    yarn__wire_range_set initial_values;
+    YARN_MAKE_DYNARRAY(&nodes, yarn__wire_range, 64);
+    YARN_MAKE_DYNARRAY(&initial_values, yarn__wire_range, 16);
+
+    /* 1. find every top level field. */
+    size_t at = 0;
+    while (at < length) {
+        uint64_t tag = 0, scalar = 0;
+        if (!yarn__wire_read_varint(buffer, length, &at, &tag)) goto errored;
+
+        switch (tag & 7) {
+            case 0: if (!yarn__wire_read_varint(buffer, length, &at, &scalar)) goto errored; break;
+            case 1: at += 8; break;
+            case 5: at += 4; break;
+            case 2:
+            {
+                if (!yarn__wire_read_varint(buffer, length, &at, &scalar)) goto errored;
+                if (scalar > length - at) goto errored;
 
-    size_t base_strlen = strlen(format);
-    size_t allocate_size = base_strlen * 2;
+                yarn__wire_range r = { buffer + at, (size_t)scalar };
+                at += (size_t)scalar;
 
-    yarn__str_builder string_builder = {0};
-    YARN_MAKE_DYNARRAY(&string_builder, char, allocate_size);
+                switch (tag >> 3) {
+                    case 1: name = r;                                 break; /* Program.name */
+                    case 2: YARN_DYNARR_APPEND(&nodes, r);            break; /* Program.nodes */
+                    case 3: YARN_DYNARR_APPEND(&initial_values, r);   break; /* Program.initial_values */
+                    default: break;
+                }
+            } break;
 
-    for (size_t i = 0; i < base_strlen; ++i) {
-        if (format[i] == '{') {
-            i += 1;
+            default: goto errored; /* groups are not a thing in proto3. */
+        }
+    }
+    if (at != length) goto errored;
 
-            int replace_idx = 0;
-            char c = 0;
-            while((c = format[i]) && c != '}') {
-                assert(c >= '0' && c <= '9');
-                replace_idx = replace_idx * 10 + (c - '0');
-                i++;
+    /* 2. split nodes into byte-balanced, contiguous ranges. */
+#if !defined(YARN_C99_THREADS)
+    n_threads = 1;
+#endif
+    if (n_threads > YARN_MAX_LOAD_THREADS) n_threads = YARN_MAX_LOAD_THREADS;
+    if (n_threads > (int)(nodes.used / YARN_MIN_NODES_PER_LOAD_THREAD)) n_threads = (int)(nodes.used / YARN_MIN_NODES_PER_LOAD_THREAD);
+    if (n_threads < 1) n_threads = 1;
+
+    size_t node_bytes = 0;
+    for (size_t i = 0; i < nodes.used; ++i) node_bytes += nodes.entries[i].length;
+
+    chapter->n_allocators = n_threads;
+    chapter->allocators   = (yarn_allocator *)YARN_MALLOC(sizeof(yarn_allocator) * n_threads);
+
+    Yarn__Program__NodesEntry **entries = 0;
+    yarn__decode_job jobs[YARN_MAX_LOAD_THREADS];
+    {
+        size_t begin = 0;
+        size_t consumed_bytes = 0;
+        for (int j = 0; j < n_threads; ++j) {
+            size_t target = node_bytes / n_threads * (j + 1);
+            size_t end    = begin;
+            size_t bytes  = 0;
+
+            if (j == n_threads - 1) {
+                end = nodes.used;
+                for (size_t i = begin; i < end; ++i) bytes += nodes.entries[i].length;
+            } else {
+                while (end < nodes.used && consumed_bytes + bytes < target) {
+                    bytes += nodes.entries[end++].length;
+                }
             }
 
-            assert(format[i] == '}');
-            i++;
-            assert(replace_idx < n_substs);
-            char *target_subst = substs[replace_idx];
-            char n = 0;
-            while((n = *target_subst++)) {
-                YARN_DYNARR_APPEND(&string_builder, n);
+            /* protobuf structs are roughly 4~8x larger than it's wire format. */
+            chapter->allocators[j] = yarn_create_allocator(bytes * 4 + 4 * 1024);
+
+            jobs[j].ranges    = nodes.entries + begin;
+            jobs[j].n_ranges  = end - begin;
+            jobs[j].allocator = &chapter->allocators[j];
+            jobs[j].failed    = 0;
+            jobs[j].out       = 0;
+
+            consumed_bytes += bytes;
+            begin = end;
+        }
+    }
+
+    /* out array lives in first allocator, so slots are decided before threads start. */
+    entries = (Yarn__Program__NodesEntry **)yarn_allocate(&chapter->allocators[0], sizeof(void *) * (nodes.used + 1));
+    {
+        size_t offset = 0;
+        for (int j = 0; j < n_threads; ++j) {
+            jobs[j].out = entries + offset;
+            offset += jobs[j].n_ranges;
+        }
+    }
+
+    /* 3. decode nodes. */
+    yarn__run_decode_jobs(jobs, n_threads);
+    for (int j = 0; j < n_threads; ++j) {
+        if (jobs[j].failed) goto errored;
+    }
+
+    /* 4. merge into the program. */
+    {
+        yarn_allocator *main_allocator = &chapter->allocators[0];
+        ProtobufCAllocator pb_allocator = {0};
+        pb_allocator.alloc          = &yarn__protobuf_alloc;
+        pb_allocator.free           = &yarn__protobuf_free;
+        pb_allocator.allocator_data = main_allocator;
+
+        Yarn__Program *program = (Yarn__Program *)yarn_allocate(main_allocator, sizeof(Yarn__Program));
+        yarn__program__init(program);
+
+        program->name    = yarn__strndup_alloc(main_allocator, (const char *)name.data, name.length);
+        program->n_nodes = nodes.used;
+        program->nodes   = entries;
+
+        program->n_initial_values = initial_values.used;
+        program->initial_values   = (Yarn__Program__InitialValuesEntry **)yarn_allocate(main_allocator, sizeof(void *) * (initial_values.used + 1));
+        for (size_t i = 0; i < initial_values.used; ++i) {
+            yarn__wire_range r = initial_values.entries[i];
+            program->initial_values[i] = (Yarn__Program__InitialValuesEntry *)protobuf_c_message_unpack(
+                &yarn__program__initial_values_entry__descriptor, &pb_allocator, r.length, r.data);
+
+            if (!program->initial_values[i] || !program->initial_values[i]->value) goto errored;
+        }
+
+        chapter->program = program;
+    }
+
+    YARN_FREE(nodes.entries);
+    YARN_FREE(initial_values.entries);
+    return 1;
+
+errored:
+    YARN_FREE(nodes.entries);
+    YARN_FREE(initial_values.entries);
+    yarn__destroy_chapter(chapter);
+    return 0;
+}
+
+void yarn__destroy_chapter(yarn_chapter *chapter) {
+    for (int i = 0; i < chapter->n_allocators; ++i) {
+        yarn_destroy_allocator(chapter->allocators[i]);
+    }
+
+    if (chapter->allocators) YARN_FREE(chapter->allocators);
+    if (chapter->name)       YARN_FREE(chapter->name);
+
+    chapter->allocators   = 0;
+    chapter->n_allocators = 0;
+    chapter->program      = 0;
+    chapter->name         = 0;
+    chapter->line_indexes = 0;
+    chapter->commands     = 0;
+    chapter->manifests    = 0;
+}
+
+void yarn__index_chapter_lines(yarn_dialogue *dialogue, yarn_chapter *chapter) {
+    struct Yarn__Program *program = chapter->program;
+    yarn_allocator *allocator = &chapter->allocators[0]; /* goes away with the chapter. */
+
+    /* room for every line upfront; growing one rehash at a time costs more than the lookups. */
+    size_t n_lines = 0;
+    for (size_t n = 0; n < program->n_nodes; ++n) {
+        Yarn__Node *node = program->nodes[n]->value;
+        for (size_t i = 0; i < node->n_instructions; ++i) {
+            n_lines += node->instructions[i]->opcode == YARN__INSTRUCTION__OP_CODE__RUN_LINE ||
+                       node->instructions[i]->opcode == YARN__INSTRUCTION__OP_CODE__ADD_OPTION;
+        }
+    }
+    yarn__kvmap_reserve(&dialogue->line_index, n_lines);
+
+    chapter->line_indexes = (int **)yarn_allocate(allocator, sizeof(int *) * (program->n_nodes ? program->n_nodes : 1));
+    for (size_t n = 0; n < program->n_nodes; ++n) {
+        Yarn__Node *node = program->nodes[n]->value;
+        int *indexes = (int *)yarn_allocate(allocator, sizeof(int) * (node->n_instructions ? node->n_instructions : 1));
+        chapter->line_indexes[n] = indexes;
+
+        for (size_t i = 0; i < node->n_instructions; ++i) {
+            Yarn__Instruction *inst = node->instructions[i];
+            indexes[i] = -1;
+
+            if (inst->opcode != YARN__INSTRUCTION__OP_CODE__RUN_LINE &&
+                inst->opcode != YARN__INSTRUCTION__OP_CODE__ADD_OPTION) continue;
+            if (inst->n_operands < 1 || inst->operands[0]->value_case != YARN__OPERAND__VALUE_STRING_VALUE) continue;
+
+            char *id = inst->operands[0]->string_value;
+            int index = -1;
+            if (yarn_kvget(&dialogue->line_index, id, &index) == -1) {
+                /* outlives the chapter: other chapters / bound tables may refer to it. */
+                char *key = yarn__strndup_alloc(&dialogue->line_allocator, id, strlen(id));
+                index = (int)dialogue->line_ids.used;
+                YARN_DYNARR_APPEND(&dialogue->line_ids, key);
+                yarn_kvpush(&dialogue->line_index, key, index);
             }
+            indexes[i] = index;
+        }
+    }
+}
+
+int yarn__bind_lines(yarn_dialogue *dialogue, yarn_string_table *table) {
+    if (!table->bound_lines.entries) YARN_MAKE_DYNARRAY(&table->bound_lines, yarn_bound_line, 64);
+
+    int all_found = 1;
+    for (size_t i = table->bound_lines.used; i < dialogue->line_ids.used; ++i) {
+        yarn_bound_line bound;
+        bound.line_id = dialogue->line_ids.entries[i];
+        bound.bucket  = -1;
+
+        yarn_kvpair_header *header = yarn__find_line(table, bound.line_id);
+        if (header) {
+            bound.bucket = (int)(header - table->table.entries);
         } else {
-            YARN_DYNARR_APPEND(&string_builder, format[i]);
+            yarn__logerror(dialogue, "line `%s` is not in the string table", bound.line_id);
+            all_found = 0;
         }
+        YARN_DYNARR_APPEND(&table->bound_lines, bound);
     }
+    return all_found;
+}
 
-    /* NOTE:
-     * weird C / C++ difference standard.
-     * character constant evaluates to int in C, but char in C++.
-     * */
-    char null_terminator = '\0';
-    YARN_DYNARR_APPEND(&string_builder, null_terminator);
-    return string_builder.entries;
+int yarn__current_line_index(yarn_dialogue *dialogue) {
+    yarn_chapter *chapter = &dialogue->chapters.entries[dialogue->current_chapter];
+    if (!chapter->line_indexes) return -1;
+    return chapter->line_indexes[dialogue->current_node][dialogue->current_instruction];
 }
 
 /* ===========================================
- * Parsing strings / CSV tables.
+ * Commands.
  */
 
-typedef struct {
-    const char *word;
-    size_t size;
-} yarn__expect_csv_column;
-
-/* TODO: @limit this shouldn't be concretely defined like this. it's not guaranteed that the csv's column would look exactly like this */
-const yarn__expect_csv_column expect_column[] = {
-    { "id",         sizeof("id")         - 1 },
-    { "text",       sizeof("text")       - 1 },
-    { "file",       sizeof("file")       - 1 },
-    { "node",       sizeof("node")       - 1 },
-    { "lineNumber", sizeof("lineNumber") - 1 },
-};
+/* literal argument: number, true / false, or string. */
+yarn_value yarn__command_literal(char *token) {
+    if (strcmp(token, "true") == 0)  return yarn_bool(1);
+    if (strcmp(token, "false") == 0) return yarn_bool(0);
+
+    /* strtof also takes "inf", "nan" and hex; those are names here. */
+    char c = token[0];
+    if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.') {
+        char *end = 0;
+        float number = strtof(token, &end);
+        int hex = strchr(token, 'x') || strchr(token, 'X');
+        if (end != token && *end == '\0' && !hex) return yarn_float(number);
+    }
+    return yarn_string(token);
+}
 
-int yarn__parse_linenumber(char *str, size_t begin, size_t length, int current_line) {
-    int result_number = 0;
-    for (int i = 0; i < length; ++i) {
-        /* TODO: @limit handle other than ascii */
-        char c = str[begin + i];
-        int  n = c - '0';
-        if (n < 0 || n > 9) {
-            printf("error(csv line %d): encountered char `%c` while parsing line number.\n", current_line, c);
-            return -1;
+/* whole token is {n}: returns n, -1 otherwise. */
+int yarn__command_slot(const char *token) {
+    if (token[0] != '{' || token[1] < '0' || token[1] > '9') return -1;
+
+    int slot = 0;
+    const char *c = token + 1;
+    while (*c >= '0' && *c <= '9' && slot < 100000) slot = slot * 10 + (*c++ - '0');
+    return (c[0] == '}' && c[1] == '\0') ? slot : -1;
+}
+
+/* end of the token starting at `at`: quoted part (if it starts with one), then anything up to whitespace. */
+const char *yarn__skip_command_token(const char *at) {
+    if (*at == '"') {
+        for (at++; *at && *at != '"'; at++) {
+            if (*at == '\\' && at[1]) at++;
         }
+        if (*at == '"') at++;
+    }
+    while (*at && *at != ' ' && *at != '\t') at++;
+    return at;
+}
 
-        if (((INT_MAX - n) / 10) < result_number) {
-            printf("error(csv line %d): integer overflow (max %d, parsed until %d%d...)\n", current_line, INT_MAX, result_number, n);
-            return -1;
+/* 0 when there's no name, or too many arguments; command_handler takes those as text. */
+yarn_command *yarn__tokenize_command(yarn_allocator *allocator, const char *text, int n_substitutions) {
+    /* counted first, so commands taken as text don't leave anything in allocator. */
+    int n_tokens = 0;
+    for (const char *at = text;;) {
+        while (*at == ' ' || *at == '\t') at++;
+        if (!*at) break;
+        if (++n_tokens > YARN_MAX_COMMAND_ARGS + 1) return 0;
+        at = yarn__skip_command_token(at);
+    }
+    if (n_tokens == 0) return 0;
+
+    /* tokens are unescaped in place on a copy; an unescaped token never outgrows its source. */
+    size_t text_length = strlen(text);
+    char *copy = yarn__strndup_alloc(allocator, text, text_length);
+
+    char *tokens[YARN_MAX_COMMAND_ARGS + 1];
+    int   quoted[YARN_MAX_COMMAND_ARGS + 1];
+
+    char *read = copy;
+    for (int i = 0; i < n_tokens; ++i) {
+        while (*read == ' ' || *read == '\t') read++;
+
+        char *write = read;
+        tokens[i] = write;
+        quoted[i] = (*read == '"');
+
+        if (quoted[i]) {
+            read++;
+            while (*read && *read != '"') {
+                if (*read == '\\' && read[1]) read++;
+                *write++ = *read++;
+            }
+            if (*read == '"') read++;
         }
+        /* what follows the closing quote is still this token: `"a b"c` is `a bc`. */
+        while (*read && *read != ' ' && *read != '\t') *write++ = *read++;
 
-        result_number = result_number * 10 + n;
+        char separator = *read;
+        *write = '\0';
+        if (separator) read++;
     }
-    return result_number;
+
+    yarn_command *command = (yarn_command *)yarn_allocate(allocator, sizeof(yarn_command));
+    command->name   = tokens[0];
+    command->n_args = n_tokens - 1;
+    command->args   = (yarn_command_arg *)yarn_allocate(allocator, sizeof(yarn_command_arg) * (n_tokens > 1 ? n_tokens - 1 : 1));
+
+    for (int i = 1; i < n_tokens; ++i) {
+        yarn_command_arg *arg = &command->args[i - 1];
+        char *token = tokens[i];
+        int slot = quoted[i] ? -1 : yarn__command_slot(token);
+
+        arg->slot = 0;
+        if (slot != -1 && slot < n_substitutions) {
+            arg->kind  = YARN_COMMAND_ARG_SUBSTITUTION;
+            arg->slot  = slot;
+            arg->value = yarn_none();
+        } else if (n_substitutions > 0 && strchr(token, '{')) {
+            arg->kind  = YARN_COMMAND_ARG_TEXT;
+            arg->value = yarn_string(token);
+        } else {
+            arg->kind  = YARN_COMMAND_ARG_VALUE;
+            arg->value = quoted[i] ? yarn_string(token) : yarn__command_literal(token);
+        }
+    }
+    return command;
 }
 
-/* quick and dirty CSV parsing. */
-int yarn__load_string_table(yarn_string_table *table, void *string_table_buffer, size_t string_table_length) {
-    char *begin = (char *)string_table_buffer;
-    size_t current     = 0;
-    size_t advanced    = 0;
-    int column_count   = 0;
-    int current_column = 0;
-
-    int current_line       = 1;
-    int parsing_first_line = 1;
-    int in_quote = 0;
-
-    char *line_id = 0;
-    yarn_parsed_entry line = {0};
-
-    while(current < string_table_length && advanced < string_table_length) {
-        assert(current_column <= column_count);
-        if (begin[advanced] == '\0') {
-            /*
-             * NOTE: csv may or may not end it's content with linebreak,
-             * meaning that I still have to check if I'm still parsing when I encounter EOF */
-            if (!parsing_first_line && current_column == 4) {
-                size_t consumed_since = advanced - current;
-                int number = yarn__parse_linenumber(begin, current, consumed_since, current_line);
-                if (number == -1) goto errored;
-                line.line_number = number;
-
-                yarn_kvpush(&table->table, line_id, line);
-                YARN_FREE(line_id);
+void yarn__tokenize_chapter_commands(yarn_chapter *chapter) {
+    struct Yarn__Program *program = chapter->program;
+    yarn_allocator *allocator = &chapter->allocators[0]; /* goes away with the chapter. */
+
+    chapter->commands = (yarn_command ***)yarn_allocate(allocator, sizeof(yarn_command **) * (program->n_nodes ? program->n_nodes : 1));
+    for (size_t n = 0; n < program->n_nodes; ++n) {
+        Yarn__Node *node = program->nodes[n]->value;
+        chapter->commands[n] = 0;
+
+        for (size_t i = 0; i < node->n_instructions; ++i) {
+            Yarn__Instruction *inst = node->instructions[i];
+            if (inst->opcode != YARN__INSTRUCTION__OP_CODE__RUN_COMMAND) continue;
+            if (inst->n_operands < 1 || inst->operands[0]->value_case != YARN__OPERAND__VALUE_STRING_VALUE) continue;
+
+            if (!chapter->commands[n]) {
+                chapter->commands[n] = (yarn_command **)yarn_allocate(allocator, sizeof(yarn_command *) * node->n_instructions);
+                memset(chapter->commands[n], 0, sizeof(yarn_command *) * node->n_instructions);
             }
-            current = advanced;
-            break;
+
+            int n_substitutions = (inst->n_operands > 1) ? (int)inst->operands[1]->float_value : 0;
+            chapter->commands[n][i] = yarn__tokenize_command(allocator, inst->operands[0]->string_value, n_substitutions);
         }
+    }
+}
 
-        switch(begin[advanced]) {
-            case '"':
-            {
-                /* 1. csv escapes double quotation with itself apparently. what the crap? */
-                if (in_quote && begin[advanced+1] == '"') {
-                    advanced += 2;
-                } else {
-                    advanced++;
-                    in_quote = !in_quote;
-                }
-            } break;
+void yarn__run_command(yarn_dialogue *dialogue, struct Yarn__Instruction *inst, yarn_value *substitutions, int n_substitutions) {
+    yarn_chapter *chapter = &dialogue->chapters.entries[dialogue->current_chapter];
+    yarn_command **commands = chapter->commands ? chapter->commands[dialogue->current_node] : 0;
+    yarn_command *command = commands ? commands[dialogue->current_instruction] : 0;
 
-            case '\r':
-            case '\n':
-            {
-                if (in_quote) {
-                    advanced++;
+    yarn_command_entry entry = {0};
+    if (command && dialogue->commands.used > 0 && yarn_kvget(&dialogue->commands, command->name, &entry) != -1) {
+        if (entry.param_count != -1 && entry.param_count != command->n_args) {
+            yarn__logerror(dialogue, "command `%s` takes %d arguments, but got %d", command->name, entry.param_count, command->n_args);
+            return;
+        }
+
+        yarn_value args[YARN_MAX_COMMAND_ARGS];
+        for (int i = 0; i < command->n_args; ++i) {
+            yarn_command_arg *arg = &command->args[i];
+            switch(arg->kind) {
+                case YARN_COMMAND_ARG_SUBSTITUTION:
+                    args[i] = substitutions[arg->slot];
                     break;
-                }
 
-                if (current_column != column_count) {
-                    printf("error (line %d): unexpected linebreak before row parsing is complete.\n", current_line);
-                    goto errored;
-                }
+                case YARN_COMMAND_ARG_TEXT:
+                    args[i] = yarn_string(yarn__substitute_values(&dialogue->dialogue_allocator, arg->value.values.v_string, substitutions, n_substitutions));
+                    break;
 
-                if (parsing_first_line) {
-                    parsing_first_line = 0;
-                } else {
-                    size_t consumed_since = advanced - current;
-                    if (current_column == 4) {
-                        int number = yarn__parse_linenumber(begin, current, consumed_since, current_line);
-                        if (number == -1) goto errored;
-                        line.line_number = number;
-                    }
+                default:
+                    args[i] = arg->value;
+                    break;
+            }
+        }
 
-                    yarn_kvpush(&table->table, line_id, line);
-                    YARN_FREE(line_id);
+        entry.function(dialogue, args, command->n_args);
+        return;
+    }
 
-                    line_id   = 0;
-                    line.text = 0;
-                    line.file = 0;
-                    line.node = 0;
-                    line.line_number = 0;
-                }
+    char *command_text = inst->operands[0]->string_value;
+    if (n_substitutions > 0) {
+        command_text = yarn__substitute_values(&dialogue->dialogue_allocator, command_text, substitutions, n_substitutions);
+    }
+    dialogue->command_handler(dialogue, command_text);
+}
 
-                if (begin[advanced] == '\r' && begin[advanced + 1] == '\n') {
-                    advanced++; /* skip carriage return */
-                }
-                current_line += 1;
-                current_column = 0;
-                advanced++; /* skip line break */
-                current = advanced;
-            } break;
+/* ===========================================
+ * Node manifests / prefetch.
+ */
 
-            case ',':
-            {
-                if (in_quote) {
-                    advanced++;
-                    break;
-                }
+/* writes line ids of node into ids (if given), returns how many there are. */
+int yarn__manifest_own_ids(Yarn__Node *node, char **ids) {
+    int n_ids = 0;
+    for (size_t i = 0; i < node->n_instructions; ++i) {
+        Yarn__Instruction *inst = node->instructions[i];
+        if (inst->opcode != YARN__INSTRUCTION__OP_CODE__RUN_LINE &&
+            inst->opcode != YARN__INSTRUCTION__OP_CODE__ADD_OPTION) continue;
+        if (inst->n_operands < 1 || inst->operands[0]->value_case != YARN__OPERAND__VALUE_STRING_VALUE) continue;
+
+        if (ids) ids[n_ids] = inst->operands[0]->string_value;
+        n_ids++;
+    }
+    return n_ids;
+}
 
-                if (parsing_first_line) {
-                    assert(column_count < YARN_LEN(expect_column));
-                    const yarn__expect_csv_column *expect = &expect_column[column_count];
+void yarn__build_manifests(yarn_chapter *chapter, int depth) {
+    struct Yarn__Program *program = chapter->program;
+    yarn_allocator *allocator = &chapter->allocators[0]; /* goes away with the chapter. */
+    size_t n_nodes = program->n_nodes;
 
-                    size_t consumed_since = advanced - current;
-                    if (expect->size != consumed_since) {
-                        printf("error(line %d): expect size difference: %zu to %zu\n", current_line, expect->size, consumed_since);
-                        goto errored;
-                    }
+    chapter->manifests = (yarn_node_manifest *)yarn_allocate(allocator, sizeof(yarn_node_manifest) * (n_nodes ? n_nodes : 1));
+    for (size_t n = 0; n < n_nodes; ++n) {
+        chapter->manifests[n].n_own = yarn__manifest_own_ids(program->nodes[n]->value, 0);
+    }
 
-                    char *current_ptr = &begin[current];
-                    if (strncmp(current_ptr, expect->word, expect->size) != 0) {
-                        char *dupped_str = yarn__strndup(current_ptr, consumed_since);
+    if (depth <= 0) {
+        for (size_t n = 0; n < n_nodes; ++n) {
+            yarn_node_manifest *manifest = &chapter->manifests[n];
+            manifest->n_ids = manifest->n_own;
+            manifest->ids   = (char **)yarn_allocate(allocator, sizeof(char *) * (manifest->n_own ? manifest->n_own : 1));
+            yarn__manifest_own_ids(program->nodes[n]->value, manifest->ids);
+        }
+        return;
+    }
 
-                        printf("error(line %d): expect word difference: %s to %s\n", current_line, expect->word, dupped_str);
-                        YARN_FREE(dupped_str);
-                        goto errored;
-                    }
+    /* names are resolved within the chapter; node_index isn't updated yet, and other chapters may go away. */
+    yarn_kvmap names = yarn_kvcreate(int, n_nodes * 2 + 1);
+    names.borrowed_keys = 1;
+    for (size_t n = 0; n < n_nodes; ++n) {
+        int index = (int)n;
+        yarn_kvpush(&names, program->nodes[n]->key, index);
+    }
 
-                    column_count++;
-                } else {
-                    /* TODO: @deviation
-                     * this part of the code must parse line number as an
-                     * integer.
-                     * */
-                    size_t consumed_since = 0;
-                    assert(current < advanced);
-                    if (begin[advanced - 1] == '"') {
-                        /* been in quote!! skip quote altogether. */
-                        consumed_since = (advanced - 1) - (current + 1);
-                        current += 1;
-                    } else {
-                        consumed_since = advanced - current;
-                    }
+    /* breadth first from every node. reached[] holds (node, jumps) in visiting order. */
+    int *reached = (int *)YARN_MALLOC(sizeof(int) * n_nodes * 2);
+    int *visited = (int *)YARN_MALLOC(sizeof(int) * n_nodes);
+    for (size_t n = 0; n < n_nodes; ++n) visited[n] = -1;
+
+    for (size_t n = 0; n < n_nodes; ++n) {
+        int n_reached = 0, at = 0, n_ids = 0;
+        reached[n_reached * 2] = (int)n;
+        reached[n_reached * 2 + 1] = 0;
+        n_reached++;
+        visited[n] = (int)n;
+
+        while (at < n_reached) {
+            int from  = reached[at * 2];
+            int jumps = reached[at * 2 + 1];
+            at++;
+
+            n_ids += chapter->manifests[from].n_own;
+            if (jumps >= depth) continue;
+
+            Yarn__Node *node = program->nodes[from]->value;
+            for (size_t i = 0; i + 1 < node->n_instructions; ++i) {
+                Yarn__Instruction *push = node->instructions[i];
+                if (push->opcode != YARN__INSTRUCTION__OP_CODE__PUSH_STRING ||
+                    node->instructions[i + 1]->opcode != YARN__INSTRUCTION__OP_CODE__RUN_NODE) continue;
+                if (push->n_operands < 1 || push->operands[0]->value_case != YARN__OPERAND__VALUE_STRING_VALUE) continue;
+
+                int to = -1;
+                if (yarn_kvget(&names, push->operands[0]->string_value, &to) == -1) continue;
+                if (visited[to] == (int)n) continue;
+
+                visited[to] = (int)n;
+                reached[n_reached * 2] = to;
+                reached[n_reached * 2 + 1] = jumps + 1;
+                n_reached++;
+            }
+        }
 
-                    char *current_ptr = &begin[current];
-                    char *dupped_str = yarn__strndup(current_ptr, consumed_since);
-                    size_t strlength = consumed_since;
-                    char *escaped_quote_at = strstr(dupped_str, "\"\""); /* search escaped quote. */
+        yarn_node_manifest *manifest = &chapter->manifests[n];
+        manifest->n_ids = n_ids;
+        manifest->ids   = (char **)yarn_allocate(allocator, sizeof(char *) * (n_ids ? n_ids : 1));
 
-                    while (escaped_quote_at) { /* escaped_quote_at points to the beginning of double quote escape. */
-                        /* how many char is remaining past escaped quote position? */
-                        size_t remaining = strlength - (escaped_quote_at - dupped_str) - 1;
+        n_ids = 0;
+        for (int r = 0; r < n_reached; ++r) {
+            n_ids += yarn__manifest_own_ids(program->nodes[reached[r * 2]]->value, manifest->ids + n_ids);
+        }
+    }
 
-                        memmove(escaped_quote_at,     /* first position of escaped quote */
-                                escaped_quote_at + 1, /* second after the escaped quote    */
-                                remaining);       /* since we're skipping 1 doublequote, subtract 1 from move amount */
+    YARN_FREE(reached);
+    YARN_FREE(visited);
+    yarn_kvdestroy(&names);
+}
 
-                        dupped_str[--strlength] = '\0'; /* shift consumed_since */
-                        escaped_quote_at = strstr(escaped_quote_at, "\"\""); /* continue */
-                    }
+const yarn_node_manifest *yarn_get_node_manifest(yarn_dialogue *dialogue, const char *node_name) {
+    yarn_node_ref ref = {0};
+    if (yarn_kvget(&dialogue->node_index, node_name, &ref) == -1) return 0;
 
-                    if (current_column == 0) {        /* id */
-                        line_id = dupped_str;
-                    } else if (current_column == 1) { /* text */
-                        line.text = dupped_str;
-                    } else if (current_column == 2) { /* file */
-                        line.file = dupped_str;
-                    } else if (current_column == 3) {
-                        line.node = dupped_str;
-                    } else {
-                        printf("error(csv line %d): unexpected column\n", current_line);
-                        goto errored;
-                    }
-                }
+    yarn_chapter *chapter = &dialogue->chapters.entries[ref.chapter];
+    return chapter->manifests ? &chapter->manifests[ref.node] : 0;
+}
 
-                current_column++;
-                advanced++; /* skip comma */
-                current = advanced;
-            } break;
+struct yarn_prefetch_queue {
+    yarn_prefetch_request *requests; /* ring buffer. */
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    YARN_DYN_ARRAY(const yarn_node_manifest *) in_flight; /* manifests popped, but not done yet. */
+
+#if defined(YARN_C99_THREADS)
+  #if defined(_WIN32)
+    SRWLOCK            lock;
+    CONDITION_VARIABLE changed;
+  #else
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+  #endif
+#endif
+};
+
+#if defined(YARN_C99_THREADS)
+  #if defined(_WIN32)
+    #define YARN__PREFETCH_LOCK(q)   AcquireSRWLockExclusive(&(q)->lock)
+    #define YARN__PREFETCH_UNLOCK(q) ReleaseSRWLockExclusive(&(q)->lock)
+    #define YARN__PREFETCH_WAIT(q)   SleepConditionVariableSRW(&(q)->changed, &(q)->lock, INFINITE, 0)
+    #define YARN__PREFETCH_WAKE(q)   WakeAllConditionVariable(&(q)->changed)
+  #else
+    #define YARN__PREFETCH_LOCK(q)   pthread_mutex_lock(&(q)->lock)
+    #define YARN__PREFETCH_UNLOCK(q) pthread_mutex_unlock(&(q)->lock)
+    #define YARN__PREFETCH_WAIT(q)   pthread_cond_wait(&(q)->changed, &(q)->lock)
+    #define YARN__PREFETCH_WAKE(q)   pthread_cond_broadcast(&(q)->changed)
+  #endif
+#else
+  /* nobody to wait for. */
+  #define YARN__PREFETCH_LOCK(q)   (void)(q)
+  #define YARN__PREFETCH_UNLOCK(q) (void)(q)
+  #define YARN__PREFETCH_WAIT(q)   (void)(q)
+  #define YARN__PREFETCH_WAKE(q)   (void)(q)
+#endif
+
+yarn_prefetch_queue *yarn_create_prefetch_queue(int capacity) {
+    if (capacity < 1) capacity = 1;
+
+    yarn_prefetch_queue *queue = (yarn_prefetch_queue *)YARN_MALLOC(sizeof(yarn_prefetch_queue));
+    memset(queue, 0, sizeof(yarn_prefetch_queue));
+    queue->requests = (yarn_prefetch_request *)YARN_MALLOC(sizeof(yarn_prefetch_request) * capacity);
+    queue->capacity = capacity;
+    YARN_MAKE_DYNARRAY(&queue->in_flight, const yarn_node_manifest *, 4);
+
+#if defined(YARN_C99_THREADS)
+  #if defined(_WIN32)
+    InitializeSRWLock(&queue->lock);
+    InitializeConditionVariable(&queue->changed);
+  #else
+    pthread_mutex_init(&queue->lock, 0);
+    pthread_cond_init(&queue->changed, 0);
+  #endif
+#endif
+    return queue;
+}
 
-            default: advanced++;
+void yarn_destroy_prefetch_queue(yarn_prefetch_queue *queue) {
+#if defined(YARN_C99_THREADS) && !defined(_WIN32)
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+#endif
+    YARN_FREE(queue->in_flight.entries);
+    YARN_FREE(queue->requests);
+    YARN_FREE(queue);
+}
+
+void yarn_close_prefetch_queue(yarn_prefetch_queue *queue) {
+    YARN__PREFETCH_LOCK(queue);
+    queue->closed = 1;
+    queue->count  = 0;
+    YARN__PREFETCH_WAKE(queue);
+    YARN__PREFETCH_UNLOCK(queue);
+}
+
+void yarn__prefetch_push(yarn_prefetch_queue *queue, const char *node_name, const yarn_node_manifest *manifest) {
+    YARN__PREFETCH_LOCK(queue);
+    if (!queue->closed) {
+        if (queue->count == queue->capacity) {
+            queue->head = (queue->head + 1) % queue->capacity;
+            queue->count--;
         }
+
+        yarn_prefetch_request *request = &queue->requests[(queue->head + queue->count) % queue->capacity];
+        request->node_name = node_name;
+        request->manifest  = manifest;
+        queue->count++;
+        YARN__PREFETCH_WAKE(queue);
     }
+    YARN__PREFETCH_UNLOCK(queue);
+}
 
-done:
-    if (string_table_length < current || begin[current] != '\0') { /* (string table length - 1) == position of '\0' */
-        printf("error: couldn't parse until the end of the string table. data possibly corrupted\n");
-        goto errored;
+int yarn_prefetch_pop(yarn_prefetch_queue *queue, yarn_prefetch_request *request, int wait) {
+    YARN__PREFETCH_LOCK(queue);
+#if defined(YARN_C99_THREADS)
+    while (wait && queue->count == 0 && !queue->closed) {
+        YARN__PREFETCH_WAIT(queue);
     }
-    if (in_quote) {
-        printf("error: unexpected eof while parsing double quotation\n");
-        goto errored;
+#else
+    (void)wait;
+#endif
+
+    int popped = queue->count > 0 && !queue->closed;
+    if (popped) {
+        *request = queue->requests[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        YARN_DYNARR_APPEND(&queue->in_flight, request->manifest);
     }
-    return 1;
+    YARN__PREFETCH_UNLOCK(queue);
+    return popped;
+}
 
-errored:
-    if (line_id) YARN_FREE(line_id);
-    if (line.text) YARN_FREE(line.text);
-    if (line.file) YARN_FREE(line.file);
-    if (line.node) YARN_FREE(line.node);
+void yarn_prefetch_done(yarn_prefetch_queue *queue, const yarn_prefetch_request *request) {
+    YARN__PREFETCH_LOCK(queue);
+    size_t at = 0;
+    while (at < queue->in_flight.used && queue->in_flight.entries[at] != request->manifest) at++;
+    assert(at < queue->in_flight.used);
+    if (at < queue->in_flight.used) queue->in_flight.entries[at] = queue->in_flight.entries[--queue->in_flight.used];
+    YARN__PREFETCH_WAKE(queue);
+    YARN__PREFETCH_UNLOCK(queue);
+}
+
+/* some popped request is of a manifest in [from, to). call with queue locked. */
+int yarn__prefetch_reading(yarn_prefetch_queue *queue, const yarn_node_manifest *from, const yarn_node_manifest *to) {
+    for (size_t i = 0; i < queue->in_flight.used; ++i) {
+        if (queue->in_flight.entries[i] >= from && queue->in_flight.entries[i] < to) return 1;
+    }
     return 0;
 }
 
+void yarn__prefetch_forget(yarn_prefetch_queue *queue, yarn_chapter *chapter) {
+    const yarn_node_manifest *from = chapter->manifests;
+    const yarn_node_manifest *to   = from + chapter->program->n_nodes;
+
+    YARN__PREFETCH_LOCK(queue);
+    int kept = 0;
+    for (int i = 0; i < queue->count; ++i) {
+        yarn_prefetch_request request = queue->requests[(queue->head + i) % queue->capacity];
+        if (request.manifest >= from && request.manifest < to) continue;
+        queue->requests[(queue->head + kept++) % queue->capacity] = request;
+    }
+    queue->count = kept;
+
+    /* popped request may still be reading from the chapter. */
+#if defined(YARN_C99_THREADS)
+    while (yarn__prefetch_reading(queue, from, to)) {
+        YARN__PREFETCH_WAIT(queue);
+    }
+#endif
+    YARN__PREFETCH_UNLOCK(queue);
+}
+
+/* ===========================================
+ * Memory accounting.
+ */
+
+/* size yarn_allocate actually takes for the request. */
+#define YARN__ARENA_SIZE(sz) (((sz) + 15) & ~((size_t)15))
+
+void yarn__stats_add(yarn_memory_stats *stats, int category, size_t bytes, size_t allocations) {
+    assert(category >= 0 && category < YARN_MEMORY_CATEGORY_COUNT);
+    stats->categories[category].bytes       += bytes;
+    stats->categories[category].allocations += allocations;
+}
+
+size_t yarn__stats_add_allocator(yarn_memory_stats *stats, yarn_allocator *allocator, size_t accounted_bytes) {
+    size_t reserved = sizeof(yarn_allocator_chunk); /* sentinel */
+    size_t chunks   = 1;
+
+    yarn_allocator_chunk *current = allocator->sentinel->next;
+    while(current->buffer != 0) {
+        reserved += sizeof(yarn_allocator_chunk) + current->capacity;
+        chunks   += 2; /* header + buffer */
+        current = current->next;
+    }
+
+    /* whatever the categories didn't claim is overhead of the allocator itself. */
+    size_t overhead = (reserved > accounted_bytes) ? reserved - accounted_bytes : 0;
+    yarn__stats_add(stats, YARN_MEMORY_ARENA, overhead, chunks);
+    return reserved;
+}
+
+void yarn__stats_add_kvmap(yarn_memory_stats *stats, yarn_kvmap *map) {
+    yarn__stats_add(stats, YARN_MEMORY_KVMAP, map->capacity * (sizeof(yarn_kvpair_header) + map->element_size + 1) + YARN__KV_GROUP - 1, 3);
+    if (map->borrowed_keys) return; /* owner counts them. */
+
+    /* key only iteration; yarn_kvforeach wants a value. */
+    char *key = 0;
+    for (int at = yarn__kvmap_iternext(map, &key, 0, 0, 0); at != -1; at = yarn__kvmap_iternext(map, &key, 0, 0, at)) {
+        yarn__stats_add(stats, YARN_MEMORY_STRINGS, strlen(key) + 1, 1);
+    }
+}
+
+size_t yarn__stats_add_string(yarn_memory_stats *stats, const char *str) {
+    if (!str || str == protobuf_c_empty_string) return 0;
+
+    size_t size = YARN__ARENA_SIZE(strlen(str) + 1);
+    yarn__stats_add(stats, YARN_MEMORY_STRINGS, size, 1);
+    return size;
+}
+
+size_t yarn__stats_add_operand(yarn_memory_stats *stats, Yarn__Operand *operand) {
+    size_t counted = YARN__ARENA_SIZE(sizeof(Yarn__Operand));
+    yarn__stats_add(stats, YARN_MEMORY_OPERANDS, counted, 1);
+
+    if (operand->value_case == YARN__OPERAND__VALUE_STRING_VALUE) {
+        counted += yarn__stats_add_string(stats, operand->string_value);
+    }
+    return counted;
+}
+
+size_t yarn__stats_add_program(yarn_memory_stats *stats, Yarn__Program *program) {
+    size_t counted = 0;
+    size_t size    = 0;
+
+    size = YARN__ARENA_SIZE(sizeof(Yarn__Program)) + YARN__ARENA_SIZE(sizeof(void *) * (program->n_nodes + 1));
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, size, 2);
+    counted += size + yarn__stats_add_string(stats, program->name);
+
+    for (size_t n = 0; n < program->n_nodes; ++n) {
+        Yarn__Program__NodesEntry *entry = program->nodes[n];
+        Yarn__Node *node = entry->value;
+
+        size = YARN__ARENA_SIZE(sizeof(Yarn__Program__NodesEntry)) + YARN__ARENA_SIZE(sizeof(Yarn__Node));
+        yarn__stats_add(stats, YARN_MEMORY_INSTRUCTIONS, size, 2);
+        counted += size;
+        counted += yarn__stats_add_string(stats, entry->key);
+        counted += yarn__stats_add_string(stats, node->name);
+        counted += yarn__stats_add_string(stats, node->sourcetextstringid);
+
+        if (node->n_instructions > 0) {
+            size = YARN__ARENA_SIZE(sizeof(void *) * node->n_instructions);
+            yarn__stats_add(stats, YARN_MEMORY_INSTRUCTIONS, size, 1);
+            counted += size;
+        }
+
+        for (size_t i = 0; i < node->n_instructions; ++i) {
+            Yarn__Instruction *inst = node->instructions[i];
+
+            size = YARN__ARENA_SIZE(sizeof(Yarn__Instruction));
+            yarn__stats_add(stats, YARN_MEMORY_INSTRUCTIONS, size, 1);
+            counted += size;
+
+            if (inst->n_operands > 0) {
+                size = YARN__ARENA_SIZE(sizeof(void *) * inst->n_operands);
+                yarn__stats_add(stats, YARN_MEMORY_OPERANDS, size, 1);
+                counted += size;
+            }
+
+            for (size_t o = 0; o < inst->n_operands; ++o) {
+                counted += yarn__stats_add_operand(stats, inst->operands[o]);
+            }
+        }
+
+        if (node->n_labels > 0) {
+            size = YARN__ARENA_SIZE(sizeof(void *) * node->n_labels);
+            yarn__stats_add(stats, YARN_MEMORY_LABELS, size, 1);
+            counted += size;
+        }
+
+        for (size_t l = 0; l < node->n_labels; ++l) {
+            size = YARN__ARENA_SIZE(sizeof(Yarn__Node__LabelsEntry)) + YARN__ARENA_SIZE(strlen(node->labels[l]->key) + 1);
+            yarn__stats_add(stats, YARN_MEMORY_LABELS, size, 2);
+            counted += size;
+        }
+
+        if (node->n_tags > 0) {
+            size = YARN__ARENA_SIZE(sizeof(void *) * node->n_tags);
+            yarn__stats_add(stats, YARN_MEMORY_OTHER, size, 1);
+            counted += size;
+        }
+
+        for (size_t t = 0; t < node->n_tags; ++t) {
+            counted += yarn__stats_add_string(stats, node->tags[t]);
+        }
+    }
+
+    size = YARN__ARENA_SIZE(sizeof(void *) * (program->n_initial_values + 1));
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, size, 1);
+    counted += size;
+
+    for (size_t i = 0; i < program->n_initial_values; ++i) {
+        Yarn__Program__InitialValuesEntry *iv = program->initial_values[i];
+
+        size = YARN__ARENA_SIZE(sizeof(Yarn__Program__InitialValuesEntry));
+        yarn__stats_add(stats, YARN_MEMORY_OTHER, size, 1);
+        counted += size;
+        counted += yarn__stats_add_string(stats, iv->key);
+        counted += yarn__stats_add_operand(stats, iv->value);
+    }
+
+    return counted;
+}
+
+void yarn__stats_add_chapter(yarn_memory_stats *stats, yarn_chapter *chapter) {
+    size_t counted = yarn__stats_add_program(stats, chapter->program);
+    if (chapter->line_indexes) {
+        size_t bytes = YARN__ARENA_SIZE(sizeof(int *) * (chapter->program->n_nodes ? chapter->program->n_nodes : 1));
+        yarn__stats_add(stats, YARN_MEMORY_OPERANDS, bytes, 1);
+        counted += bytes;
+
+        for (size_t n = 0; n < chapter->program->n_nodes; ++n) {
+            size_t n_instructions = chapter->program->nodes[n]->value->n_instructions;
+            bytes = YARN__ARENA_SIZE(sizeof(int) * (n_instructions ? n_instructions : 1));
+            yarn__stats_add(stats, YARN_MEMORY_OPERANDS, bytes, 1);
+            counted += bytes;
+        }
+    }
+    if (chapter->commands) {
+        size_t bytes = YARN__ARENA_SIZE(sizeof(yarn_command **) * chapter->program->n_nodes);
+        yarn__stats_add(stats, YARN_MEMORY_OPERANDS, bytes, 1);
+        counted += bytes;
+
+        for (size_t n = 0; n < chapter->program->n_nodes; ++n) {
+            Yarn__Node *node = chapter->program->nodes[n]->value;
+            if (!chapter->commands[n]) continue;
+
+            bytes = YARN__ARENA_SIZE(sizeof(yarn_command *) * node->n_instructions);
+            yarn__stats_add(stats, YARN_MEMORY_OPERANDS, bytes, 1);
+            counted += bytes;
+
+            for (size_t i = 0; i < node->n_instructions; ++i) {
+                yarn_command *command = chapter->commands[n][i];
+                if (!command) continue;
+
+                /* token copy, command, arguments. */
+                bytes = YARN__ARENA_SIZE(strlen(node->instructions[i]->operands[0]->string_value) + 1);
+                yarn__stats_add(stats, YARN_MEMORY_STRINGS, bytes, 1);
+                counted += bytes;
+
+                bytes = YARN__ARENA_SIZE(sizeof(yarn_command)) + YARN__ARENA_SIZE(sizeof(yarn_command_arg) * (command->n_args ? command->n_args : 1));
+                yarn__stats_add(stats, YARN_MEMORY_OPERANDS, bytes, 2);
+                counted += bytes;
+            }
+        }
+    }
+    if (chapter->manifests) {
+        size_t bytes = YARN__ARENA_SIZE(sizeof(yarn_node_manifest) * chapter->program->n_nodes);
+        yarn__stats_add(stats, YARN_MEMORY_OTHER, bytes, 1);
+        counted += bytes;
+
+        for (size_t n = 0; n < chapter->program->n_nodes; ++n) {
+            int n_ids = chapter->manifests[n].n_ids;
+            bytes = YARN__ARENA_SIZE(sizeof(char *) * (n_ids ? n_ids : 1));
+            yarn__stats_add(stats, YARN_MEMORY_OTHER, bytes, 1);
+            counted += bytes;
+        }
+    }
+    for (int i = 0; i < chapter->n_allocators; ++i) {
+        /* program is spread over every allocator; overhead is only known in total. */
+        size_t reserved = yarn__stats_add_allocator(stats, &chapter->allocators[i], counted);
+        counted = (counted > reserved) ? counted - reserved : 0;
+    }
+
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_allocator) * chapter->n_allocators, 1);
+    if (chapter->name) yarn__stats_add(stats, YARN_MEMORY_STRINGS, strlen(chapter->name) + 1, 1);
+}
+
+void yarn__stats_sum(yarn_memory_stats *stats) {
+    stats->total.bytes       = 0;
+    stats->total.allocations = 0;
+
+    for (int i = 0; i < YARN_MEMORY_CATEGORY_COUNT; ++i) {
+        stats->total.bytes       += stats->categories[i].bytes;
+        stats->total.allocations += stats->categories[i].allocations;
+    }
+}
+
+int yarn_get_chapter_memory_stats(yarn_dialogue *dialogue, const char *chapter_name, yarn_memory_stats *stats) {
+    memset(stats, 0, sizeof(yarn_memory_stats));
+
+    int index = yarn__find_chapter(dialogue, chapter_name);
+    if (index == -1) return 0;
+
+    yarn__stats_add_chapter(stats, &dialogue->chapters.entries[index]);
+    yarn__stats_sum(stats);
+    return 1;
+}
+
+int yarn_get_dialogue_memory_stats(yarn_dialogue *dialogue, yarn_memory_stats *stats) {
+    memset(stats, 0, sizeof(yarn_memory_stats));
+
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_dialogue), 1);
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_chapter) * dialogue->chapters.capacity, 1);
+    yarn__stats_add(stats, YARN_MEMORY_SCRATCH, sizeof(yarn_option) * dialogue->current_options.capacity, 1);
+
+    yarn__stats_add_kvmap(stats, &dialogue->library);
+    yarn__stats_add_kvmap(stats, &dialogue->commands);
+    yarn__stats_add_kvmap(stats, &dialogue->node_index);
+    yarn__stats_add_kvmap(stats, &dialogue->line_index);
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(char *) * dialogue->line_ids.capacity, 1);
+
+    size_t line_ids = 0;
+    for (yarn_allocator_chunk *c = dialogue->line_allocator.sentinel->next; c->buffer != 0; c = c->next) {
+        line_ids += c->used;
+    }
+    yarn__stats_add(stats, YARN_MEMORY_STRINGS, line_ids, 0);
+    yarn__stats_add_allocator(stats, &dialogue->line_allocator, line_ids);
+
+    /* the whole dialogue allocator is substitution / command scratch. */
+    size_t scratch = 0;
+    yarn_allocator_chunk *current = dialogue->dialogue_allocator.sentinel->next;
+    while(current->buffer != 0) {
+        scratch += current->used;
+        current = current->next;
+    }
+    yarn__stats_add(stats, YARN_MEMORY_SCRATCH, scratch, 0);
+    yarn__stats_add_allocator(stats, &dialogue->dialogue_allocator, scratch);
+
+    for (size_t i = 0; i < dialogue->chapters.used; ++i) {
+        yarn__stats_add_chapter(stats, &dialogue->chapters.entries[i]);
+    }
+
+    yarn__stats_sum(stats);
+    return 1;
+}
+
+int yarn_get_string_table_memory_stats(yarn_string_table *table, yarn_memory_stats *stats) {
+    memset(stats, 0, sizeof(yarn_memory_stats));
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_string_table), 1);
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(char *) * table->interned.capacity, 1);
+
+    if (table->lazy_slots) {
+        yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_lazy_slot) * table->lazy_cache_lines, 1);
+        for (int i = 0; i < table->lazy_used; ++i) {
+            yarn__stats_add(stats, YARN_MEMORY_STRINGS, strlen(table->lazy_slots[i].text) + 1, 1);
+        }
+    }
+
+    if (table->text_blocks.entries) {
+        yarn__stats_add(stats, YARN_MEMORY_OTHER,   sizeof(yarn_text_block) * table->text_blocks.capacity, 1);
+        yarn__stats_add(stats, YARN_MEMORY_STRINGS, table->compressed_text.capacity, 1);
+    }
+    if (table->staged_text.entries) yarn__stats_add(stats, YARN_MEMORY_SCRATCH, table->staged_text.capacity, 1);
+    for (int i = 0; i < YARN_TEXT_BLOCK_CACHE; ++i) {
+        if (table->block_cache[i].text) yarn__stats_add(stats, YARN_MEMORY_SCRATCH, table->block_cache[i].capacity, 1);
+    }
+    yarn__stats_add_kvmap(stats, &table->table);
+    yarn__stats_add_kvmap(stats, &table->interned_ids);
+    if (table->bound_lines.entries) yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_bound_line) * table->bound_lines.capacity, 1);
+    if (table->frozen.slots) {
+        yarn__stats_add(stats, YARN_MEMORY_KVMAP, sizeof(uint32_t) * table->frozen.n_buckets, 1);
+        yarn__stats_add(stats, YARN_MEMORY_KVMAP, sizeof(uint32_t) * table->frozen.n_lines, 1);
+    }
+    if (table->format_buckets) yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_cached_line *) * table->n_format_buckets, 1);
+    for (yarn_cached_line *cached = table->format_head; cached; cached = cached->next) {
+        yarn__stats_add(stats, YARN_MEMORY_SCRATCH, cached->size, 1);
+    }
+
+    /* allocator holds ids and texts, and markup / templates of lines. */
+    size_t formats = 0;
+    char *key = 0;
+    yarn_parsed_entry entry;
+    yarn_kvforeach(&table->table, &key, &entry) {
+        formats += yarn__stats_add_line_format(stats, &entry);
+    }
+
+    size_t used = 0;
+    yarn_allocator_chunk *current = table->allocator.sentinel->next;
+    while(current->buffer != 0) {
+        used += current->used;
+        current = current->next;
+    }
+    yarn__stats_add(stats, YARN_MEMORY_STRINGS, used > formats ? used - formats : 0, 0);
+    yarn__stats_add_allocator(stats, &table->allocator, used);
+
+    yarn__stats_sum(stats);
+    return 1;
+}
+
+int yarn_get_storage_memory_stats(yarn_variable_storage storage, yarn_memory_stats *stats) {
+    memset(stats, 0, sizeof(yarn_memory_stats));
+    if (storage.load != &yarn__load_from_default_storage) return 0;
+
+    yarn_default_storage *str = (yarn_default_storage *)storage.data;
+    yarn__stats_add(stats, YARN_MEMORY_OTHER, sizeof(yarn_default_storage), 1);
+    yarn__stats_add_kvmap(stats, &str->kvmap);
+
+    /* string values are kept alive in storage allocator. */
+    size_t counted = 0;
+    char *key = 0;
+    yarn_value value = {0};
+    yarn_kvforeach(&str->kvmap, &key, &value) {
+        if (value.type == YARN_VALUE_STRING) {
+            size_t size = YARN__ARENA_SIZE(strlen(value.values.v_string) + 1);
+            yarn__stats_add(stats, YARN_MEMORY_STRINGS, size, 1);
+            counted += size;
+        }
+    }
+    yarn__stats_add_allocator(stats, &str->allocator, counted);
+
+    yarn__stats_sum(stats);
+    return 1;
+}
+
+const char *yarn_memory_category_name(int category) {
+    switch(category) {
+        case YARN_MEMORY_INSTRUCTIONS: return "instructions";
+        case YARN_MEMORY_OPERANDS:     return "operands";
+        case YARN_MEMORY_STRINGS:      return "strings";
+        case YARN_MEMORY_LABELS:       return "labels";
+        case YARN_MEMORY_KVMAP:        return "kvmap";
+        case YARN_MEMORY_ARENA:        return "arena";
+        case YARN_MEMORY_SCRATCH:      return "scratch";
+        case YARN_MEMORY_OTHER:        return "other";
+        case YARN_MEMORY_TEMPLATES:    return "templates";
+        default:                       return "unknown";
+    }
+}
+
+/* ===========================================
+ * Number formatting.
+ *
+ * shortest digits that read back as the same float: free-format algorithm of Burger & Dybvig,
+ * on bignums just big enough for floats (~180 bits). integers below 2^24 skip all of it.
+ */
+
+#define YARN__BIGNUM_WORDS 10
+
+typedef struct {
+    int      used;
+    uint32_t words[YARN__BIGNUM_WORDS];
+} yarn__bignum;
+
+void yarn__bignum_set(yarn__bignum *b, uint64_t value) {
+    b->used = 0;
+    for (; value; value >>= 32) b->words[b->used++] = (uint32_t)value;
+}
+
+void yarn__bignum_mul(yarn__bignum *b, uint32_t factor) {
+    uint64_t carry = 0;
+    for (int i = 0; i < b->used; ++i) {
+        uint64_t product = (uint64_t)b->words[i] * factor + carry;
+        b->words[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+    if (carry) b->words[b->used++] = (uint32_t)carry;
+}
+
+void yarn__bignum_mul_pow10(yarn__bignum *b, int exponent) {
+    static const uint32_t pow10[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+    for (; exponent >= 9; exponent -= 9) yarn__bignum_mul(b, 1000000000u);
+    if (exponent > 0) yarn__bignum_mul(b, pow10[exponent]);
+}
+
+void yarn__bignum_shl(yarn__bignum *b, int bits) {
+    if (b->used == 0) return;
+
+    int words = bits / 32;
+    bits %= 32;
+    if (bits) {
+        uint32_t carry = 0;
+        for (int i = 0; i < b->used; ++i) {
+            uint32_t word = b->words[i];
+            b->words[i] = (word << bits) | carry;
+            carry = word >> (32 - bits);
+        }
+        if (carry) b->words[b->used++] = carry;
+    }
+    if (words) {
+        memmove(b->words + words, b->words, sizeof(uint32_t) * b->used);
+        memset(b->words, 0, sizeof(uint32_t) * words);
+        b->used += words;
+    }
+}
+
+int yarn__bignum_cmp(const yarn__bignum *a, const yarn__bignum *b) {
+    if (a->used != b->used) return (a->used < b->used) ? -1 : 1;
+    for (int i = a->used - 1; i >= 0; --i) {
+        if (a->words[i] != b->words[i]) return (a->words[i] < b->words[i]) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* out = a + b. */
+void yarn__bignum_add(yarn__bignum *out, const yarn__bignum *a, const yarn__bignum *b) {
+    int used = (a->used > b->used) ? a->used : b->used;
+    uint64_t carry = 0;
+    for (int i = 0; i < used; ++i) {
+        uint64_t sum = carry;
+        if (i < a->used) sum += a->words[i];
+        if (i < b->used) sum += b->words[i];
+        out->words[i] = (uint32_t)sum;
+        carry = sum >> 32;
+    }
+    out->used = used;
+    if (carry) out->words[out->used++] = (uint32_t)carry;
+}
+
+/* a -= b, a >= b. */
+void yarn__bignum_sub(yarn__bignum *a, const yarn__bignum *b) {
+    int64_t borrow = 0;
+    for (int i = 0; i < a->used; ++i) {
+        int64_t difference = (int64_t)a->words[i] - (i < b->used ? b->words[i] : 0) - borrow;
+        borrow = difference < 0;
+        a->words[i] = (uint32_t)difference;
+    }
+    while (a->used > 0 && a->words[a->used - 1] == 0) a->used--;
+}
+
+/* k from log2 of value (x * log10(2) ~ x * 78913 / 2^18); never too big, fixed up after if too small. */
+int yarn__estimate_decimal_exponent(uint64_t f, int e) {
+    int x = e - 1;
+    for (uint64_t rest = f; rest; rest >>= 1) x++;
+    int estimate = (x >= 0) ? (x * 78913) >> 18 : -((-x * 78913 + (1 << 18) - 1) >> 18);
+    return estimate + (x != 0);
+}
+
+/* yarn__shortest_digits, for values from ~1e-9 to ~1e15: r * 10 fits in 64 bits there, so no bignums. */
+int yarn__shortest_digits_small(uint64_t f, int e, int even, int closer, char *digits, int *k) {
+    uint64_t r, s, m_plus, m_minus;
+    if (e >= 0) {
+        r = f << (e + 1 + closer);
+        s = 2u << closer;
+        m_plus  = (uint64_t)1 << (e + closer);
+        m_minus = (uint64_t)1 << e;
+    } else {
+        r = f << (1 + closer);
+        s = (uint64_t)1 << (1 + closer - e);
+        m_plus  = (uint64_t)1 << closer;
+        m_minus = 1;
+    }
+
+    *k = yarn__estimate_decimal_exponent(f, e);
+    for (int i = 0; i < *k; ++i) s *= 10;
+    for (int i = 0; i < -*k; ++i) {
+        r *= 10;
+        m_plus *= 10;
+        m_minus *= 10;
+    }
+    while (even ? r + m_plus >= s : r + m_plus > s) {
+        s *= 10;
+        (*k)++;
+    }
+
+    int n = 0;
+    for (;;) {
+        r *= 10;
+        m_plus *= 10;
+        m_minus *= 10;
+        int digit = (int)(r / s);
+        r %= s;
+
+        int low  = even ? r <= m_minus : r < m_minus;
+        int high = even ? r + m_plus >= s : r + m_plus > s;
+        if (low && high) {
+            if (r * 2 > s || (r * 2 == s && (digit & 1))) digit++;
+        } else if (high) {
+            digit++;
+        }
+
+        digits[n++] = (char)('0' + digit);
+        if (low || high) return n;
+    }
+}
+
+/* digits of value, such that value ~ 0.digits * 10^k. returns number of digits. */
+int yarn__shortest_digits(uint32_t mantissa, int biased_exponent, char *digits, int *k) {
+    /* value = f * 2^e, and the interval of everything that rounds to it is (value - m-, value + m+) / s. */
+    uint64_t f = (biased_exponent == 0) ? mantissa : (mantissa | 0x800000u);
+    int      e = (biased_exponent == 0) ? -149 : biased_exponent - 150;
+    int  even  = (f & 1) == 0; /* round half to even: boundaries read back as value too. */
+    int closer = (mantissa == 0 && biased_exponent > 1); /* float below is half as far. */
+
+    if (e >= -54 && e <= 26) return yarn__shortest_digits_small(f, e, even, closer, digits, k);
+
+    yarn__bignum r, s, m_plus, m_minus, sum;
+    if (e >= 0) {
+        yarn__bignum_set(&r, f);       yarn__bignum_shl(&r, e + 1 + closer);
+        yarn__bignum_set(&s, 2u << closer);
+        yarn__bignum_set(&m_plus, 1);  yarn__bignum_shl(&m_plus, e + closer);
+        yarn__bignum_set(&m_minus, 1); yarn__bignum_shl(&m_minus, e);
+    } else {
+        yarn__bignum_set(&r, f << (1 + closer));
+        yarn__bignum_set(&s, 1);       yarn__bignum_shl(&s, 1 + closer - e);
+        yarn__bignum_set(&m_plus, 1u << closer);
+        yarn__bignum_set(&m_minus, 1);
+    }
+
+    *k = yarn__estimate_decimal_exponent(f, e);
+    if (*k >= 0) {
+        yarn__bignum_mul_pow10(&s, *k);
+    } else {
+        yarn__bignum_mul_pow10(&r, -*k);
+        yarn__bignum_mul_pow10(&m_plus, -*k);
+        yarn__bignum_mul_pow10(&m_minus, -*k);
+    }
+    for (;;) {
+        yarn__bignum_add(&sum, &r, &m_plus);
+        int c = yarn__bignum_cmp(&sum, &s);
+        if (!(even ? c >= 0 : c > 0)) break;
+        yarn__bignum_mul(&s, 10);
+        (*k)++;
+    }
+
+    /* one digit at a time, until what's left is within the interval. */
+    int n = 0;
+    for (;;) {
+        yarn__bignum_mul(&r, 10);
+        yarn__bignum_mul(&m_plus, 10);
+        yarn__bignum_mul(&m_minus, 10);
+
+        int digit = 0;
+        while (yarn__bignum_cmp(&r, &s) >= 0) {
+            yarn__bignum_sub(&r, &s);
+            digit++;
+        }
+
+        yarn__bignum_add(&sum, &r, &m_plus);
+        int low  = even ? yarn__bignum_cmp(&r, &m_minus) <= 0 : yarn__bignum_cmp(&r, &m_minus) < 0;
+        int high = even ? yarn__bignum_cmp(&sum, &s) >= 0    : yarn__bignum_cmp(&sum, &s) > 0;
+
+        if (low && high) {
+            /* both ends work: the closer one, even digit on a tie. */
+            yarn__bignum_shl(&r, 1);
+            int c = yarn__bignum_cmp(&r, &s);
+            if (c > 0 || (c == 0 && (digit & 1))) digit++;
+        } else if (high) {
+            digit++;
+        }
+
+        digits[n++] = (char)('0' + digit);
+        if (low || high) return n;
+    }
+}
+
+size_t yarn__format_float(float value, char *out) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t mantissa        = bits & 0x7FFFFFu;
+    int      biased_exponent = (int)((bits >> 23) & 0xFF);
+    size_t   length          = 0;
+
+    if (biased_exponent == 0xFF) {
+        const char *special = mantissa ? "NaN" : ((bits >> 31) ? "-Infinity" : "Infinity");
+        length = strlen(special);
+        memcpy(out, special, length + 1);
+        return length;
+    }
+    if (bits >> 31) out[length++] = '-';
+
+    float magnitude = (bits >> 31) ? -value : value;
+    if (magnitude < 16777216.0f && magnitude == (float)(uint32_t)magnitude) {
+        /* integer: every digit is exact, and it's already as short as it gets. */
+        uint32_t integer = (uint32_t)magnitude;
+        char reversed[10];
+        int n = 0;
+        do {
+            reversed[n++] = (char)('0' + integer % 10);
+            integer /= 10;
+        } while (integer);
+        while (n) out[length++] = reversed[--n];
+        out[length] = '\0';
+        return length;
+    }
+
+    char digits[12];
+    int k = 0;
+    int n = yarn__shortest_digits(mantissa, biased_exponent, digits, &k);
+    int exponent = k - 1; /* of the first digit. */
+
+    if (exponent < -5 || exponent >= 15) {
+        out[length++] = digits[0];
+        if (n > 1) {
+            out[length++] = '.';
+            memcpy(out + length, digits + 1, n - 1);
+            length += n - 1;
+        }
+        out[length++] = 'E';
+        out[length++] = (exponent < 0) ? '-' : '+';
+        int magnitude_exponent = (exponent < 0) ? -exponent : exponent;
+        if (magnitude_exponent >= 100) out[length++] = (char)('0' + magnitude_exponent / 100);
+        out[length++] = (char)('0' + (magnitude_exponent / 10) % 10);
+        out[length++] = (char)('0' + magnitude_exponent % 10);
+    } else if (k <= 0) {
+        out[length++] = '0';
+        out[length++] = '.';
+        for (int i = 0; i < -k; ++i) out[length++] = '0';
+        memcpy(out + length, digits, n);
+        length += n;
+    } else if (k >= n) {
+        memcpy(out + length, digits, n);
+        length += n;
+        for (int i = n; i < k; ++i) out[length++] = '0';
+    } else {
+        memcpy(out + length, digits, k);
+        length += k;
+        out[length++] = '.';
+        memcpy(out + length, digits + k, n - k);
+        length += n - k;
+    }
+
+    out[length] = '\0';
+    return length;
+}
+
+int yarn_format_number(float value, char *buffer, size_t capacity) {
+    char temp[YARN__NUMBER_CAPACITY];
+    size_t length = yarn__format_float(value, temp);
+    if (capacity > 0) {
+        size_t n = (length < capacity) ? length : capacity - 1;
+        memcpy(buffer, temp, n);
+        buffer[n] = '\0';
+    }
+    return (int)length;
+}
+
+/* ===========================================
+ * Text manipulation / substitutions.
+ */
+
+const char *yarn__value_text(yarn_value value, char *number, size_t *length) {
+    const char *text = "None";
+    switch(value.type) {
+        case YARN_VALUE_STRING: text = value.values.v_string ? value.values.v_string : ""; break;
+        case YARN_VALUE_BOOL:   text = value.values.v_bool ? "true" : "false";            break;
+        case YARN_VALUE_FLOAT:
+            *length = yarn__format_float(value.values.v_float, number);
+            return number;
+        default: break;
+    }
+    *length = strlen(text);
+    return text;
+}
+
+char *yarn__substitute_values(yarn_allocator *allocator, const char *format, yarn_value *values, int n_values) {
+    assert(format);
+
+    /* measure, then write into exactly that much. */
+    size_t length = yarn__substitute_into(format, values, n_values, 0, 0);
+    char *result = (char *)yarn_allocate(allocator, length + 1);
+    yarn__substitute_into(format, values, n_values, result, length + 1);
+    return result;
+}
+
+size_t yarn__substitute_into(const char *format, yarn_value *substs, int n_substs, char *buffer, size_t capacity) {
+    char number[YARN__NUMBER_CAPACITY];
+    size_t length = 0;  /* of the whole result, even past capacity. */
+    size_t limit  = capacity ? capacity - 1 : 0;
+
+    const char *at = format;
+    while (*at) {
+        /* literal run up to next `{`. */
+        const char *brace = strchr(at, '{');
+        const char *literal_end = brace ? brace : at + strlen(at);
+        const char *piece = at;
+        size_t piece_length = (size_t)(literal_end - at);
+        at = literal_end;
+
+        if (brace) {
+            const char *digit = brace + 1;
+            int index = 0;
+            while (*digit >= '0' && *digit <= '9' && index <= n_substs) {
+                index = index * 10 + (*digit - '0');
+                digit++;
+            }
+
+            if (digit > brace + 1 && *digit == '}' && index < n_substs) {
+                if (piece_length > 0 && length < limit) {
+                    size_t n = (piece_length < limit - length) ? piece_length : limit - length;
+                    memcpy(buffer + length, piece, n);
+                }
+                length += piece_length;
+
+                piece = yarn__value_text(substs[index], number, &piece_length);
+                at = digit + 1;
+            } else {
+                piece_length += 1; /* not a placeholder: `{` is text. */
+                at = brace + 1;
+            }
+        }
+
+        if (piece_length > 0 && length < limit) {
+            size_t n = (piece_length < limit - length) ? piece_length : limit - length;
+            memcpy(buffer + length, piece, n);
+        }
+        length += piece_length;
+    }
+
+    if (capacity > 0) buffer[length < limit ? length : limit] = '\0';
+    return length;
+}
+
+/* ===========================================
+ * Markup.
+ *
+ * parsed in place: plain text is never longer than the text, so it's written over it as we go.
+ * names and values are copied into table's allocator before that, since they'd be written over.
+ */
+
+typedef struct {
+    YARN_DYN_ARRAY(yarn_markup_attribute) attributes;
+    YARN_DYN_ARRAY(yarn_markup_property) properties;
+    YARN_DYN_ARRAY(int) open; /* attributes that aren't closed yet. */
+    YARN_DYN_ARRAY(yarn_template_segment) segments; /* of template being compiled. */
+} yarn__markup_builder;
+
+enum {
+    YARN__MARKER_OPEN = 0,
+    YARN__MARKER_SELF_CLOSING,
+    YARN__MARKER_CLOSE,
+    YARN__MARKER_CLOSE_ALL,
+};
+
+typedef struct {
+    int         kind;           /* YARN__MARKER_* */
+    const char *name;           /* into text. */
+    size_t      name_length;
+    uint32_t    first_property; /* into builder's properties. */
+    int32_t     value_slot;     /* n of `value={n}`, -1 if there's none. known even without properties. */
+} yarn__marker;
+
+int yarn__markup_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+int yarn__markup_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+size_t yarn__skip_markup_space(const char *text, size_t length, size_t at) {
+    while (at < length && yarn__markup_space(text[at])) at++;
+    return at;
+}
+
+int yarn__marker_is(yarn__marker *marker, int kind, const char *name) {
+    return marker->kind == kind && marker->name_length == strlen(name) && memcmp(marker->name, name, marker->name_length) == 0;
+}
+
+/* YARN_FORMAT_* of marker; YARN_FORMAT_NONE if it isn't a format function. */
+int yarn__marker_function(yarn__marker *marker) {
+    if (marker->kind == YARN__MARKER_CLOSE || marker->kind == YARN__MARKER_CLOSE_ALL) return YARN_FORMAT_NONE;
+    if (yarn__marker_is(marker, marker->kind, "select"))  return YARN_FORMAT_SELECT;
+    if (yarn__marker_is(marker, marker->kind, "plural"))  return YARN_FORMAT_PLURAL;
+    if (yarn__marker_is(marker, marker->kind, "ordinal")) return YARN_FORMAT_ORDINAL;
+    return YARN_FORMAT_NONE;
+}
+
+/* scans value of property at text[at], and adds the property. returns index right past the value, 0 if there's none.
+ * without allocator, only finds where the value ends; nothing is copied or added. */
+size_t yarn__scan_markup_value(yarn_allocator *allocator, yarn__markup_builder *builder, const char *text, size_t length, size_t at,
+                               const char *name, size_t name_length, yarn__marker *marker) {
+    at = yarn__skip_markup_space(text, length, at);
+    int quoted = at < length && text[at] == '"';
+    size_t from = quoted ? at + 1 : at;
+    size_t end  = from;
+
+    if (quoted) {
+        while (end < length && text[end] != '"') end += (text[end] == '\\' && end + 1 < length) ? 2 : 1;
+        if (end >= length) return 0;
+        at = end + 1;
+    } else {
+        while (end < length && !yarn__markup_space(text[end]) && text[end] != ']' &&
+               !(text[end] == '/' && end + 1 < length && text[end + 1] == ']')) end++;
+        if (end == from) return 0;
+        at = end;
+    }
+
+    /* exactly `{n}`: unquoted values have no escapes, so the text tells without copying it. */
+    int32_t slot = -1;
+    if (!quoted && end - from > 2 && text[from] == '{' && text[end - 1] == '}') {
+        int32_t n = 0;
+        size_t i = from + 1;
+        while (i < end - 1 && text[i] >= '0' && text[i] <= '9' && i - from < 10) n = n * 10 + (text[i++] - '0');
+        if (i == end - 1) slot = n;
+    }
+    if (slot >= 0 && name_length == 5 && memcmp(name, "value", 5) == 0) marker->value_slot = slot;
+    if (!allocator) return at;
+
+    yarn_markup_property property;
+    property.name   = yarn__strndup_alloc(allocator, name, name_length);
+    property.type   = YARN_MARKUP_STRING;
+    property.number = 0;
+    property.slot   = slot;
+
+    /* exact size: escapes only ever make it shorter. */
+    size_t value_length = end - from;
+    if (quoted) {
+        for (size_t i = from; i < end; ++i) {
+            if (text[i] == '\\' && i + 1 < end) { i++; value_length--; }
+        }
+    }
+    char *value = (char *)yarn_allocate(allocator, value_length + 1);
+    value_length = 0;
+    for (size_t i = from; i < end; ++i) {
+        if (quoted && text[i] == '\\' && i + 1 < end) i++;
+        value[value_length++] = text[i];
+    }
+    value[value_length] = '\0';
+    property.value = value;
+
+    if (!quoted) {
+        char *number_end = 0;
+        if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+            property.type   = YARN_MARKUP_BOOL;
+            property.number = (value[0] == 't') ? 1.0f : 0.0f;
+        } else if ((value[0] >= '0' && value[0] <= '9') || value[0] == '-' || value[0] == '.') {
+            float number = strtof(value, &number_end);
+            if (number_end == value + value_length) {
+                property.type   = strchr(value, '.') ? YARN_MARKUP_FLOAT : YARN_MARKUP_INTEGER;
+                property.number = number;
+            }
+        }
+    }
+
+    YARN_DYNARR_APPEND(&builder->properties, property);
+    return at;
+}
+
+/* scans marker at text[at] (a `[`). returns index right past its `]`, or 0 if it isn't a valid marker.
+ * properties are copied into allocator; without one, marker is only measured (kind, name, value_slot, end),
+ * so markers that end up as text or get skipped cost nothing. */
+size_t yarn__scan_marker(yarn_allocator *allocator, yarn__markup_builder *builder, const char *text, size_t length, size_t at,
+                         yarn__marker *marker) {
+    size_t rollback = builder->properties.used;
+    marker->first_property = (uint32_t)rollback;
+    marker->value_slot     = -1;
+    at = yarn__skip_markup_space(text, length, at + 1);
+
+    if (at < length && text[at] == '/') {
+        at = yarn__skip_markup_space(text, length, at + 1);
+        size_t from = at;
+        while (at < length && yarn__markup_name_char(text[at])) at++;
+
+        marker->kind        = (at > from) ? YARN__MARKER_CLOSE : YARN__MARKER_CLOSE_ALL;
+        marker->name        = text + from;
+        marker->name_length = at - from;
+        at = yarn__skip_markup_space(text, length, at);
+        return (at < length && text[at] == ']') ? at + 1 : 0;
+    }
+
+    size_t from = at;
+    while (at < length && yarn__markup_name_char(text[at])) at++;
+    if (at == from) return 0;
+
+    marker->kind        = YARN__MARKER_OPEN;
+    marker->name        = text + from;
+    marker->name_length = at - from;
+
+    /* [name=value] is short for [name name=value]. */
+    const char *property      = marker->name;
+    size_t property_length    = marker->name_length;
+    int    expect_value       = at < length && text[at] == '=';
+
+    for (;;) {
+        if (expect_value) {
+            at = yarn__scan_markup_value(allocator, builder, text, length, at + 1, property, property_length, marker);
+            if (!at) break;
+        }
+
+        at = yarn__skip_markup_space(text, length, at);
+        if (at >= length) break;
+        if (text[at] == ']') return at + 1;
+        if (text[at] == '/' && at + 1 < length && text[at + 1] == ']') {
+            marker->kind = YARN__MARKER_SELF_CLOSING;
+            return at + 2;
+        }
+
+        from = at;
+        while (at < length && yarn__markup_name_char(text[at])) at++;
+        property        = text + from;
+        property_length = at - from;
+        at = yarn__skip_markup_space(text, length, at);
+        if (property_length == 0 || at >= length || text[at] != '=') break;
+        expect_value = 1;
+    }
+
+    builder->properties.used = rollback;
+    return 0;
+}
+
+/* names of the implicit character attribute; not copied, so stats can tell them from the ones that are. */
+const char yarn__character_attribute[] = "character";
+const char yarn__character_property[]  = "name";
+
+/* `Name: text` gets a character attribute over `Name: `, unless there's one already. */
+void yarn__add_character_attribute(yarn_allocator *allocator, yarn__markup_builder *builder, const char *text, size_t length) {
+    for (size_t i = 0; i < builder->attributes.used; ++i) {
+        if (strcmp(builder->attributes.entries[i].name, yarn__character_attribute) == 0) return;
+    }
+
+    const char *colon = (const char *)memchr(text, ':', length);
+    if (!colon || colon == text) return;
+    for (const char *at = text; at < colon; ++at) {
+        if (*at == '{' || *at == '[') return;
+    }
+
+    size_t name_length = (size_t)(colon - text);
+    yarn_markup_property property;
+    property.name   = yarn__character_property;
+    property.value  = yarn__strndup_alloc(allocator, text, name_length);
+    property.type   = YARN_MARKUP_STRING;
+    property.number = 0;
+    property.slot   = -1;
+
+    uint32_t first_property = (uint32_t)builder->properties.used;
+    YARN_DYNARR_APPEND(&builder->properties, property);
+
+    yarn_markup_attribute attribute;
+    attribute.name           = yarn__character_attribute;
+    attribute.position       = 0;
+    attribute.length         = (uint32_t)(yarn__skip_markup_space(text, length, name_length + 1));
+    attribute.first_property = first_property;
+    attribute.n_properties   = 1;
+
+    /* goes first, attributes are ordered by where they open. */
+    YARN_DYNARR_APPEND(&builder->attributes, attribute);
+    memmove(builder->attributes.entries + 1, builder->attributes.entries, sizeof(yarn_markup_attribute) * (builder->attributes.used - 1));
+    builder->attributes.entries[0] = attribute;
+}
+
+/* takes markup out of text, in place. returns length of the plain text; *markup is 0 if text had none.
+ * sets *malformed if some marker isn't valid (kept as text), or was never opened / closed. */
+size_t yarn__parse_markup(yarn_allocator *allocator, yarn__markup_builder *builder, char *text, size_t length, yarn_line_markup **markup, int *malformed) {
+    builder->attributes.used = 0;
+    builder->properties.used = 0;
+    builder->open.used       = 0;
+    *markup    = 0;
+    *malformed = 0;
+
+    size_t in = 0, out = 0;
+    int nomarkup = -1; /* open nomarkup attribute. */
+
+    if (memchr(text, '[', length) || memchr(text, '\\', length)) {
+        while (in < length) {
+            char c = text[in];
+            if (c == '\\' && in + 1 < length && (text[in + 1] == '[' || text[in + 1] == ']')) {
+                text[out++] = text[in + 1];
+                in += 2;
+                continue;
+            }
+
+            yarn__marker marker;
+            size_t next = (c == '[') ? yarn__scan_marker(0, builder, text, length, in, &marker) : 0;
+            if (next && nomarkup != -1 && !yarn__marker_is(&marker, YARN__MARKER_CLOSE, "nomarkup")) {
+                next = 0;
+            } else if (c == '[' && !next && nomarkup == -1) {
+                *malformed = 1;
+            }
+
+            if (!next) {
+                text[out++] = c;
+                in++;
+                continue;
+            }
+
+            if (yarn__marker_function(&marker) != YARN_FORMAT_NONE) {
+                /* left for the template. */
+                memmove(text + out, text + in, next - in);
+                out += next - in;
+                in = next;
+                continue;
+            }
+
+            /* kept: now its properties are worth copying. */
+            if (marker.kind == YARN__MARKER_OPEN || marker.kind == YARN__MARKER_SELF_CLOSING) {
+                yarn__scan_marker(allocator, builder, text, length, in, &marker);
+            }
+            in = next;
+
+            switch (marker.kind) {
+                case YARN__MARKER_OPEN:
+                case YARN__MARKER_SELF_CLOSING:
+                {
+                    yarn_markup_attribute attribute;
+                    attribute.name           = yarn__strndup_alloc(allocator, marker.name, marker.name_length);
+                    attribute.position       = (uint32_t)out;
+                    attribute.length         = 0;
+                    attribute.first_property = marker.first_property;
+                    attribute.n_properties   = (uint32_t)(builder->properties.used - marker.first_property);
+
+                    int index = (int)builder->attributes.used;
+                    YARN_DYNARR_APPEND(&builder->attributes, attribute);
+
+                    if (marker.kind == YARN__MARKER_OPEN) {
+                        YARN_DYNARR_APPEND(&builder->open, index);
+                        if (yarn__marker_is(&marker, YARN__MARKER_OPEN, "nomarkup")) nomarkup = index;
+                        break;
+                    }
+
+                    int trim = 1;
+                    for (size_t i = marker.first_property; i < builder->properties.used; ++i) {
+                        yarn_markup_property *property = &builder->properties.entries[i];
+                        if (strcmp(property->name, "trimwhitespace") == 0 && property->type == YARN_MARKUP_BOOL) trim = property->number != 0;
+                    }
+                    if (trim && (out == 0 || yarn__markup_space(text[out - 1])) && in < length && yarn__markup_space(text[in])) in++;
+                } break;
+
+                case YARN__MARKER_CLOSE:
+                {
+                    /* closes the innermost attribute with that name. */
+                    int found = -1;
+                    for (size_t i = builder->open.used; i-- > 0;) {
+                        yarn_markup_attribute *attribute = &builder->attributes.entries[builder->open.entries[i]];
+                        if (strlen(attribute->name) == marker.name_length && memcmp(attribute->name, marker.name, marker.name_length) == 0) {
+                            found = (int)i;
+                            break;
+                        }
+                    }
+
+                    if (found == -1) {
+                        *malformed = 1;
+                        break;
+                    }
+
+                    int index = builder->open.entries[found];
+                    builder->attributes.entries[index].length = (uint32_t)out - builder->attributes.entries[index].position;
+                    memmove(builder->open.entries + found, builder->open.entries + found + 1, sizeof(int) * (builder->open.used - found - 1));
+                    builder->open.used--;
+                    if (index == nomarkup) nomarkup = -1;
+                } break;
+
+                case YARN__MARKER_CLOSE_ALL:
+                {
+                    for (size_t i = 0; i < builder->open.used; ++i) {
+                        yarn_markup_attribute *attribute = &builder->attributes.entries[builder->open.entries[i]];
+                        attribute->length = (uint32_t)out - attribute->position;
+                    }
+                    builder->open.used = 0;
+                } break;
+            }
+        }
+
+        /* never closed: runs to the end. */
+        for (size_t i = 0; i < builder->open.used; ++i) {
+            yarn_markup_attribute *attribute = &builder->attributes.entries[builder->open.entries[i]];
+            attribute->length = (uint32_t)out - attribute->position;
+            *malformed = 1;
+        }
+        length = out;
+    }
+
+    yarn__add_character_attribute(allocator, builder, text, length);
+    if (builder->attributes.used == 0) return length;
+
+    size_t attributes_size = sizeof(yarn_markup_attribute) * builder->attributes.used;
+    size_t properties_size = sizeof(yarn_markup_property) * builder->properties.used;
+    yarn_line_markup *result = (yarn_line_markup *)yarn_allocate(allocator, sizeof(yarn_line_markup) + attributes_size + properties_size);
+    result->n_attributes = (uint32_t)builder->attributes.used;
+    result->n_properties = (uint32_t)builder->properties.used;
+    result->attributes   = (yarn_markup_attribute *)(result + 1);
+    result->properties   = (yarn_markup_property *)((char *)result->attributes + attributes_size);
+    memcpy(result->attributes, builder->attributes.entries, attributes_size);
+    if (properties_size > 0) memcpy(result->properties, builder->properties.entries, properties_size);
+
+    *markup = result;
+    return length;
+}
+
+/* ===========================================
+ * Plural rules.
+ */
+
+#define YARN__RULE(category, operand, negate, and_next, mod, from, to) \
+    { YARN_PLURAL_##category, YARN_PLURAL_OPERAND_##operand, negate, and_next, mod, from, to }
+#define YARN__RULES_END { YARN_PLURAL_OTHER, 0, 0, 0, 0, 0, 0 }
+
+const yarn_plural_condition yarn__plurals_other[] = { YARN__RULES_END };
+
+/* one: i = 1 and v = 0 */
+const yarn_plural_condition yarn__plurals_one_i[] = {
+    YARN__RULE(ONE, I, 0, 1, 0, 1, 1), YARN__RULE(ONE, V, 0, 0, 0, 0, 0),
+    YARN__RULES_END
+};
+
+/* one: n = 1 */
+const yarn_plural_condition yarn__plurals_one_n[] = {
+    YARN__RULE(ONE, N, 0, 0, 0, 1, 1),
+    YARN__RULES_END
+};
+
+/* one: i = 0,1 */
+const yarn_plural_condition yarn__plurals_fr[] = {
+    YARN__RULE(ONE, I, 0, 0, 0, 0, 1),
+    YARN__RULES_END
+};
+
+/* one: v = 0 and i % 10 = 1 and i % 100 != 11
+ * few: v = 0 and i % 10 = 2..4 and i % 100 != 12..14
+ * many: v = 0 and i % 10 = 0 or v = 0 and i % 10 = 5..9 or v = 0 and i % 100 = 11..14 */
+const yarn_plural_condition yarn__plurals_ru[] = {
+    YARN__RULE(ONE,  V, 0, 1, 0, 0, 0), YARN__RULE(ONE, I, 0, 1, 10, 1, 1), YARN__RULE(ONE, I, 1, 0, 100, 11, 11),
+    YARN__RULE(FEW,  V, 0, 1, 0, 0, 0), YARN__RULE(FEW, I, 0, 1, 10, 2, 4), YARN__RULE(FEW, I, 1, 0, 100, 12, 14),
+    YARN__RULE(MANY, V, 0, 1, 0, 0, 0), YARN__RULE(MANY, I, 0, 0, 10, 0, 0),
+    YARN__RULE(MANY, V, 0, 1, 0, 0, 0), YARN__RULE(MANY, I, 0, 0, 10, 5, 9),
+    YARN__RULE(MANY, V, 0, 1, 0, 0, 0), YARN__RULE(MANY, I, 0, 0, 100, 11, 14),
+    YARN__RULES_END
+};
+
+/* one: i = 1 and v = 0
+ * few: v = 0 and i % 10 = 2..4 and i % 100 != 12..14
+ * many: v = 0 and i != 1 and i % 10 = 0..1 or v = 0 and i % 10 = 5..9 or v = 0 and i % 100 = 12..14 */
+const yarn_plural_condition yarn__plurals_pl[] = {
+    YARN__RULE(ONE,  I, 0, 1, 0, 1, 1), YARN__RULE(ONE, V, 0, 0, 0, 0, 0),
+    YARN__RULE(FEW,  V, 0, 1, 0, 0, 0), YARN__RULE(FEW, I, 0, 1, 10, 2, 4), YARN__RULE(FEW, I, 1, 0, 100, 12, 14),
+    YARN__RULE(MANY, V, 0, 1, 0, 0, 0), YARN__RULE(MANY, I, 1, 1, 0, 1, 1), YARN__RULE(MANY, I, 0, 0, 10, 0, 1),
+    YARN__RULE(MANY, V, 0, 1, 0, 0, 0), YARN__RULE(MANY, I, 0, 0, 10, 5, 9),
+    YARN__RULE(MANY, V, 0, 1, 0, 0, 0), YARN__RULE(MANY, I, 0, 0, 100, 12, 14),
+    YARN__RULES_END
+};
+
+/* one: i = 1 and v = 0, few: i = 2..4 and v = 0, many: v != 0 */
+const yarn_plural_condition yarn__plurals_cs[] = {
+    YARN__RULE(ONE,  I, 0, 1, 0, 1, 1), YARN__RULE(ONE, V, 0, 0, 0, 0, 0),
+    YARN__RULE(FEW,  I, 0, 1, 0, 2, 4), YARN__RULE(FEW, V, 0, 0, 0, 0, 0),
+    YARN__RULE(MANY, V, 1, 0, 0, 0, 0),
+    YARN__RULES_END
+};
+
+/* zero: n = 0, one: n = 1, two: n = 2, few: n % 100 = 3..10, many: n % 100 = 11..99 */
+const yarn_plural_condition yarn__plurals_ar[] = {
+    YARN__RULE(ZERO, N, 0, 0, 0, 0, 0),
+    YARN__RULE(ONE,  N, 0, 0, 0, 1, 1),
+    YARN__RULE(TWO,  N, 0, 0, 0, 2, 2),
+    YARN__RULE(FEW,  N, 0, 0, 100, 3, 10),
+    YARN__RULE(MANY, N, 0, 0, 100, 11, 99),
+    YARN__RULES_END
+};
+
+/* one: n % 10 = 1 and n % 100 != 11, two: n % 10 = 2 and n % 100 != 12, few: n % 10 = 3 and n % 100 != 13 */
+const yarn_plural_condition yarn__ordinals_en[] = {
+    YARN__RULE(ONE, N, 0, 1, 10, 1, 1), YARN__RULE(ONE, N, 1, 0, 100, 11, 11),
+    YARN__RULE(TWO, N, 0, 1, 10, 2, 2), YARN__RULE(TWO, N, 1, 0, 100, 12, 12),
+    YARN__RULE(FEW, N, 0, 1, 10, 3, 3), YARN__RULE(FEW, N, 1, 0, 100, 13, 13),
+    YARN__RULES_END
+};
+
+/* one: n % 10 = 1,2 and n % 100 != 11,12 */
+const yarn_plural_condition yarn__ordinals_sv[] = {
+    YARN__RULE(ONE, N, 0, 1, 10, 1, 2), YARN__RULE(ONE, N, 1, 0, 100, 11, 12),
+    YARN__RULES_END
+};
+
+/* many: n = 11,8,80,800 */
+const yarn_plural_condition yarn__ordinals_it[] = {
+    YARN__RULE(MANY, N, 0, 0, 0, 11, 11), YARN__RULE(MANY, N, 0, 0, 0, 8, 8),
+    YARN__RULE(MANY, N, 0, 0, 0, 80, 80), YARN__RULE(MANY, N, 0, 0, 0, 800, 800),
+    YARN__RULES_END
+};
+
+const yarn_plural_rules yarn__plural_rules[] = {
+    { "en", yarn__plurals_one_i, yarn__ordinals_en },
+    { "de", yarn__plurals_one_i, yarn__plurals_other },
+    { "nl", yarn__plurals_one_i, yarn__plurals_other },
+    { "sv", yarn__plurals_one_i, yarn__ordinals_sv },
+    { "it", yarn__plurals_one_i, yarn__ordinals_it },
+    { "fi", yarn__plurals_one_i, yarn__plurals_other },
+    { "et", yarn__plurals_one_i, yarn__plurals_other },
+    { "ca", yarn__plurals_one_i, yarn__plurals_other },
+    { "fr", yarn__plurals_fr,    yarn__plurals_one_n },
+    { "pt", yarn__plurals_fr,    yarn__plurals_other },
+    { "es", yarn__plurals_one_n, yarn__plurals_other },
+    { "el", yarn__plurals_one_n, yarn__plurals_other },
+    { "hu", yarn__plurals_one_n, yarn__plurals_other },
+    { "tr", yarn__plurals_one_n, yarn__plurals_other },
+    { "bg", yarn__plurals_one_n, yarn__plurals_other },
+    { "nb", yarn__plurals_one_n, yarn__plurals_other },
+    { "ru", yarn__plurals_ru,    yarn__plurals_other },
+    { "uk", yarn__plurals_ru,    yarn__plurals_other },
+    { "pl", yarn__plurals_pl,    yarn__plurals_other },
+    { "cs", yarn__plurals_cs,    yarn__plurals_other },
+    { "sk", yarn__plurals_cs,    yarn__plurals_other },
+    { "ar", yarn__plurals_ar,    yarn__plurals_other },
+    { "ja", yarn__plurals_other, yarn__plurals_other },
+    { "zh", yarn__plurals_other, yarn__plurals_other },
+    { "ko", yarn__plurals_other, yarn__plurals_other },
+};
+
+const yarn_plural_rules yarn__plural_rules_root = { "", yarn__plurals_other, yarn__plurals_other };
+
+#undef YARN__RULE
+#undef YARN__RULES_END
+
+const yarn_plural_rules *yarn_find_plural_rules(const char *locale) {
+    if (!locale) return &yarn__plural_rules[0];
+
+    size_t length = 0;
+    while (locale[length] && locale[length] != '-' && locale[length] != '_') length++;
+
+    for (int i = 0; i < YARN_LEN(yarn__plural_rules); ++i) {
+        const char *language = yarn__plural_rules[i].language;
+        size_t k = 0;
+        while (k < length && language[k] && (locale[k] | 0x20) == language[k]) k++;
+        if (k == length && language[k] == '\0') return &yarn__plural_rules[i];
+    }
+    return &yarn__plural_rules_root;
+}
+
+const yarn_plural_rules *yarn__table_plurals(yarn_string_table *table) {
+    if (!table->plurals) table->plurals = yarn_find_plural_rules(table->locale);
+    return table->plurals;
+}
+
+const char *yarn_plural_category_name(int category) {
+    switch (category) {
+        case YARN_PLURAL_ZERO: return "zero";
+        case YARN_PLURAL_ONE:  return "one";
+        case YARN_PLURAL_TWO:  return "two";
+        case YARN_PLURAL_FEW:  return "few";
+        case YARN_PLURAL_MANY: return "many";
+        default:               return "other";
+    }
+}
+
+int yarn_plural_category(const yarn_plural_rules *rules, const char *number, int ordinal) {
+    /* operands, straight off the digits; so "1.50" keeps its v = 2. */
+    uint64_t operands[5] = {0}; /* YARN_PLURAL_OPERAND_* */
+    const uint64_t saturate = 1000000000000000000ull;
+    int digits = 0;
+
+    const char *at = number;
+    if (*at == '-' || *at == '+') at++;
+    for (; *at >= '0' && *at <= '9'; ++at, ++digits) {
+        uint64_t *i = &operands[YARN_PLURAL_OPERAND_I];
+        *i = (*i < saturate) ? *i * 10 + (uint64_t)(*at - '0') : saturate;
+    }
+    if (*at == '.') {
+        for (++at; *at >= '0' && *at <= '9'; ++at, ++digits) {
+            uint64_t *f = &operands[YARN_PLURAL_OPERAND_F];
+            *f = (*f < saturate) ? *f * 10 + (uint64_t)(*at - '0') : saturate;
+            operands[YARN_PLURAL_OPERAND_V]++;
+        }
+    }
+    if (digits == 0 || *at != '\0') return YARN_PLURAL_OTHER;
+
+    operands[YARN_PLURAL_OPERAND_T] = operands[YARN_PLURAL_OPERAND_F];
+    while (operands[YARN_PLURAL_OPERAND_T] != 0 && operands[YARN_PLURAL_OPERAND_T] % 10 == 0) operands[YARN_PLURAL_OPERAND_T] /= 10;
+
+    /* n is an integer only if there's no fraction (trailing zeros don't count). */
+    int n_integer = operands[YARN_PLURAL_OPERAND_T] == 0;
+    operands[YARN_PLURAL_OPERAND_N] = operands[YARN_PLURAL_OPERAND_I];
+
+    const yarn_plural_condition *condition = ordinal ? rules->ordinal : rules->cardinal;
+    int holds = 1;
+    for (; condition->category != YARN_PLURAL_OTHER; ++condition) {
+        uint64_t value = operands[condition->operand];
+        int in = (condition->operand != YARN_PLURAL_OPERAND_N) || n_integer;
+        if (condition->mod) value %= condition->mod;
+        in = in && value >= condition->from && value <= condition->to;
+
+        holds = holds && (condition->negate ? !in : in);
+        if (condition->and_next) continue;
+        if (holds) return condition->category;
+        holds = 1;
+    }
+    return YARN_PLURAL_OTHER;
+}
+
+/* ===========================================
+ * Line templates.
+ */
+
+size_t yarn__format_text(const char *text, yarn_line_template *format, yarn_line *line, const yarn_plural_rules *plurals, char *buffer, size_t capacity) {
+    if (format) return yarn__format_template(text, format, line->substitutions, line->n_substitutions, plurals, buffer, capacity);
+    if (line->n_substitutions > 0) return yarn__substitute_into(text, line->substitutions, line->n_substitutions, buffer, capacity);
+
+    /* nothing to substitute: length is known, one copy. */
+    size_t length = strlen(text);
+    if (capacity > 0) {
+        size_t n = (length < capacity) ? length : capacity - 1;
+        memcpy(buffer, text, n);
+        buffer[n] = '\0';
+    }
+    return length;
+}
+
+/* case of format function for its value; `other` if none matches, 0 if there's no `other` either. */
+yarn_markup_property *yarn__pick_case(yarn_line_template *format, yarn_template_segment *segment, const char *value, const yarn_plural_rules *plurals) {
+    const char *key = value;
+    if (segment->function != YARN_FORMAT_SELECT) {
+        key = yarn_plural_category_name(yarn_plural_category(plurals, value, segment->function == YARN_FORMAT_ORDINAL));
+    }
+
+    yarn_markup_property *other = 0;
+    for (uint32_t i = 0; i < segment->n_cases; ++i) {
+        yarn_markup_property *option = &format->cases[segment->first_case + i];
+        if (strcmp(option->name, key) == 0) return option;
+        if (strcmp(option->name, "other") == 0) other = option;
+    }
+    return other;
+}
+
+/* copies what's left of piece after `written` bytes of output, if there's room. */
+void yarn__copy_clipped(char *buffer, size_t room, size_t written, const char *piece, size_t length) {
+    if (written >= room) return;
+    memcpy(buffer + written, piece, (length < room - written) ? length : room - written);
+}
+
+/* writes what segment becomes into buffer, at most room bytes. returns its whole length. */
+size_t yarn__write_segment(const char *text, yarn_line_template *format, yarn_template_segment *segment, yarn_value *substs, int n_substs,
+                           const yarn_plural_rules *plurals, char *buffer, size_t room) {
+    if (segment->slot < 0 || segment->slot >= n_substs) {
+        if (room > 0) yarn__copy_clipped(buffer, room, 0, text + segment->offset, segment->length);
+        return segment->length;
+    }
+
+    char number[YARN__NUMBER_CAPACITY];
+    size_t value_length = 0;
+    const char *value = yarn__value_text(substs[segment->slot], number, &value_length);
+    if (segment->function == YARN_FORMAT_NONE) {
+        yarn__copy_clipped(buffer, room, 0, value, value_length);
+        return value_length;
+    }
+
+    /* text of picked case, every `%` in it being the value. */
+    yarn_markup_property *picked = yarn__pick_case(format, segment, value, plurals);
+    size_t length = 0;
+    for (const char *at = picked ? picked->value : ""; *at;) {
+        const char *percent = strchr(at, '%');
+        size_t run = percent ? (size_t)(percent - at) : strlen(at);
+        yarn__copy_clipped(buffer, room, length, at, run);
+        length += run;
+        at += run;
+
+        if (percent) {
+            yarn__copy_clipped(buffer, room, length, value, value_length);
+            length += value_length;
+            at++;
+        }
+    }
+    return length;
+}
+
+uint32_t yarn__format_position(yarn_line_template *format, yarn_line *line, const yarn_plural_rules *plurals, uint32_t position) {
+    if (!format) return position;
+
+    /* every placeholder / function before position moves it by how much longer / shorter it gets. */
+    uint32_t result = position;
+    for (uint32_t i = 0; i < format->n_segments; ++i) {
+        yarn_template_segment *segment = &format->segments[i];
+        if (segment->offset + segment->length > position) break;
+        if (segment->slot < 0) continue;
+
+        size_t length = yarn__write_segment(0, format, segment, line->substitutions, line->n_substitutions, plurals, 0, 0);
+        result = result - segment->length + (uint32_t)length;
+    }
+    return result;
+}
+
+/* scans `{n}` at text[at]. returns index right past it, or 0 if it isn't one. */
+size_t yarn__scan_placeholder(const char *text, size_t length, size_t at, int32_t *slot) {
+    size_t digit = at + 1;
+    *slot = 0;
+    while (digit < length && text[digit] >= '0' && text[digit] <= '9' && digit - at <= 9) {
+        *slot = *slot * 10 + (text[digit] - '0');
+        digit++;
+    }
+    return (digit > at + 1 && digit < length && text[digit] == '}') ? digit + 1 : 0;
+}
+
+/* scans `[select value={n} ... /]` (or plural / ordinal) at text[at]. its cases are left in builder's properties.
+ * returns index right past it, or 0 if it isn't one; sets *malformed if it's a format function without `value={n}`. */
+size_t yarn__scan_format_function(yarn_allocator *allocator, yarn__markup_builder *builder, const char *text, size_t length, size_t at,
+                                  yarn_template_segment *segment, int *malformed) {
+    yarn__marker marker;
+    size_t next = yarn__scan_marker(0, builder, text, length, at, &marker);
+    if (!next) return 0;
+
+    segment->function = yarn__marker_function(&marker);
+    if (segment->function == YARN_FORMAT_NONE) return 0;
+    if (marker.value_slot < 0) {
+        *malformed = 1;
+        return 0;
+    }
+    yarn__scan_marker(allocator, builder, text, length, at, &marker);
+
+    /* value goes first, the rest are cases. */
+    yarn_markup_property *properties = builder->properties.entries;
+    for (size_t i = marker.first_property; i < builder->properties.used; ++i) {
+        if (strcmp(properties[i].name, "value") != 0 || properties[i].slot < 0) continue;
+
+        yarn_markup_property value = properties[i];
+        properties[i] = properties[marker.first_property];
+        properties[marker.first_property] = value;
+
+        segment->slot       = value.slot;
+        segment->first_case = marker.first_property + 1;
+        segment->n_cases    = (uint32_t)(builder->properties.used - segment->first_case);
+        return next;
+    }
+
+    /* can't happen: value_slot came from one of these. */
+    *malformed = 1;
+    builder->properties.used = marker.first_property;
+    return 0;
+}
+
+void yarn__push_segment(yarn__markup_builder *builder, size_t offset, size_t length, int32_t slot, uint32_t *literal_length) {
+    yarn_template_segment segment = {0};
+    segment.offset = (uint32_t)offset;
+    segment.length = (uint32_t)length;
+    segment.slot   = slot;
+    if (slot < 0) *literal_length += (uint32_t)length;
+    YARN_DYNARR_APPEND(&builder->segments, segment);
+}
+
+/* true if position of plain text is inside a [nomarkup] attribute. */
+int yarn__in_nomarkup(const yarn_line_markup *markup, size_t position) {
+    if (!markup) return 0;
+    for (uint32_t i = 0; i < markup->n_attributes; ++i) {
+        const yarn_markup_attribute *attribute = &markup->attributes[i];
+        if (position >= attribute->position && position < attribute->position + attribute->length &&
+            strcmp(attribute->name, "nomarkup") == 0) return 1;
+    }
+    return 0;
+}
+
+/* splits text into template (see yarn_line_template). returns 0 if there's no placeholder / format function.
+ * sets *malformed if some `{` isn't a valid placeholder, or some function has no value; those are kept as text.
+ * functions inside [nomarkup] are text, like any other marker there: with markup_parsed, text is plain text
+ * and markup tells where nomarkup is; otherwise its markers are still in text. */
+yarn_line_template *yarn__compile_template(yarn_allocator *allocator, yarn__markup_builder *builder, const char *text, size_t length,
+                                           int markup_parsed, const yarn_line_markup *markup, int *malformed) {
+    *malformed = 0;
+    if (!memchr(text, '{', length) && !memchr(text, '[', length)) return 0;
+
+    builder->segments.used   = 0;
+    builder->properties.used = 0;
+
+    uint32_t literal_length = 0;
+    size_t   literal_from   = 0;
+    int      nomarkup       = 0;
+    for (size_t at = 0; at < length;) {
+        if (text[at] != '{' && text[at] != '[') {
+            at++;
+            continue;
+        }
+
+        if (text[at] == '[' && markup_parsed && yarn__in_nomarkup(markup, at)) {
+            at++;
+            continue;
+        }
+        if (text[at] == '[' && !markup_parsed) {
+            yarn__marker marker;
+            size_t end = yarn__scan_marker(0, builder, text, length, at, &marker);
+            if (end && (yarn__marker_is(&marker, YARN__MARKER_OPEN, "nomarkup") || yarn__marker_is(&marker, YARN__MARKER_CLOSE, "nomarkup"))) {
+                nomarkup = marker.kind == YARN__MARKER_OPEN;
+                at = end;
+                continue;
+            }
+            if (nomarkup) {
+                at++;
+                continue;
+            }
+        }
+
+        yarn_template_segment segment = {0};
+        size_t next = (text[at] == '{') ? yarn__scan_placeholder(text, length, at, &segment.slot)
+                                        : yarn__scan_format_function(allocator, builder, text, length, at, &segment, malformed);
+        if (!next) {
+            /* not a placeholder: `{` stays part of the literal. */
+            if (text[at] == '{') *malformed = 1;
+            at++;
+            continue;
+        }
+
+        if (at > literal_from) yarn__push_segment(builder, literal_from, at - literal_from, -1, &literal_length);
+        segment.offset = (uint32_t)at;
+        segment.length = (uint32_t)(next - at);
+        YARN_DYNARR_APPEND(&builder->segments, segment);
+        literal_from = at = next;
+    }
+
+    if (builder->segments.used == 0) return 0;
+    if (length > literal_from) yarn__push_segment(builder, literal_from, length - literal_from, -1, &literal_length);
+
+    size_t segments_size = sizeof(yarn_template_segment) * builder->segments.used;
+    size_t cases_size    = sizeof(yarn_markup_property) * builder->properties.used;
+    yarn_line_template *result = (yarn_line_template *)yarn_allocate(allocator, sizeof(yarn_line_template) + segments_size + cases_size);
+    result->literal_length = literal_length;
+    result->n_segments     = (uint32_t)builder->segments.used;
+    result->n_cases        = (uint32_t)builder->properties.used;
+    result->segments       = (yarn_template_segment *)(result + 1);
+    result->cases          = (yarn_markup_property *)((char *)result->segments + segments_size);
+    memcpy(result->segments, builder->segments.entries, segments_size);
+    if (cases_size > 0) memcpy(result->cases, builder->properties.entries, cases_size);
+    return result;
+}
+
+size_t yarn__stats_add_properties(yarn_memory_stats *stats, const yarn_markup_property *properties, uint32_t n_properties) {
+    size_t bytes = 0;
+    size_t count = 0;
+    for (uint32_t i = 0; i < n_properties; ++i) {
+        if (properties[i].name != yarn__character_property) {
+            bytes += YARN__ARENA_SIZE(strlen(properties[i].name) + 1);
+            count++;
+        }
+        bytes += YARN__ARENA_SIZE(strlen(properties[i].value) + 1);
+        count++;
+    }
+    yarn__stats_add(stats, YARN_MEMORY_TEMPLATES, bytes, count);
+    return bytes;
+}
+
+size_t yarn__stats_add_line_format(yarn_memory_stats *stats, yarn_parsed_entry *entry) {
+    size_t bytes = 0;
+    if (entry->markup) {
+        yarn_line_markup *markup = entry->markup;
+        size_t size = YARN__ARENA_SIZE(sizeof(yarn_line_markup) + sizeof(yarn_markup_attribute) * markup->n_attributes +
+                                       sizeof(yarn_markup_property) * markup->n_properties);
+        yarn__stats_add(stats, YARN_MEMORY_TEMPLATES, size, 1);
+        bytes += size;
+
+        for (uint32_t i = 0; i < markup->n_attributes; ++i) {
+            if (markup->attributes[i].name == yarn__character_attribute) continue;
+            size = YARN__ARENA_SIZE(strlen(markup->attributes[i].name) + 1);
+            yarn__stats_add(stats, YARN_MEMORY_TEMPLATES, size, 1);
+            bytes += size;
+        }
+        bytes += yarn__stats_add_properties(stats, markup->properties, markup->n_properties);
+    }
+    if (entry->format) {
+        yarn_line_template *format = entry->format;
+        size_t size = YARN__ARENA_SIZE(sizeof(yarn_line_template) + sizeof(yarn_template_segment) * format->n_segments +
+                                       sizeof(yarn_markup_property) * format->n_cases);
+        yarn__stats_add(stats, YARN_MEMORY_TEMPLATES, size, 1);
+        bytes += size + yarn__stats_add_properties(stats, format->cases, format->n_cases);
+    }
+    return bytes;
+}
+
+size_t yarn__format_template(const char *text, yarn_line_template *format, yarn_value *substs, int n_substs,
+                             const yarn_plural_rules *plurals, char *buffer, size_t capacity) {
+    /* exact size first: literals are known, only substitutions / functions need measuring. */
+    size_t length = format->literal_length;
+    for (uint32_t i = 0; i < format->n_segments; ++i) {
+        yarn_template_segment *segment = &format->segments[i];
+        if (segment->slot >= 0) length += yarn__write_segment(text, format, segment, substs, n_substs, plurals, 0, 0);
+    }
+    if (capacity == 0) return length;
+
+    /* then one pass; clips only when it doesn't fit. */
+    size_t limit   = capacity - 1;
+    size_t written = 0;
+    for (uint32_t i = 0; i < format->n_segments && written < limit; ++i) {
+        written += yarn__write_segment(text, format, &format->segments[i], substs, n_substs, plurals, buffer + written, limit - written);
+    }
+    buffer[written < limit ? written : limit] = '\0';
+    return length;
+}
+
+int yarn__markup_spans(yarn_parsed_entry *entry, yarn_line *line, const yarn_plural_rules *plurals, yarn_markup_span *spans, int max_spans) {
+    if (!entry->markup) return 0;
+
+    int n_spans = 0;
+    for (uint32_t i = 0; i < entry->markup->n_attributes && n_spans < max_spans; ++i) {
+        yarn_markup_attribute *attribute = &entry->markup->attributes[i];
+        uint32_t begin = yarn__format_position(entry->format, line, plurals, attribute->position);
+        uint32_t end   = yarn__format_position(entry->format, line, plurals, attribute->position + attribute->length);
+
+        yarn_markup_span *span = &spans[n_spans++];
+        span->attribute = attribute;
+        span->position  = begin;
+        span->length    = end - begin;
+    }
+    return n_spans;
+}
+
+/* ===========================================
+ * Formatted line cache.
+ */
+
+uint32_t yarn__fnv1a(uint32_t hash, const void *bytes, size_t length) {
+    const uint8_t *at = (const uint8_t *)bytes;
+    for (size_t i = 0; i < length; ++i) hash = (hash ^ at[i]) * 16777619u;
+    return hash;
+}
+
+uint32_t yarn__format_cache_hash(const char *line_id, const yarn_plural_rules *plurals, yarn_value *values, int n_values) {
+    /* entry keys and rules are unique per table; their addresses are enough. */
+    uint32_t hash = 2166136261u;
+    hash = yarn__fnv1a(hash, &line_id, sizeof(line_id));
+    hash = yarn__fnv1a(hash, &plurals, sizeof(plurals));
+
+    for (int i = 0; i < n_values; ++i) {
+        yarn_value *value = &values[i];
+        hash = yarn__fnv1a(hash, &value->type, sizeof(value->type));
+        switch(value->type) {
+            case YARN_VALUE_STRING:
+                if (value->values.v_string) hash = yarn__fnv1a(hash, value->values.v_string, strlen(value->values.v_string));
+                break;
+            case YARN_VALUE_BOOL:
+            {
+                int b = !!value->values.v_bool;
+                hash = yarn__fnv1a(hash, &b, sizeof(b));
+            } break;
+            case YARN_VALUE_FLOAT: hash = yarn__fnv1a(hash, &value->values.v_float, sizeof(float)); break;
+            default: break;
+        }
+    }
+    return hash;
+}
+
+int yarn__same_values(yarn_value *a, yarn_value *b, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (a[i].type != b[i].type) return 0;
+        switch(a[i].type) {
+            case YARN_VALUE_STRING:
+            {
+                const char *x = a[i].values.v_string ? a[i].values.v_string : "";
+                const char *y = b[i].values.v_string ? b[i].values.v_string : "";
+                if (strcmp(x, y) != 0) return 0;
+            } break;
+            case YARN_VALUE_BOOL:
+                if (!a[i].values.v_bool != !b[i].values.v_bool) return 0;
+                break;
+            case YARN_VALUE_FLOAT:
+                if (memcmp(&a[i].values.v_float, &b[i].values.v_float, sizeof(float)) != 0) return 0;
+                break;
+            default: break;
+        }
+    }
+    return 1;
+}
+
+/* formats line into one allocation: entry, values, spans, strings of values, text. */
+yarn_cached_line *yarn__format_cached_line(yarn_string_table *table, yarn_kvpair_header *header, yarn_line *line,
+                                           const yarn_plural_rules *plurals, uint32_t hash) {
+    const char *text = yarn__line_text(table, header);
+    if (!text) return 0;
+
+    yarn_parsed_entry *entry = (yarn_parsed_entry *)YARN__KV_VALUEOF(&table->table, header);
+    size_t length  = yarn__format_text(text, entry->format, line, plurals, 0, 0);
+    int    n_spans = entry->markup ? (int)entry->markup->n_attributes : 0;
+    size_t strings = 0;
+    for (int i = 0; i < line->n_substitutions; ++i) {
+        yarn_value *value = &line->substitutions[i];
+        if (value->type == YARN_VALUE_STRING && value->values.v_string) strings += strlen(value->values.v_string) + 1;
+    }
+
+    size_t size = sizeof(yarn_cached_line) + sizeof(yarn_value) * line->n_substitutions +
+                  sizeof(yarn_markup_span) * n_spans + strings + length + 1;
+    yarn_cached_line *cached = (yarn_cached_line *)YARN_MALLOC(size);
+    memset(cached, 0, sizeof(yarn_cached_line));
+
+    yarn_value       *values = (yarn_value *)(cached + 1);
+    yarn_markup_span *spans  = (yarn_markup_span *)(values + line->n_substitutions);
+    char             *at     = (char *)(spans + n_spans);
+
+    for (int i = 0; i < line->n_substitutions; ++i) {
+        values[i] = line->substitutions[i];
+        if (values[i].type != YARN_VALUE_STRING || !values[i].values.v_string) continue;
+
+        size_t n = strlen(values[i].values.v_string) + 1;
+        memcpy(at, values[i].values.v_string, n);
+        values[i].values.v_string = at;
+        at += n;
+    }
+
+    yarn__format_text(text, entry->format, line, plurals, at, length + 1);
+    cached->view.text    = at;
+    cached->view.length  = (int)length;
+    cached->view.spans   = n_spans ? spans : 0;
+    cached->view.n_spans = yarn__markup_spans(entry, line, plurals, spans, n_spans);
+
+    cached->line_id  = header->key;
+    cached->plurals  = plurals;
+    cached->hash     = hash;
+    cached->n_values = line->n_substitutions;
+    cached->values   = values;
+    cached->size     = size;
+    return cached;
+}
+
+void yarn__uncache_line(yarn_string_table *table, yarn_cached_line *cached) {
+    yarn_cached_line **link = &table->format_buckets[cached->hash & (table->n_format_buckets - 1)];
+    while (*link != cached) link = &(*link)->next_in_bucket;
+    *link = cached->next_in_bucket;
+
+    if (cached->prev) cached->prev->next = cached->next; else table->format_head = cached->next;
+    if (cached->next) cached->next->prev = cached->prev; else table->format_tail = cached->prev;
+    table->format_used--;
+
+    cached->cached = 0;
+    if (cached->refs == 0) YARN_FREE(cached);
+}
+
+void yarn__flush_format_cache(yarn_string_table *table) {
+    while (table->format_tail) yarn__uncache_line(table, table->format_tail);
+}
+
+void yarn__resize_format_cache(yarn_string_table *table) {
+    int limit = table->format_cache_lines > 0 ? table->format_cache_lines : 0;
+    while (table->format_used > limit) yarn__uncache_line(table, table->format_tail);
+    table->format_cache_sized = table->format_cache_lines;
+
+    uint32_t n = 0;
+    if (limit > 0) {
+        n = 16;
+        while (n < (uint32_t)limit) n *= 2;
+    }
+    if (n == table->n_format_buckets) return;
+
+    yarn_cached_line **buckets = 0;
+    if (n > 0) {
+        buckets = (yarn_cached_line **)YARN_MALLOC(sizeof(yarn_cached_line *) * n);
+        memset(buckets, 0, sizeof(yarn_cached_line *) * n);
+    }
+    for (yarn_cached_line *cached = table->format_head; cached; cached = cached->next) {
+        yarn_cached_line **bucket = &buckets[cached->hash & (n - 1)];
+        cached->next_in_bucket = *bucket;
+        *bucket = cached;
+    }
+
+    if (table->format_buckets) YARN_FREE(table->format_buckets);
+    table->format_buckets   = buckets;
+    table->n_format_buckets = n;
+}
+
+const yarn_formatted_line *yarn_acquire_formatted_line(yarn_string_table *table, yarn_line *line) {
+    int bound = 0;
+    yarn_kvpair_header *header = yarn__displayable_line(table, line, &bound);
+    if (!header) return 0;
+
+    const yarn_plural_rules *plurals = yarn__table_plurals(table);
+    uint32_t hash = yarn__format_cache_hash(header->key, plurals, line->substitutions, line->n_substitutions);
+
+    if (table->format_cache_lines != table->format_cache_sized) yarn__resize_format_cache(table);
+    if (table->format_buckets) {
+        yarn_cached_line *cached = table->format_buckets[hash & (table->n_format_buckets - 1)];
+        for (; cached; cached = cached->next_in_bucket) {
+            if (cached->hash != hash || cached->line_id != header->key || cached->plurals != plurals) continue;
+            if (cached->n_values != line->n_substitutions) continue;
+            if (!yarn__same_values(cached->values, line->substitutions, cached->n_values)) continue;
+
+            /* hit: to the front. */
+            if (cached->prev) {
+                cached->prev->next = cached->next;
+                if (cached->next) cached->next->prev = cached->prev; else table->format_tail = cached->prev;
+                cached->prev = 0;
+                cached->next = table->format_head;
+                table->format_head->prev = cached;
+                table->format_head = cached;
+            }
+            cached->refs++;
+            table->format_acquired++;
+            return &cached->view;
+        }
+    }
+
+    yarn_cached_line *cached = yarn__format_cached_line(table, header, line, plurals, hash);
+    if (!cached) return 0;
+    cached->refs = 1;
+    table->format_acquired++;
+    if (!table->format_buckets) return &cached->view; /* no cache. */
+
+    yarn_cached_line **bucket = &table->format_buckets[hash & (table->n_format_buckets - 1)];
+    cached->next_in_bucket = *bucket;
+    *bucket = cached;
+
+    cached->next = table->format_head;
+    if (table->format_head) table->format_head->prev = cached; else table->format_tail = cached;
+    table->format_head = cached;
+    cached->cached = 1;
+    table->format_used++;
+
+    while (table->format_used > table->format_cache_lines) yarn__uncache_line(table, table->format_tail);
+    return &cached->view;
+}
+
+void yarn_release_formatted_line(yarn_string_table *table, const yarn_formatted_line *formatted) {
+    if (!formatted) return;
+
+    yarn_cached_line *cached = (yarn_cached_line *)formatted;
+    assert(cached->refs > 0 && table->format_acquired > 0);
+    table->format_acquired--;
+    if (--cached->refs == 0 && !cached->cached) YARN_FREE(cached);
+}
+
+/* ===========================================
+ * Compressed line texts.
+ *
+ * texts are staged back to back (with their '\0') until the block is full, then the block is
+ * compressed into table->compressed_text. small LZ77 codec, same sequence layout as LZ4:
+ *
+ *   token (literal length << 4 | (match length - 4)), [literal length ext], literals, offset (2 bytes LE), [match length ext]
+ *
+ * 15 in a token nibble means the length continues in following bytes, each adding up to 255.
+ * last sequence is literals only; decoder knows it's done once it produced raw_size bytes.
+ */
+
+#define YARN__LZ_HASH_BITS  12
+#define YARN__LZ_MIN_MATCH  4
+#define YARN__LZ_MAX_OFFSET 65535
+
+/* worst case size of compressed block, for incompressible input. */
+size_t yarn__lz_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+uint32_t yarn__lz_read32(const uint8_t *bytes) {
+    uint32_t result;
+    memcpy(&result, bytes, sizeof(result));
+    return result;
+}
+
+uint8_t *yarn__lz_write_length(uint8_t *out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+/* match_length 0 means literals only. */
+uint8_t *yarn__lz_write_sequence(uint8_t *out, const uint8_t *literals, size_t n_literals, size_t offset, size_t match_length) {
+    size_t match_code = match_length ? match_length - YARN__LZ_MIN_MATCH : 0;
+    *out++ = (uint8_t)(((n_literals < 15 ? n_literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+    if (n_literals >= 15) out = yarn__lz_write_length(out, n_literals - 15);
+    memcpy(out, literals, n_literals);
+    out += n_literals;
+
+    if (match_length) {
+        *out++ = (uint8_t)(offset & 0xff);
+        *out++ = (uint8_t)(offset >> 8);
+        if (match_code >= 15) out = yarn__lz_write_length(out, match_code - 15);
+    }
+    return out;
+}
+
+/* dest needs yarn__lz_bound(length) bytes. returns compressed size. */
+size_t yarn__lz_compress(const uint8_t *src, size_t length, uint8_t *dest) {
+    uint32_t positions[1 << YARN__LZ_HASH_BITS]; /* last position + 1 of each hashed 4 bytes, 0 if none. */
+    memset(positions, 0, sizeof(positions));
+
+    uint8_t *out  = dest;
+    size_t at     = 0;
+    size_t anchor = 0; /* start of pending literals. */
+    while (at + YARN__LZ_MIN_MATCH <= length) {
+        uint32_t sequence = yarn__lz_read32(src + at);
+        uint32_t hash     = (sequence * 2654435761u) >> (32 - YARN__LZ_HASH_BITS);
+        size_t candidate  = positions[hash];
+        positions[hash]   = (uint32_t)(at + 1);
+
+        if (candidate == 0 || at - (candidate - 1) > YARN__LZ_MAX_OFFSET || yarn__lz_read32(src + candidate - 1) != sequence) {
+            at++;
+            continue;
+        }
+
+        size_t match        = candidate - 1;
+        size_t match_length = YARN__LZ_MIN_MATCH;
+        while (at + match_length < length && src[match + match_length] == src[at + match_length]) {
+            match_length++;
+        }
+
+        out = yarn__lz_write_sequence(out, src + anchor, at - anchor, at - match, match_length);
+        at += match_length;
+        anchor = at;
+    }
+
+    if (anchor < length) out = yarn__lz_write_sequence(out, src + anchor, length - anchor, 0, 0);
+    return (size_t)(out - dest);
+}
+
+/* reads length extension bytes. returns 0 if it runs past the end. */
+int yarn__lz_read_length(const uint8_t *src, size_t src_length, size_t *in, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*in >= src_length) return 0;
+        byte = src[(*in)++];
+        *length += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+/* decompresses exactly raw_size bytes into dest. returns 0 if block is malformed. */
+int yarn__lz_decompress(const uint8_t *src, size_t src_length, uint8_t *dest, size_t raw_size) {
+    size_t in  = 0;
+    size_t out = 0;
+    while (out < raw_size) {
+        if (in >= src_length) return 0;
+        uint8_t token = src[in++];
+
+        size_t n_literals = token >> 4;
+        if (n_literals == 15 && !yarn__lz_read_length(src, src_length, &in, &n_literals)) return 0;
+        if (n_literals > raw_size - out || n_literals > src_length - in) return 0;
+
+        memcpy(dest + out, src + in, n_literals);
+        in  += n_literals;
+        out += n_literals;
+        if (out == raw_size) break;
+
+        if (src_length - in < 2) return 0;
+        size_t offset = (size_t)src[in] | ((size_t)src[in + 1] << 8);
+        in += 2;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !yarn__lz_read_length(src, src_length, &in, &match_length)) return 0;
+        match_length += YARN__LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || match_length > raw_size - out) return 0;
+
+        /* byte by byte: match may overlap what it's producing. */
+        const uint8_t *match = dest + out - offset;
+        for (size_t i = 0; i < match_length; ++i) {
+            dest[out + i] = match[i];
+        }
+        out += match_length;
+    }
+    return 1;
+}
+
+void yarn__flush_text_block(yarn_string_table *table) {
+    size_t raw_size = table->staged_text.used;
+    if (raw_size == 0) return;
+
+    size_t required = table->compressed_text.used + yarn__lz_bound(raw_size);
+    if (required > table->compressed_text.capacity) {
+        size_t capacity = table->compressed_text.capacity ? table->compressed_text.capacity * 2 : 64 * 1024;
+        while (capacity < required) capacity *= 2;
+        table->compressed_text.entries  = (uint8_t *)YARN_REALLOC(table->compressed_text.entries, capacity);
+        table->compressed_text.capacity = capacity;
+    }
+
+    yarn_text_block block;
+    block.offset          = table->compressed_text.used;
+    block.raw_size        = (uint32_t)raw_size;
+    block.compressed_size = (uint32_t)yarn__lz_compress((const uint8_t *)table->staged_text.entries, raw_size,
+                                                        table->compressed_text.entries + block.offset);
+
+    if (!table->text_blocks.entries) YARN_MAKE_DYNARRAY(&table->text_blocks, yarn_text_block, 64);
+    YARN_DYNARR_APPEND(&table->text_blocks, block);
+    table->compressed_text.used += block.compressed_size;
+    table->staged_text.used = 0;
+}
+
+/* copies text (with its '\0') into the block being filled, and points entry at it. */
+void yarn__stage_text(yarn_string_table *table, yarn_parsed_entry *entry, const char *text, size_t length) {
+    if (table->staged_text.used > 0 && table->staged_text.used + length + 1 > YARN_TEXT_BLOCK_SIZE) {
+        yarn__flush_text_block(table);
+    }
+
+    /* text longer than a block gets a block of its own. */
+    size_t required = table->staged_text.used + length + 1;
+    if (required > table->staged_text.capacity) {
+        size_t capacity = (required > YARN_TEXT_BLOCK_SIZE) ? required : YARN_TEXT_BLOCK_SIZE;
+        table->staged_text.entries  = (char *)YARN_REALLOC(table->staged_text.entries, capacity);
+        table->staged_text.capacity = capacity;
+    }
+
+    entry->text_slot   = (int)table->text_blocks.used;
+    entry->text_offset = (uint32_t)table->staged_text.used;
+    entry->text_length = (uint32_t)length;
+
+    memcpy(table->staged_text.entries + table->staged_text.used, text, length + 1);
+    table->staged_text.used += length + 1;
+}
+
+/* done loading: compresses the last block, and gives back what only loading needed. */
+void yarn__seal_text_blocks(yarn_string_table *table) {
+    yarn__flush_text_block(table);
+
+    YARN_FREE(table->staged_text.entries);
+    table->staged_text.entries  = 0;
+    table->staged_text.capacity = 0;
+
+    if (table->compressed_text.used > 0 && table->compressed_text.used < table->compressed_text.capacity) {
+        table->compressed_text.entries  = (uint8_t *)YARN_REALLOC(table->compressed_text.entries, table->compressed_text.used);
+        table->compressed_text.capacity = table->compressed_text.used;
+    }
+}
+
+char *yarn__decode_compressed_text(yarn_string_table *table, yarn_parsed_entry *entry) {
+    int block = entry->text_slot;
+    yarn_text_block_slot *slot   = 0;
+    yarn_text_block_slot *victim = &table->block_cache[0];
+
+    for (int i = 0; i < YARN_TEXT_BLOCK_CACHE; ++i) {
+        yarn_text_block_slot *s = &table->block_cache[i];
+        if (s->text && s->block == block) {
+            slot = s;
+            break;
+        }
+        if (s->last_used < victim->last_used) victim = s; /* unused slots have 0. */
+    }
+
+    if (!slot) {
+        yarn_text_block *b = &table->text_blocks.entries[block];
+        slot = victim;
+        if (slot->capacity < b->raw_size) {
+            if (slot->text) YARN_FREE(slot->text);
+            slot->capacity = (b->raw_size > YARN_TEXT_BLOCK_SIZE) ? b->raw_size : YARN_TEXT_BLOCK_SIZE;
+            slot->text     = (char *)YARN_MALLOC(slot->capacity);
+        }
+
+        if (!yarn__lz_decompress(table->compressed_text.entries + b->offset, b->compressed_size, (uint8_t *)slot->text, b->raw_size)) {
+            printf("error: compressed text block %d is corrupted\n", block);
+            slot->block     = -1;
+            slot->last_used = 0;
+            return 0;
+        }
+        slot->block = block;
+    }
+
+    slot->last_used = ++table->block_clock;
+    return slot->text + entry->text_offset;
+}
+
+/* ===========================================
+ * Parsing strings / CSV tables.
+ *
+ * one pass over the bytes, with a state machine that can stop and resume at any byte.
+ * fields are unescaped straight into the unused tail of table's allocator while scanning,
+ * and only the ones we keep get committed; skipped columns aren't even copied.
+ * no malloc per field, and destroying the table frees all of it at once.
+ */
+
+/* what a csv column is used for. decided by the header row. */
+enum {
+    YARN__CSV_SKIP = -1, /* unknown, or not projected. */
+    YARN__CSV_ID   = 0,
+    YARN__CSV_TEXT,
+    YARN__CSV_FILE,
+    YARN__CSV_NODE,
+    YARN__CSV_LINE_NUMBER,
+};
+
+typedef struct {
+    const char *word;
+    int         role;
+    int         column_flag; /* YARN_COLUMN_*, 0 if it can't be skipped. */
+} yarn__known_csv_column;
+
+const yarn__known_csv_column known_columns[] = {
+    { "id",         YARN__CSV_ID,          0                       },
+    { "text",       YARN__CSV_TEXT,        YARN_COLUMN_TEXT        },
+    { "file",       YARN__CSV_FILE,        YARN_COLUMN_FILE        },
+    { "node",       YARN__CSV_NODE,        YARN_COLUMN_NODE        },
+    { "lineNumber", YARN__CSV_LINE_NUMBER, YARN_COLUMN_LINE_NUMBER },
+};
+
+enum {
+    YARN__CSV_FIELD_START = 0,
+    YARN__CSV_UNQUOTED,
+    YARN__CSV_QUOTED,
+    YARN__CSV_QUOTE_IN_QUOTED, /* seen `"` inside quote: escaped (`""`) or closing. */
+};
+
+typedef struct yarn__csv_parser {
+    yarn_string_table *table;
+
+    int state;
+    int skip_lf;         /* last row ended with `\r`. */
+    int parsing_header;
+    int column;
+    int current_line;
+    int ended;           /* met '\0'. */
+    int discard;         /* current field is skipped; don't even copy it. */
+
+    /* absolute offsets in csv; for lazy table. */
+    size_t base;         /* offset of the bytes currently being fed. */
+    size_t field_begin;
+    size_t field_end;
+
+    YARN_DYN_ARRAY(int) roles; /* YARN__CSV_* of each column. */
+    yarn__markup_builder markup; /* scratch of yarn__parse_markup / yarn__compile_template. */
+
+    /* field being built lives right past chunk->used, until committed. */
+    yarn_allocator_chunk *chunk;
+    size_t field_length;
+
+    char *line_id;
+    yarn_parsed_entry line;
+
+    /* neighbouring rows mostly share file / node; skip the lookup if it's the same as last one. */
+    int last_file;
+    int last_node;
+} yarn__csv_parser;
+
+/*
+ * structural character scanning.
+ * which characters are structural depends on whether we're inside a quote:
+ *   outside: `,` `\r` `\n` '\0'
+ *   inside:  `"` '\0' (commas and linebreaks are text)
+ * so each state has its own scanner. both compare 32 (avx2) or 16 (sse2) bytes at once into
+ * a bitmask of structural characters, and jump straight to the lowest bit.
+ * state machine only ever sees the structural characters; the bytes in between are copied as a run.
+ */
+uint32_t yarn__ctz32(uint32_t mask) {
+    assert(mask != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+uint32_t yarn__popcount32(uint32_t mask) {
+#if defined(_MSC_VER)
+    return (uint32_t)__popcnt(mask);
+#else
+    return (uint32_t)__builtin_popcount(mask);
+#endif
+}
+
+/* returns offset of first `,` `\r` `\n` or '\0', or length if there's none. */
+size_t yarn__csv_scan_unquoted(const char *bytes, size_t length) {
+    size_t at = 0;
+
+#if defined(YARN__SIMD_AVX2)
+    {
+        const __m256i comma = _mm256_set1_epi8(',');
+        const __m256i cr    = _mm256_set1_epi8('\r');
+        const __m256i lf    = _mm256_set1_epi8('\n');
+        const __m256i nul   = _mm256_setzero_si256();
+
+        for (; at + 32 <= length; at += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(bytes + at));
+            __m256i hit   = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, comma), _mm256_cmpeq_epi8(block, cr)),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(block, lf),    _mm256_cmpeq_epi8(block, nul)));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+            if (mask) return at + yarn__ctz32(mask);
+        }
+    }
+#endif
+
+#if defined(YARN__SIMD_SSE2)
+    {
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i cr    = _mm_set1_epi8('\r');
+        const __m128i lf    = _mm_set1_epi8('\n');
+        const __m128i nul   = _mm_setzero_si128();
+
+        for (; at + 16 <= length; at += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(bytes + at));
+            __m128i hit   = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, comma), _mm_cmpeq_epi8(block, cr)),
+                                         _mm_or_si128(_mm_cmpeq_epi8(block, lf),    _mm_cmpeq_epi8(block, nul)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+            if (mask) return at + yarn__ctz32(mask);
+        }
+    }
+#endif
+
+    for (; at < length; ++at) {
+        char c = bytes[at];
+        if (c == ',' || c == '\r' || c == '\n' || c == '\0') break;
+    }
+    return at;
+}
+
+/* returns offset of first `"` or '\0', or length if there's none. adds linebreaks passed to *newlines. */
+size_t yarn__csv_scan_quoted(const char *bytes, size_t length, int *newlines) {
+    size_t at = 0;
+    int lines = 0;
+
+#if defined(YARN__SIMD_AVX2)
+    {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i lf    = _mm256_set1_epi8('\n');
+        const __m256i nul   = _mm256_setzero_si256();
+
+        for (; at + 32 <= length; at += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(bytes + at));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, nul)));
+            uint32_t lfs  = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf));
+            if (mask) {
+                uint32_t index = yarn__ctz32(mask);
+                lines += yarn__popcount32(lfs & ((1u << index) - 1)); /* only the ones before the quote. */
+                *newlines += lines;
+                return at + index;
+            }
+            lines += yarn__popcount32(lfs);
+        }
+    }
+#endif
+
+#if defined(YARN__SIMD_SSE2)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i lf    = _mm_set1_epi8('\n');
+        const __m128i nul   = _mm_setzero_si128();
+
+        for (; at + 16 <= length; at += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(bytes + at));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, nul)));
+            uint32_t lfs  = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf));
+            if (mask) {
+                uint32_t index = yarn__ctz32(mask);
+                lines += yarn__popcount32(lfs & ((1u << index) - 1));
+                *newlines += lines;
+                return at + index;
+            }
+            lines += yarn__popcount32(lfs);
+        }
+    }
+#endif
+
+    for (; at < length; ++at) {
+        char c = bytes[at];
+        if (c == '"' || c == '\0') break;
+        if (c == '\n') lines++;
+    }
+
+    *newlines += lines;
+    return at;
+}
+
+int yarn__parse_linenumber(char *str, size_t begin, size_t length, int current_line) {
+    int result_number = 0;
+    for (int i = 0; i < length; ++i) {
+        /* TODO: @limit handle other than ascii */
+        char c = str[begin + i];
+        int  n = c - '0';
+        if (n < 0 || n > 9) {
+            printf("error(csv line %d): encountered char `%c` while parsing line number.\n", current_line, c);
+            return -1;
+        }
+
+        if (((INT_MAX - n) / 10) < result_number) {
+            printf("error(csv line %d): integer overflow (max %d, parsed until %d%d...)\n", current_line, INT_MAX, result_number, n);
+            return -1;
+        }
+
+        result_number = result_number * 10 + n;
+    }
+    return result_number;
+}
+
+void yarn__csv_begin(yarn__csv_parser *parser, yarn_string_table *table, size_t expected_size) {
+    memset(parser, 0, sizeof(yarn__csv_parser));
+    parser->table          = table;
+    parser->parsing_header = 1;
+    parser->current_line   = 1;
+    parser->last_file      = -1;
+    parser->last_node      = -1;
+    parser->line.file      = -1;
+    parser->line.node      = -1;
+    parser->line.text_slot = -1;
+    YARN_MAKE_DYNARRAY(&parser->roles, int, 8);
+    YARN_MAKE_DYNARRAY(&parser->markup.attributes, yarn_markup_attribute, 8);
+    YARN_MAKE_DYNARRAY(&parser->markup.properties, yarn_markup_property, 8);
+    YARN_MAKE_DYNARRAY(&parser->markup.open, int, 8);
+    YARN_MAKE_DYNARRAY(&parser->markup.segments, yarn_template_segment, 8);
+
+    /* reserving whole csv upfront means every field lands in one chunk without moving. */
+    parser->chunk = yarn__allocator_reserve(&table->allocator, expected_size + 1);
+}
+
+void yarn__csv_end(yarn__csv_parser *parser) {
+    YARN_FREE(parser->roles.entries);
+    parser->roles.entries = 0;
+    if (parser->markup.attributes.entries) {
+        YARN_FREE(parser->markup.attributes.entries);
+        YARN_FREE(parser->markup.properties.entries);
+        YARN_FREE(parser->markup.open.entries);
+        YARN_FREE(parser->markup.segments.entries);
+        parser->markup.attributes.entries = 0;
+    }
+}
+
+/* appends bytes to current field. moves the field into new chunk if it outgrows current one. */
+void yarn__csv_append(yarn__csv_parser *parser, const char *bytes, size_t length) {
+    if (parser->discard) return;
+
+    yarn_allocator_chunk *chunk = parser->chunk;
+    size_t required = parser->field_length + length + 1; /* + '\0' */
+
+    if (chunk->capacity - chunk->used < required) {
+        yarn_allocator_chunk *moved = yarn__allocator_reserve(&parser->table->allocator, required);
+        memcpy(moved->buffer + moved->used, chunk->buffer + chunk->used, parser->field_length);
+        parser->chunk = chunk = moved;
+    }
+
+    memcpy(chunk->buffer + chunk->used + parser->field_length, bytes, length);
+    parser->field_length += length;
+}
+
+/* null terminates current field without committing it. */
+char *yarn__csv_peek_field(yarn__csv_parser *parser) {
+    yarn__csv_append(parser, "", 0); /* make room for '\0' */
+
+    char *field = parser->chunk->buffer + parser->chunk->used;
+    field[parser->field_length] = '\0';
+    return field;
+}
+
+char *yarn__csv_commit_field(yarn__csv_parser *parser) {
+    char *field = yarn__csv_peek_field(parser);
+    parser->chunk->used += parser->field_length + 1;
+    return field;
+}
+
+/* interns current field. commits it only if it's the first time we see it. */
+int yarn__csv_intern_field(yarn__csv_parser *parser, int last_id) {
+    yarn_string_table *table = parser->table;
+    char *field = yarn__csv_peek_field(parser);
+
+    if (last_id != -1 && strcmp(table->interned.entries[last_id], field) == 0) {
+        return last_id;
+    }
+
+    int id = -1;
+    if (yarn_kvget(&table->interned_ids, field, &id) != -1) {
+        return id;
+    }
+
+    field = yarn__csv_commit_field(parser);
+    id = (int)table->interned.used;
+    YARN_DYNARR_APPEND(&table->interned, field);
+    yarn_kvpush(&table->interned_ids, field, id);
+    return id;
+}
+
+/* decides what to do with the column of header, by its name. */
+int yarn__csv_map_column(yarn__csv_parser *parser) {
+    char *word = yarn__csv_peek_field(parser);
+    int role = YARN__CSV_SKIP;
+
+    for (int i = 0; i < YARN_LEN(known_columns); ++i) {
+        const yarn__known_csv_column *known = &known_columns[i];
+        if (strcmp(word, known->word) != 0) continue;
+
+        for (size_t c = 0; c < parser->roles.used; ++c) {
+            if (parser->roles.entries[c] == known->role) {
+                printf("error(csv line %d): duplicate column %s\n", parser->current_line, word);
+                return 0;
+            }
+        }
+
+        if (known->column_flag == 0 || (parser->table->columns & known->column_flag)) {
+            role = known->role;
+        }
+        break;
+    }
+
+    YARN_DYNARR_APPEND(&parser->roles, role);
+    return 1;
+}
+
+/* marks whether next field is worth copying. */
+void yarn__csv_next_field(yarn__csv_parser *parser) {
+    parser->field_length = 0;
+    parser->state   = YARN__CSV_FIELD_START;
+    parser->discard = 0;
+    if (!parser->parsing_header && parser->column < (int)parser->roles.used) {
+        int role = parser->roles.entries[parser->column];
+        parser->discard = (role == YARN__CSV_SKIP) || (role == YARN__CSV_TEXT && parser->table->lazy);
+    }
+}
+
+/* markup (if table parses it) and template of text. text is changed in place; returns its new length. */
+size_t yarn__csv_compile_text(yarn__csv_parser *parser, char *text, size_t length) {
+    yarn_allocator *allocator = &parser->table->allocator;
+    int malformed = 0;
+
+    if (parser->table->markup) {
+        length = yarn__parse_markup(allocator, &parser->markup, text, length, &parser->line.markup, &malformed);
+        if (malformed) {
+            printf("error(csv line %d): malformed markup, kept as text: %.*s\n", parser->current_line, (int)length, text);
+        }
+        text[length] = '\0';
+    }
+
+    parser->line.format = yarn__compile_template(allocator, &parser->markup, text, length, parser->table->markup, parser->line.markup, &malformed);
+    if (malformed) {
+        printf("error(csv line %d): malformed placeholder / format function, kept as text: %s\n", parser->current_line, text);
+    }
+    return length;
+}
+
+int yarn__csv_end_field(yarn__csv_parser *parser) {
+    int column = parser->column++;
+
+    if (parser->parsing_header) {
+        if (!yarn__csv_map_column(parser)) return 0;
+    } else {
+        if (column >= (int)parser->roles.used) {
+            printf("error(csv line %d): unexpected column\n", parser->current_line);
+            return 0;
+        }
+
+        switch(parser->roles.entries[column]) {
+            case YARN__CSV_SKIP: break;
+            case YARN__CSV_ID:   parser->line_id   = yarn__csv_commit_field(parser); break;
+            case YARN__CSV_TEXT:
+            {
+                if (parser->table->lazy) {
+                    parser->line.text_offset = (uint32_t)parser->field_begin;
+                    parser->line.text_length = (uint32_t)(parser->field_end - parser->field_begin);
+                } else if (parser->table->compress) {
+                    /* staged, then overwritten by the next field; template is compiled from the staged copy. */
+                    yarn__stage_text(parser->table, &parser->line, yarn__csv_peek_field(parser), parser->field_length);
+                    parser->line.text_length = (uint32_t)yarn__csv_compile_text(parser, parser->table->staged_text.entries + parser->line.text_offset, parser->line.text_length);
+                } else {
+                    parser->line.text = yarn__csv_commit_field(parser);
+                    yarn__csv_compile_text(parser, parser->line.text, parser->field_length);
+                }
+            } break;
+            case YARN__CSV_FILE: parser->line.file = parser->last_file = yarn__csv_intern_field(parser, parser->last_file); break;
+            case YARN__CSV_NODE: parser->line.node = parser->last_node = yarn__csv_intern_field(parser, parser->last_node); break;
+            case YARN__CSV_LINE_NUMBER:
+            {
+                /* TODO: @deviation this part of the code must parse line number as an integer. */
+                int number = yarn__parse_linenumber(yarn__csv_peek_field(parser), 0, parser->field_length, parser->current_line);
+                if (number == -1) return 0;
+                parser->line.line_number = number;
+            } break;
+        }
+    }
+
+    yarn__csv_next_field(parser);
+    return 1;
+}
+
+int yarn__csv_end_row(yarn__csv_parser *parser) {
+    if (parser->parsing_header) {
+        int has_id = 0;
+        for (size_t c = 0; c < parser->roles.used; ++c) {
+            has_id |= (parser->roles.entries[c] == YARN__CSV_ID);
+        }
+
+        if (!has_id) {
+            printf("error(csv line %d): csv has no `id` column\n", parser->current_line);
+            return 0;
+        }
+        parser->parsing_header = 0;
+    } else {
+        if (parser->column != (int)parser->roles.used) {
+            printf("error(csv line %d): unexpected linebreak before row parsing is complete.\n", parser->current_line);
+            return 0;
+        }
+
+        yarn_kvpush(&parser->table->table, parser->line_id, parser->line);
+        parser->line_id = 0;
+        memset(&parser->line, 0, sizeof(yarn_parsed_entry));
+        parser->line.file      = -1;
+        parser->line.node      = -1;
+        parser->line.text_slot = -1;
+    }
+
+    parser->column = 0;
+    parser->current_line += 1;
+    yarn__csv_next_field(parser);
+    return 1;
+}
+
+/* parses as much as given. stops at '\0', if there's any. returns 0 on error. */
+int yarn__csv_feed(yarn__csv_parser *parser, const char *bytes, size_t length) {
+    size_t at = 0;
+    while(at < length && !parser->ended) {
+        switch(parser->state) {
+            case YARN__CSV_FIELD_START:
+            {
+                char c = bytes[at];
+                if (parser->skip_lf) {
+                    parser->skip_lf = 0;
+                    if (c == '\n') {
+                        at++;
+                        break;
+                    }
+                }
+
+                parser->field_begin = parser->base + at;
+                if (c == '"') {
+                    at++;
+                    parser->state = YARN__CSV_QUOTED;
+                    break;
+                }
+
+                if (c == '\0' && parser->column == 0) {
+                    at++;
+                    parser->ended = 1;
+                    break;
+                }
+
+                if ((c == '\r' || c == '\n') && parser->column == 0) {
+                    /* empty line. */
+                    at++;
+                    parser->skip_lf = (c == '\r');
+                    parser->current_line += 1;
+                    break;
+                }
+
+                parser->state = YARN__CSV_UNQUOTED;
+            } /* fallthrough */
+
+            case YARN__CSV_UNQUOTED:
+            {
+                size_t run = at + yarn__csv_scan_unquoted(bytes + at, length - at);
+                yarn__csv_append(parser, bytes + at, run - at);
+                parser->field_end = parser->base + run;
+                at = run;
+                if (at == length) break;
+
+                char c = bytes[at++];
+                if (c == '\0') {
+                    parser->ended = 1;
+                    break;
+                }
+
+                if (!yarn__csv_end_field(parser)) return 0;
+                if (c != ',') {
+                    if (!yarn__csv_end_row(parser)) return 0;
+                    parser->skip_lf = (c == '\r');
+                }
+            } break;
+
+            case YARN__CSV_QUOTED:
+            {
+                /* 1. csv escapes double quotation with itself apparently. what the crap? */
+                size_t run = at + yarn__csv_scan_quoted(bytes + at, length - at, &parser->current_line);
+                yarn__csv_append(parser, bytes + at, run - at);
+                at = run;
+                if (at == length) break;
+
+                if (bytes[at++] == '\0') {
+                    parser->ended = 1;
+                    break;
+                }
+                parser->state = YARN__CSV_QUOTE_IN_QUOTED;
+            } break;
+
+            case YARN__CSV_QUOTE_IN_QUOTED:
+            {
+                if (bytes[at] == '"') {
+                    yarn__csv_append(parser, "\"", 1);
+                    at++;
+                    parser->state = YARN__CSV_QUOTED;
+                } else {
+                    /* closed. whatever is left until the delimiter is taken as is. */
+                    parser->state = YARN__CSV_UNQUOTED;
+                }
+            } break;
+        }
+    }
+
+    parser->base += at;
+    return 1;
+}
+
+/* completes the last row, if csv didn't end with linebreak. */
+int yarn__csv_finish(yarn__csv_parser *parser) {
+    if (parser->state == YARN__CSV_QUOTED) {
+        printf("error: unexpected eof while parsing double quotation\n");
+        return 0;
+    }
+
+    if (parser->state != YARN__CSV_FIELD_START || parser->column > 0) {
+        if (!yarn__csv_end_field(parser)) return 0;
+        if (!yarn__csv_end_row(parser))   return 0;
+    }
+
+    if (parser->table->compress) yarn__seal_text_blocks(parser->table);
+    return 1;
+}
+
+size_t yarn__csv_unescape(char *dest, const char *field, size_t length) {
+    if (length == 0 || field[0] != '"') {
+        memcpy(dest, field, length);
+        return length;
+    }
+
+    /* same as the state machine: `""` is `"`, lone `"` closes, anything after closing is taken as is. */
+    size_t written = 0;
+    size_t at = 1;
+    while(at < length) {
+        char c = field[at++];
+        if (c != '"') {
+            dest[written++] = c;
+        } else if (at < length && field[at] == '"') {
+            dest[written++] = '"';
+            at++;
+        } else {
+            memcpy(dest + written, field + at, length - at);
+            written += length - at;
+            break;
+        }
+    }
+    return written;
+}
+
+void yarn__lazy_unlink(yarn_string_table *table, int slot) {
+    yarn_lazy_slot *s = &table->lazy_slots[slot];
+    if (s->prev != -1) table->lazy_slots[s->prev].next = s->next; else table->lazy_head = s->next;
+    if (s->next != -1) table->lazy_slots[s->next].prev = s->prev; else table->lazy_tail = s->prev;
+}
+
+void yarn__lazy_push_front(yarn_string_table *table, int slot) {
+    yarn_lazy_slot *s = &table->lazy_slots[slot];
+    s->prev = -1;
+    s->next = table->lazy_head;
+    if (table->lazy_head != -1) table->lazy_slots[table->lazy_head].prev = slot;
+    table->lazy_head = slot;
+    if (table->lazy_tail == -1) table->lazy_tail = slot;
+}
+
+char *yarn__decode_lazy_text(yarn_string_table *table, char *line_id, yarn_parsed_entry *entry) {
+    const char *field = table->lazy_source + entry->text_offset;
+
+    if (table->lazy_cache_lines <= 0) {
+        /* unbounded: decode once, keep it with the rest of the table. */
+        yarn_allocator_chunk *chunk = yarn__allocator_reserve(&table->allocator, entry->text_length + 1);
+        char *text = chunk->buffer + chunk->used;
+        size_t length = yarn__csv_unescape(text, field, entry->text_length);
+        text[length] = '\0';
+
+        chunk->used += length + 1;
+        entry->text = text;
+        return text;
+    }
+
+    if (!table->lazy_slots) {
+        table->lazy_slots = (yarn_lazy_slot *)YARN_MALLOC(sizeof(yarn_lazy_slot) * table->lazy_cache_lines);
+        table->lazy_used  = 0;
+        table->lazy_head  = -1;
+        table->lazy_tail  = -1;
+    }
+
+    int slot = entry->text_slot;
+    if (slot != -1 && table->lazy_slots[slot].line_id == line_id) {
+        yarn__lazy_unlink(table, slot);
+        yarn__lazy_push_front(table, slot);
+        return table->lazy_slots[slot].text;
+    }
+
+    if (table->lazy_used < table->lazy_cache_lines) {
+        slot = table->lazy_used++;
+    } else {
+        /* evict least recently used. its entry notices by the owner mismatch. */
+        slot = table->lazy_tail;
+        yarn__lazy_unlink(table, slot);
+        YARN_FREE(table->lazy_slots[slot].text);
+    }
+
+    char *text = (char *)YARN_MALLOC(entry->text_length + 1);
+    size_t length = yarn__csv_unescape(text, field, entry->text_length);
+    text[length] = '\0';
+
+    table->lazy_slots[slot].line_id = line_id;
+    table->lazy_slots[slot].text    = text;
+    yarn__lazy_push_front(table, slot);
+
+    entry->text_slot = slot;
+    return text;
+}
+
+int yarn_string_table_feed(yarn_string_table *table, const void *chunk, size_t chunk_length) {
+    if (table->frozen.slots) {
+        printf("error: frozen string table can't be loaded into\n");
+        return 0;
+    }
+    if (table->format_acquired) {
+        printf("error: release formatted lines before loading into the string table\n");
+        return 0;
+    }
+    table->bound_to = 0; /* buckets move. */
+    table->bound_lines.used = 0;
+    yarn__flush_format_cache(table);
+
+    if (table->lazy) {
+        printf("error: lazy string table can't be fed in chunks\n");
+        return 0;
+    }
+
+    if (!table->feeding) {
+        table->feeding = (yarn__csv_parser *)YARN_MALLOC(sizeof(yarn__csv_parser));
+        yarn__csv_begin(table->feeding, table, 0); /* size unknown; allocator grows as it goes. */
+    }
+
+    if (!yarn__csv_feed(table->feeding, (const char *)chunk, chunk_length)) {
+        yarn__stop_feeding(table);
+        return 0;
+    }
+    return 1;
+}
+
+int yarn_string_table_finish(yarn_string_table *table) {
+    if (!table->feeding) return 0;
+
+    int result = yarn__csv_finish(table->feeding);
+    yarn__stop_feeding(table);
+    return result;
+}
+
+void yarn__stop_feeding(yarn_string_table *table) {
+    if (!table->feeding) return;
+
+    yarn__csv_end(table->feeding);
+    YARN_FREE(table->feeding);
+    table->feeding = 0;
+}
+
+int yarn__load_string_table(yarn_string_table *table, void *string_table_buffer, size_t string_table_length) {
+    yarn__csv_parser parser;
+    size_t expected_size = string_table_length;
+
+    if (table->frozen.slots) {
+        printf("error: frozen string table can't be loaded into\n");
+        return 0;
+    }
+    if (table->format_acquired) {
+        printf("error: release formatted lines before loading into the string table\n");
+        return 0;
+    }
+    table->bound_to = 0; /* buckets move. */
+    table->bound_lines.used = 0;
+    yarn__flush_format_cache(table);
+
+    if (table->lazy && table->compress) {
+        printf("error: string table can't be both lazy and compressed\n");
+        return 0;
+    }
+    if (table->lazy && table->markup) {
+        printf("error: lazy string table can't parse markup\n");
+        return 0;
+    }
+
+    if (table->lazy) {
+        if (table->lazy_source) {
+            printf("error: lazy string table can only be loaded once\n");
+            return 0;
+        }
+        if (string_table_length > UINT32_MAX) {
+            printf("error: lazy string table must be smaller than 4GB\n");
+            return 0;
+        }
+
+        table->lazy_source = (const char *)string_table_buffer;
+        expected_size = string_table_length / 4; /* ids and interned strings only. */
+    }
+
+    if (table->compress) {
+        expected_size = string_table_length / 4; /* texts go to compressed blocks. */
+    }
+
+    yarn__csv_begin(&parser, table, expected_size);
+
+    int result = yarn__csv_feed(&parser, (const char *)string_table_buffer, string_table_length);
+    if (result && !parser.ended) { /* (string table length - 1) == position of '\0' */
+        printf("error: couldn't parse until the end of the string table. data possibly corrupted\n");
+        result = 0;
+    }
+
+    if (result) result = yarn__csv_finish(&parser);
+    yarn__csv_end(&parser);
+    return result;
+}
+
 
 #endif
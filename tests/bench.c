@@ -0,0 +1,261 @@
+/*
+ ==========================================
+  Load benchmark.
+  measures yarn_load_program, yarn_load_string_table, peak RSS and teardown time
+  for a `.yarnc` + `.csv` pair (see gen_corpus.c for generating big ones),
+  plus what yarn_get_*_memory_stats accounts for, by category,
+  and line id lookups before / after yarn_freeze_string_table, and by dense index after binding,
+  and yarn__hashstr against plain djb2 over the line ids plus `$`-prefixed variable names.
+
+  usage:
+    bench <yarnc> <csv> [label] [load threads] [lazy|compress]
+
+  build with -DYARN_C99_THREADS to let [load threads] decode the program in parallel.
+  pass `lazy` to load the string table lazily (texts are decoded on first use),
+  or `compress` to keep its texts in compressed blocks.
+
+  run one process per corpus; peak RSS only ever grows within a process.
+ ==========================================
+*/
+#include "yarn_spinner.pb-c.h"
+
+#define YARN_C99_STUB_TO_NOOP
+#define YARN_C99_IMPLEMENTATION
+#include "yarn_c99.h"
+
+#include <math.h>
+
+#if defined(_WIN32)
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <time.h>
+  #include <sys/resource.h>
+#endif
+
+static double now_ms(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1000.0 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+#endif
+}
+
+/* peak resident set size in kilobytes. */
+static long peak_rss_kb(void) {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return (long)(pmc.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+  #if defined(__APPLE__)
+    return (long)(usage.ru_maxrss / 1024); /* bytes on macOS */
+  #else
+    return (long)usage.ru_maxrss;
+  #endif
+#endif
+}
+
+static char *read_entire_file(const char *file_name, size_t *bytes_read) {
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp) return 0;
+
+    fseek(fp, 0, SEEK_END);
+    size_t filesize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char *result = (char *)calloc(filesize + 1, 1);
+    size_t read = fread(result, 1, filesize, fp);
+    fclose(fp);
+
+    *bytes_read = read;
+    return result;
+}
+
+/* what yarn__hashstr used to be, for comparison. */
+static uint32_t djb2(const char *str, size_t length) {
+    uint32_t h = 5381;
+    for (size_t i = 0; i < length; ++i) h = ((h << 5) + h) + str[i];
+    return h;
+}
+
+static volatile uint32_t hash_sink;
+
+static size_t spread_capacity(size_t n_keys) {
+    size_t capacity = 1;
+    while (capacity < n_keys * 2) capacity *= 2;
+    return capacity;
+}
+
+/* fraction of keys landing in a bucket of their own, if hashing were uniform. */
+static double uniform_spread(size_t n_keys) {
+    double capacity = (double)spread_capacity(n_keys);
+    return n_keys ? capacity * (1.0 - exp(-(double)n_keys / capacity)) / (double)n_keys : 0;
+}
+
+/* hashes every key `rounds` times, and counts buckets of a power-of-two table (load ~0.5) they land in. */
+static double bench_hash(uint32_t (*hash)(const char *, size_t), const char **keys, const size_t *lengths, size_t n_keys,
+                         int rounds, double *occupied) {
+    size_t capacity = spread_capacity(n_keys);
+    uint8_t *taken = (uint8_t *)calloc(capacity, 1);
+
+    uint32_t sink = 0;
+    double t0 = now_ms();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < n_keys; ++i) sink += hash(keys[i], lengths[i]);
+    }
+    double t1 = now_ms();
+
+    size_t n_taken = 0;
+    for (size_t i = 0; i < n_keys; ++i) {
+        uint32_t bucket = hash(keys[i], lengths[i]) & (uint32_t)(capacity - 1);
+        n_taken += !taken[bucket];
+        taken[bucket] = 1;
+    }
+    free(taken);
+
+    hash_sink = sink;
+    *occupied = n_keys ? (double)n_taken / (double)n_keys : 0;
+    return t1 - t0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <yarnc> <csv> [label] [load threads] [lazy|compress]\n", argv[0]);
+        return 1;
+    }
+
+    const char *label = (argc > 3) ? argv[3] : argv[1];
+    int load_threads  = (argc > 4) ? atoi(argv[4]) : 1;
+    int lazy_table    = (argc > 5) && strcmp(argv[5], "lazy") == 0;
+    int compress      = (argc > 5) && strcmp(argv[5], "compress") == 0;
+    size_t yarnc_size = 0, csv_size = 0;
+    char *yarnc = read_entire_file(argv[1], &yarnc_size);
+    char *csv   = read_entire_file(argv[2], &csv_size);
+    if (!yarnc || !csv) {
+        fprintf(stderr, "could not read %s / %s\n", argv[1], argv[2]);
+        return 1;
+    }
+
+    long rss_before = peak_rss_kb();
+
+    yarn_variable_storage storage = yarn_create_default_storage();
+    yarn_string_table *table      = yarn_create_string_table();
+    yarn_dialogue *dialogue       = yarn_create_dialogue(storage);
+    dialogue->log_debug    = 0;
+    dialogue->load_threads = load_threads;
+    table->lazy            = lazy_table;
+    table->compress        = compress;
+
+    double t0 = now_ms();
+    int program_ok = yarn_load_program(dialogue, yarnc, yarnc_size);
+    double t1 = now_ms();
+    int table_ok = yarn_load_string_table(table, csv, csv_size + 1);
+    double t2 = now_ms();
+
+    long rss_loaded = peak_rss_kb();
+    size_t n_lines  = table->table.used;
+    size_t n_nodes  = program_ok ? dialogue->program->n_nodes : 0;
+
+    /* every id once, in random order, so neither map gets walked in memory order. */
+    const char **ids = (const char **)malloc(sizeof(char *) * (n_lines + 1));
+    size_t n_ids = 0;
+    char *key = 0;
+    yarn_parsed_entry entry;
+    yarn_kvforeach(&table->table, &key, &entry) ids[n_ids++] = key;
+    uint32_t seed = 12345;
+    for (size_t i = n_ids; i > 1; --i) {
+        seed = seed * 1103515245u + 12345u;
+        size_t j = seed % i;
+        const char *t = ids[i - 1]; ids[i - 1] = ids[j]; ids[j] = t;
+    }
+
+    size_t found = 0;
+    double l0 = now_ms();
+    for (size_t i = 0; i < n_ids; ++i) found += yarn__find_line(table, ids[i]) != 0;
+    double l1 = now_ms();
+    int frozen_ok = yarn_freeze_string_table(table);
+    double l2 = now_ms();
+    for (size_t i = 0; i < n_ids; ++i) found += yarn__find_line(table, ids[i]) != 0;
+    double l3 = now_ms();
+
+    int bound_ok = yarn_bind_string_table(dialogue, table);
+    double l4 = now_ms();
+    size_t n_bound = dialogue->line_ids.used;
+    for (size_t i = 0; i < n_bound; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        found += yarn_get_line_text_by_index(table, (int)(seed % n_bound)) != 0;
+    }
+    double l5 = now_ms();
+
+    /* line ids as they are, plus variable names in the same numbering scheme. */
+    size_t n_keys = n_ids * 2;
+    const char **keys = (const char **)malloc(sizeof(char *) * (n_keys + 1));
+    size_t *lengths   = (size_t *)malloc(sizeof(size_t) * (n_keys + 1));
+    char **variables  = (char **)malloc(sizeof(char *) * (n_ids + 1));
+    for (size_t i = 0; i < n_ids; ++i) {
+        char name[64];
+        int length   = snprintf(name, sizeof(name), "$chapter_%zu_visited_node_%zu", i / 50, i);
+        variables[i] = (char *)malloc(length + 1);
+        memcpy(variables[i], name, length + 1);
+
+        keys[i * 2]        = ids[i];
+        lengths[i * 2]     = strlen(ids[i]);
+        keys[i * 2 + 1]    = variables[i];
+        lengths[i * 2 + 1] = (size_t)length;
+    }
+    double djb2_spread, hash_spread;
+    double djb2_ms = bench_hash(djb2, keys, lengths, n_keys, 10, &djb2_spread);
+    double hash_ms = bench_hash(yarn__hashstr, keys, lengths, n_keys, 10, &hash_spread);
+    for (size_t i = 0; i < n_ids; ++i) free(variables[i]);
+    free(variables);
+    free(lengths);
+    free(keys);
+    free(ids);
+
+    yarn_memory_stats dialogue_stats, table_stats;
+    yarn_get_dialogue_memory_stats(dialogue, &dialogue_stats);
+    yarn_get_string_table_memory_stats(table, &table_stats);
+
+    double t3 = now_ms();
+    yarn_destroy_dialogue(dialogue);
+    yarn_destroy_string_table(table);
+    yarn_destroy_default_storage(storage);
+    double t4 = now_ms();
+
+    free(yarnc);
+    free(csv);
+
+    printf("%-12s threads %2d %s nodes %8zu  lines %8zu | program %9.2f ms  table %9.2f ms  teardown %9.2f ms | peak rss %8ld kb (+%ld kb)%s\n",
+           label, load_threads, lazy_table ? "lazy " : (compress ? "lz   " : "eager"), n_nodes, n_lines,
+           t1 - t0, t2 - t1, t4 - t3,
+           rss_loaded, rss_loaded - rss_before,
+           (program_ok && table_ok) ? "" : "  [LOAD FAILED]");
+
+    printf("%-12s lookups: kvmap %7.2f ms, freeze %7.2f ms%s, frozen %7.2f ms, bind %7.2f ms%s, by index %7.2f ms (%zu / %zu found)\n",
+           label, l1 - l0, l2 - l1, frozen_ok ? "" : " [FAILED]", l3 - l2,
+           l4 - l3, bound_ok ? "" : " [MISSING LINES]", l5 - l4, found, n_ids * 2 + n_bound);
+
+    printf("%-12s hashing %zu keys x10: djb2 %7.2f ms (%.1f%% distinct buckets), yarn__hashstr %7.2f ms (%.1f%%), uniform %.1f%%\n",
+           label, n_keys, djb2_ms, djb2_spread * 100, hash_ms, hash_spread * 100, uniform_spread(n_keys) * 100);
+
+    printf("%-12s accounted: dialogue %zu kb (%zu allocs), table %zu kb (%zu allocs)\n",
+           label,
+           dialogue_stats.total.bytes / 1024, dialogue_stats.total.allocations,
+           table_stats.total.bytes / 1024, table_stats.total.allocations);
+    for (int i = 0; i < YARN_MEMORY_CATEGORY_COUNT; ++i) {
+        printf("%-12s   %-12s dialogue %10zu kb %9zu allocs | table %10zu kb %9zu allocs\n",
+               "", yarn_memory_category_name(i),
+               dialogue_stats.categories[i].bytes / 1024, dialogue_stats.categories[i].allocations,
+               table_stats.categories[i].bytes / 1024, table_stats.categories[i].allocations);
+    }
+
+    return (program_ok && table_ok) ? 0 : 1;
+}
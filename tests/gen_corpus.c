@@ -0,0 +1,256 @@
+/*
+ ==========================================
+  Synthetic corpus generator.
+  emits valid `.yarnc` + `.csv` pair at the given scale, for scale testing / benchmarks.
+
+  usage:
+    gen_corpus <output prefix> <nodes> <instructions> <lines>
+
+    gen_corpus bench-data/large 10000 1000000 500000
+      -> bench-data/large.yarnc, bench-data/large.csv
+
+  every node runs its share of lines (every 4th line has a substitution),
+  then presents its last two lines as options, then jumps to the next node.
+  remaining instruction budget is spent on (PUSH_BOOL, JUMP_IF_FALSE, POP) padding.
+ ==========================================
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yarn_spinner.pb-c.h"
+
+/* generator never frees; everything lives until exit. */
+static void *gen_alloc(size_t size) {
+    void *result = calloc(1, size);
+    if (!result) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return result;
+}
+
+static char *gen_printf(const char *fmt, ...) {
+    char buffer[256];
+    va_list vl;
+    va_start(vl, fmt);
+    int length = vsnprintf(buffer, sizeof(buffer), fmt, vl);
+    va_end(vl);
+
+    char *result = (char *)gen_alloc(length + 1);
+    memcpy(result, buffer, length);
+    return result;
+}
+
+static Yarn__Operand *op_string(char *s) {
+    Yarn__Operand *op = (Yarn__Operand *)gen_alloc(sizeof(Yarn__Operand));
+    yarn__operand__init(op);
+    op->value_case   = YARN__OPERAND__VALUE_STRING_VALUE;
+    op->string_value = s;
+    return op;
+}
+
+static Yarn__Operand *op_float(float f) {
+    Yarn__Operand *op = (Yarn__Operand *)gen_alloc(sizeof(Yarn__Operand));
+    yarn__operand__init(op);
+    op->value_case  = YARN__OPERAND__VALUE_FLOAT_VALUE;
+    op->float_value = f;
+    return op;
+}
+
+static Yarn__Operand *op_bool(int b) {
+    Yarn__Operand *op = (Yarn__Operand *)gen_alloc(sizeof(Yarn__Operand));
+    yarn__operand__init(op);
+    op->value_case = YARN__OPERAND__VALUE_BOOL_VALUE;
+    op->bool_value = !!b;
+    return op;
+}
+
+typedef struct {
+    Yarn__Instruction **entries;
+    size_t used;
+    size_t capacity;
+
+    Yarn__Node__LabelsEntry **labels;
+    size_t n_labels;
+} gen_node_builder;
+
+static Yarn__Instruction *emit(gen_node_builder *b, Yarn__Instruction__OpCode opcode, int n_operands) {
+    if (b->used >= b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 16;
+        b->entries  = (Yarn__Instruction **)realloc(b->entries, sizeof(void *) * b->capacity);
+    }
+
+    Yarn__Instruction *inst = (Yarn__Instruction *)gen_alloc(sizeof(Yarn__Instruction));
+    yarn__instruction__init(inst);
+    inst->opcode     = opcode;
+    inst->n_operands = n_operands;
+    inst->operands   = n_operands ? (Yarn__Operand **)gen_alloc(sizeof(void *) * n_operands) : 0;
+
+    b->entries[b->used++] = inst;
+    return inst;
+}
+
+static void label(gen_node_builder *b, char *name) {
+    Yarn__Node__LabelsEntry *entry = (Yarn__Node__LabelsEntry *)gen_alloc(sizeof(Yarn__Node__LabelsEntry));
+    yarn__node__labels_entry__init(entry);
+    entry->key   = name;
+    entry->value = (int32_t)b->used;
+
+    b->labels = (Yarn__Node__LabelsEntry **)realloc(b->labels, sizeof(void *) * (b->n_labels + 1));
+    b->labels[b->n_labels++] = entry;
+}
+
+static void write_csv_text(FILE *fp, size_t line) {
+    /* mix of plain, quoted, escaped quote and comma fields, like real exports. */
+    switch (line % 4) {
+        case 0: fprintf(fp, "Character %zu: plain line of dialogue number %zu", line % 7, line); break;
+        case 1: fprintf(fp, "\"Character %zu: line with a comma, number %zu\"", line % 7, line); break;
+        case 2: fprintf(fp, "\"Character %zu: \"\"quoted\"\" line number %zu\"", line % 7, line); break;
+        case 3: fprintf(fp, "Character %zu: line number %zu", line % 7, line); break;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s <output prefix> <nodes> <instructions> <lines>\n", argv[0]);
+        return 1;
+    }
+
+    const char *prefix = argv[1];
+    size_t n_nodes  = strtoul(argv[2], 0, 10);
+    size_t n_instrs = strtoul(argv[3], 0, 10);
+    size_t n_lines  = strtoul(argv[4], 0, 10);
+    if (n_nodes == 0) n_nodes = 1;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.csv", prefix);
+    FILE *csv = fopen(path, "wb");
+    if (!csv) {
+        fprintf(stderr, "could not open %s\n", path);
+        return 1;
+    }
+    fprintf(csv, "id,text,file,node,lineNumber\n");
+
+    Yarn__Program program;
+    yarn__program__init(&program);
+    program.name    = (char *)"Generated";
+    program.n_nodes = n_nodes;
+    program.nodes   = (Yarn__Program__NodesEntry **)gen_alloc(sizeof(void *) * n_nodes);
+
+    size_t line_counter  = 0;
+    size_t total_instrs  = 0;
+    for (size_t n = 0; n < n_nodes; ++n) {
+        gen_node_builder b = {0};
+        char *node_name = gen_printf("Node%zu", n);
+        char *file_name = gen_printf("chapter%zu.yarn", n / 50);
+
+        size_t lines_here  = n_lines / n_nodes + (n < (n_lines % n_nodes) ? 1 : 0);
+        size_t instr_quota = n_instrs / n_nodes + (n < (n_instrs % n_nodes) ? 1 : 0);
+        size_t option_from = (lines_here >= 3) ? lines_here - 2 : lines_here;
+        char  *end_label   = gen_printf("L_end_%s", node_name);
+
+        /* count what the node needs besides padding, then pad at the head so it actually runs. */
+        size_t needed = 2;
+        for (size_t l = 0; l < lines_here; ++l) {
+            needed += (((line_counter + l) % 4) == 3) ? 2 : 1;
+        }
+        if (option_from < lines_here) needed += 2 + (lines_here - option_from) * 2;
+
+        /* padding: 3 instructions each. */
+        while (b.used + 3 + needed <= instr_quota) {
+            Yarn__Instruction *push = emit(&b, YARN__INSTRUCTION__OP_CODE__PUSH_BOOL, 1);
+            push->operands[0] = op_bool(1);
+            Yarn__Instruction *jif = emit(&b, YARN__INSTRUCTION__OP_CODE__JUMP_IF_FALSE, 1);
+            jif->operands[0] = op_string(end_label);
+            emit(&b, YARN__INSTRUCTION__OP_CODE__POP, 0);
+        }
+
+        for (size_t l = 0; l < lines_here; ++l) {
+            size_t line = line_counter++;
+            int has_substitution = (line % 4) == 3;
+            char *line_id = gen_printf("line:n%zu-%zu", n, l);
+
+            fprintf(csv, "%s,", line_id);
+            if (has_substitution) {
+                fprintf(csv, "Character %zu: line number %zu has {0} coins", line % 7, line);
+            } else {
+                write_csv_text(csv, line);
+            }
+            fprintf(csv, ",%s,%s,%zu\n", file_name, node_name, l + 3);
+
+            if (has_substitution) {
+                Yarn__Instruction *push = emit(&b, YARN__INSTRUCTION__OP_CODE__PUSH_FLOAT, 1);
+                push->operands[0] = op_float((float)(line % 100));
+            }
+
+            if (l < option_from) {
+                Yarn__Instruction *run = emit(&b, YARN__INSTRUCTION__OP_CODE__RUN_LINE, has_substitution ? 2 : 1);
+                run->operands[0] = op_string(line_id);
+                if (has_substitution) run->operands[1] = op_float(1);
+            } else {
+                Yarn__Instruction *add = emit(&b, YARN__INSTRUCTION__OP_CODE__ADD_OPTION, 4);
+                add->operands[0] = op_string(line_id);
+                add->operands[1] = op_string(gen_printf("L%zushortcutoption_%s", l - option_from, node_name));
+                add->operands[2] = op_float(has_substitution ? 1 : 0);
+                add->operands[3] = op_bool(0);
+            }
+        }
+
+        if (option_from < lines_here) {
+            emit(&b, YARN__INSTRUCTION__OP_CODE__SHOW_OPTIONS, 0);
+            emit(&b, YARN__INSTRUCTION__OP_CODE__JUMP, 0);
+
+            for (size_t o = 0; o < lines_here - option_from; ++o) {
+                label(&b, gen_printf("L%zushortcutoption_%s", o, node_name));
+                emit(&b, YARN__INSTRUCTION__OP_CODE__POP, 0);
+                Yarn__Instruction *jump = emit(&b, YARN__INSTRUCTION__OP_CODE__JUMP_TO, 1);
+                jump->operands[0] = op_string(end_label);
+            }
+        }
+
+        label(&b, end_label);
+        if (n + 1 < n_nodes) {
+            Yarn__Instruction *push = emit(&b, YARN__INSTRUCTION__OP_CODE__PUSH_STRING, 1);
+            push->operands[0] = op_string(gen_printf("Node%zu", n + 1));
+            emit(&b, YARN__INSTRUCTION__OP_CODE__RUN_NODE, 0);
+        } else {
+            emit(&b, YARN__INSTRUCTION__OP_CODE__STOP, 0);
+        }
+
+        Yarn__Node *node = (Yarn__Node *)gen_alloc(sizeof(Yarn__Node));
+        yarn__node__init(node);
+        node->name           = node_name;
+        node->n_instructions = b.used;
+        node->instructions   = b.entries;
+        node->n_labels       = b.n_labels;
+        node->labels         = b.labels;
+
+        Yarn__Program__NodesEntry *entry = (Yarn__Program__NodesEntry *)gen_alloc(sizeof(Yarn__Program__NodesEntry));
+        yarn__program__nodes_entry__init(entry);
+        entry->key   = node_name;
+        entry->value = node;
+        program.nodes[n] = entry;
+
+        total_instrs += b.used;
+    }
+    fclose(csv);
+
+    size_t packed_size = yarn__program__get_packed_size(&program);
+    uint8_t *packed = (uint8_t *)gen_alloc(packed_size);
+    yarn__program__pack(&program, packed);
+
+    snprintf(path, sizeof(path), "%s.yarnc", prefix);
+    FILE *yarnc = fopen(path, "wb");
+    if (!yarnc) {
+        fprintf(stderr, "could not open %s\n", path);
+        return 1;
+    }
+    fwrite(packed, 1, packed_size, yarnc);
+    fclose(yarnc);
+
+    printf("%s: %zu nodes, %zu instructions, %zu lines (%zu bytes yarnc)\n",
+           prefix, n_nodes, total_instrs, line_counter, packed_size);
+    return 0;
+}
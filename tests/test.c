@@ -4,6 +4,9 @@
 #include "yarn_c99.h"
 #include "utest.h"
 
+#include <float.h>
+#include <math.h>
+
 typedef struct {
     int a;
     int b;
@@ -124,7 +127,7 @@ UTEST(kvmap, normal_usage) {
         yarn_kvpush(&kvmap, e[i].key, e[i].value);
     }
     ASSERT_TRUE(kvmap.used == 5);
-    ASSERT_TRUE(kvmap.capacity == 3 * 2);
+    ASSERT_TRUE(kvmap.capacity == 4 * 2); /* 3 is rounded up to a power of two. */
 
     for (int i = 0; i < YARN_LEN(e); ++i) {
         ASSERT_TRUE(yarn_kvhas(&kvmap, e[i].key));
@@ -146,6 +149,132 @@ UTEST(kvmap, normal_usage) {
     yarn_kvdestroy(&kvmap);
 }
 
+/* used / deleted agree with the control bytes, tail mirrors the front. */
+static int kvmap_consistent(yarn_kvmap *map) {
+    size_t used = 0, deleted = 0;
+    for (size_t i = 0; i < map->capacity; ++i) {
+        if (map->control[i] == YARN__KV_DELETED)   deleted++;
+        else if (map->control[i] != YARN__KV_EMPTY) used++;
+    }
+    for (size_t i = 0; i < YARN__KV_GROUP - 1; ++i) {
+        if (map->control[map->capacity + i] != map->control[i % map->capacity]) return 0;
+    }
+    return used == map->used && deleted == map->deleted;
+}
+
+UTEST(kvmap, delete_reinsert_churn) {
+    yarn_kvmap kvmap = yarn_kvcreate(int, 16);
+    int  reference[96];
+    char key[16];
+    for (int i = 0; i < 96; ++i) reference[i] = -1;
+
+    uint32_t random = 12345;
+    for (int step = 0; step < 20000; ++step) {
+        random = random * 1103515245u + 12345u;
+        int k = (int)((random >> 16) % 96);
+        snprintf(key, sizeof(key), "key_%d", k);
+
+        if (reference[k] != -1) {
+            ASSERT_EQ(yarn_kvdelete(&kvmap, key), 1);
+            reference[k] = -1;
+        } else {
+            int value = step;
+            yarn_kvpush(&kvmap, key, value);
+            reference[k] = step;
+        }
+
+        if (step % 97 == 0) {
+            ASSERT_TRUE(kvmap_consistent(&kvmap));
+            size_t present = 0;
+            for (int i = 0; i < 96; ++i) {
+                snprintf(key, sizeof(key), "key_%d", i);
+                int value = -1;
+                if (reference[i] == -1) {
+                    ASSERT_EQ(yarn_kvget(&kvmap, key, &value), -1);
+                } else {
+                    ASSERT_NE(yarn_kvget(&kvmap, key, &value), -1);
+                    ASSERT_EQ(value, reference[i]);
+                    present++;
+                }
+            }
+            ASSERT_EQ(kvmap.used, present);
+        }
+    }
+
+    /* tombstones are cleared by rehashing, map doesn't keep growing. */
+    EXPECT_LE(kvmap.capacity, 256u);
+    yarn_kvdestroy(&kvmap);
+}
+
+UTEST(kvmap, smaller_than_a_group) {
+    /* one bucket: every control byte of the group is that bucket. */
+    yarn_kvmap one = yarn_kvcreate(int, 1);
+    ASSERT_EQ(one.capacity, 1u);
+    int value = 7;
+    yarn_kvpush(&one, "only", value);
+    ASSERT_TRUE(kvmap_consistent(&one));
+    value = 0;
+    EXPECT_EQ(yarn_kvget(&one, "only", &value), 0);
+    EXPECT_EQ(value, 7);
+    EXPECT_EQ(yarn_kvget(&one, "other", &value), -1);
+    EXPECT_EQ(yarn_kvdelete(&one, "only"), 1);
+    EXPECT_EQ(yarn_kvget(&one, "only", &value), -1);
+    yarn_kvdestroy(&one);
+
+    /* two keys that both want the last bucket: the second wraps around to the first. */
+    char keys[3][16];
+    int  found = 0;
+    for (int i = 0; found < 3; ++i) {
+        snprintf(keys[found], sizeof(keys[found]), "wrap_%d", i);
+        if ((yarn__hashstr(keys[found], strlen(keys[found])) & 3) == 3) found++;
+    }
+
+    yarn_kvmap four = yarn_kvcreate(int, 4);
+    for (value = 0; value < 2; ++value) yarn_kvpush(&four, keys[value], value);
+    ASSERT_EQ(four.capacity, 4u);
+    EXPECT_EQ(yarn_kvget(&four, keys[0], &value), 3);
+    EXPECT_EQ(yarn_kvget(&four, keys[1], &value), 0);
+    EXPECT_EQ(value, 1);
+    EXPECT_EQ(yarn_kvget(&four, keys[2], &value), -1);
+
+    /* probe goes past the tombstone, across the tail. */
+    EXPECT_EQ(yarn_kvdelete(&four, keys[0]), 1);
+    ASSERT_TRUE(kvmap_consistent(&four));
+    EXPECT_EQ(yarn_kvget(&four, keys[1], &value), 0);
+    EXPECT_EQ(yarn_kvget(&four, keys[0], &value), -1);
+
+    /* reinsert takes the tombstone back. */
+    value = 2;
+    yarn_kvpush(&four, keys[2], value);
+    ASSERT_TRUE(kvmap_consistent(&four));
+    EXPECT_EQ(yarn_kvget(&four, keys[2], &value), 3);
+    EXPECT_EQ(value, 2);
+    EXPECT_EQ(four.deleted, 0u);
+    yarn_kvdestroy(&four);
+}
+
+UTEST(kvmap, hash_prefixed_keys) {
+    /* only length bytes are hashed, so keys don't need to be terminated. */
+    EXPECT_EQ(yarn__hashstr("line:abcdef", 6), yarn__hashstr("line:a", 6));
+    EXPECT_NE(yarn__hashstr("line:abcdef", 6), yarn__hashstr("line:abcdef", 11));
+
+    /* keys sharing a long prefix still spread over low bits (bucket) and high bits (tag). */
+    uint8_t buckets[64] = {0}, tags[128] = {0};
+    char key[64];
+    for (int i = 0; i < 1024; ++i) {
+        int length = snprintf(key, sizeof(key), "line:chapter_one_intro_%d", i);
+        uint32_t hash = yarn__hashstr(key, length);
+        buckets[hash & 63] = 1;
+        tags[hash >> 25] = 1;
+    }
+
+    int n_buckets = 0, n_tags = 0;
+    for (int i = 0; i < 64; ++i)  n_buckets += buckets[i];
+    for (int i = 0; i < 128; ++i) n_tags += tags[i];
+    EXPECT_EQ(n_buckets, 64);
+    EXPECT_EQ(n_tags, 128);
+}
+
 struct CSVParsing {
     yarn_string_table *t;
 };
@@ -202,6 +331,122 @@ UTEST_F(CSVParsing, removing_double_quotation) {
     EXPECT_EQ(strlen(parsed.text), sizeof("hey \"hello\" there") - 1);
 }
 
+UTEST_F(CSVParsing, quoted_fields) {
+    const char quotes[] = "id,text,file,node,lineNumber\r\n"
+                          "line:a,\"\"\"\"\"\"\"\"\"\",testfile,Start,1\r\n"  /* four escaped quotes */
+                          "\r\n"                                              /* empty line */
+                          "line:b,\"first\nsecond, \"\"third\"\"\",\"\",Start,2\n"
+                          "line:c,,,,";
+    ASSERT_TRUE(yarn__load_string_table(utest_fixture->t, (char*)quotes, sizeof(quotes)));
+    EXPECT_EQ(utest_fixture->t->table.used, 3);
+
+    yarn_parsed_entry parsed = {0};
+    EXPECT_NE(yarn_kvget(&utest_fixture->t->table, "line:a", &parsed), -1);
+    EXPECT_STREQ(parsed.text, "\"\"\"\"");
+
+    EXPECT_NE(yarn_kvget(&utest_fixture->t->table, "line:b", &parsed), -1);
+    EXPECT_STREQ(parsed.text, "first\nsecond, \"third\"");
+    EXPECT_STREQ(yarn_get_interned_string(utest_fixture->t, parsed.file), "");
+    EXPECT_EQ(parsed.line_number, 2);
+
+    EXPECT_NE(yarn_kvget(&utest_fixture->t->table, "line:c", &parsed), -1);
+    EXPECT_STREQ(parsed.text, "");
+    EXPECT_EQ(parsed.line_number, 0);
+}
+
+UTEST_F(CSVParsing, interned_file_and_node) {
+    const char table[] = "id,text,file,node,lineNumber\n"
+                         "line:a,a,first.yarn,Start,1\n"
+                         "line:b,b,first.yarn,Other,2\n"
+                         "line:c,c,second.yarn,Start,3\n";
+    ASSERT_TRUE(yarn__load_string_table(utest_fixture->t, (char*)table, sizeof(table)));
+    EXPECT_EQ(utest_fixture->t->interned.used, 4);
+
+    yarn_parsed_entry a = {0}, b = {0}, c = {0};
+    ASSERT_NE(yarn_kvget(&utest_fixture->t->table, "line:a", &a), -1);
+    ASSERT_NE(yarn_kvget(&utest_fixture->t->table, "line:b", &b), -1);
+    ASSERT_NE(yarn_kvget(&utest_fixture->t->table, "line:c", &c), -1);
+
+    EXPECT_EQ(a.file, b.file);
+    EXPECT_NE(a.file, c.file);
+    EXPECT_EQ(a.node, c.node);
+    EXPECT_EQ(a.node, yarn_find_interned_string(utest_fixture->t, "Start"));
+    EXPECT_STREQ(yarn_get_interned_string(utest_fixture->t, b.node), "Other");
+    EXPECT_STREQ(yarn_get_interned_string(utest_fixture->t, c.file), "second.yarn");
+
+    EXPECT_EQ(yarn_find_interned_string(utest_fixture->t, "Missing"), -1);
+    EXPECT_TRUE(yarn_get_interned_string(utest_fixture->t, 4) == 0);
+}
+
+UTEST_F(CSVParsing, reordered_and_extra_columns) {
+    const char table[] = "lock,node,comment,text,id,lineNumber,file\n"
+                         "abc,Start,\"some, comment\",hello,line:a,4,first.yarn\n";
+    ASSERT_TRUE(yarn__load_string_table(utest_fixture->t, (char*)table, sizeof(table)));
+
+    yarn_parsed_entry parsed = {0};
+    ASSERT_NE(yarn_kvget(&utest_fixture->t->table, "line:a", &parsed), -1);
+    EXPECT_STREQ(parsed.text, "hello");
+    EXPECT_STREQ(yarn_get_interned_string(utest_fixture->t, parsed.file), "first.yarn");
+    EXPECT_STREQ(yarn_get_interned_string(utest_fixture->t, parsed.node), "Start");
+    EXPECT_EQ(parsed.line_number, 4);
+}
+
+UTEST_F(CSVParsing, projected_columns) {
+    const char table[] = "id,text,file,node,lineNumber\nline:a,hello,first.yarn,Start,4\n";
+    utest_fixture->t->columns = YARN_COLUMN_TEXT;
+    ASSERT_TRUE(yarn__load_string_table(utest_fixture->t, (char*)table, sizeof(table)));
+
+    yarn_parsed_entry parsed = {0};
+    ASSERT_NE(yarn_kvget(&utest_fixture->t->table, "line:a", &parsed), -1);
+    EXPECT_STREQ(parsed.text, "hello");
+    EXPECT_EQ(parsed.file, -1);
+    EXPECT_EQ(parsed.node, -1);
+    EXPECT_EQ(parsed.line_number, 0);
+    EXPECT_EQ(utest_fixture->t->interned.used, 0);
+}
+
+UTEST_F(CSVParsing, should_fail_without_id_column) {
+    const char no_id[]     = "text,file,node,lineNumber\nhello,first.yarn,Start,4\n";
+    const char twice_id[]  = "id,text,id\nline:a,hello,line:b\n";
+    const char too_many[]  = "id,text\nline:a,hello,extra\n";
+    EXPECT_FALSE(yarn__load_string_table(utest_fixture->t, (char*)no_id, sizeof(no_id)));
+    EXPECT_FALSE(yarn__load_string_table(utest_fixture->t, (char*)twice_id, sizeof(twice_id)));
+    EXPECT_FALSE(yarn__load_string_table(utest_fixture->t, (char*)too_many, sizeof(too_many)));
+}
+
+UTEST_F(CSVParsing, should_fail_on_unclosed_quote) {
+    const char unclosed[] = "id,text,file,node,lineNumber\nline:a,\"hey hello there,testfile,Start,10";
+    ASSERT_FALSE(yarn__load_string_table(utest_fixture->t, (char*)unclosed, sizeof(unclosed)));
+}
+
+UTEST(csv_scan, finds_structural_at_every_offset) {
+    /* crosses every 16 / 32 byte block boundary, and the scalar tail. */
+    const char structural[] = { ',', '\r', '\n', '\0' };
+    char buffer[96];
+
+    for (int s = 0; s < YARN_LEN(structural); ++s) {
+        for (size_t at = 0; at < sizeof(buffer); ++at) {
+            memset(buffer, 'a', sizeof(buffer));
+            buffer[at] = structural[s];
+            ASSERT_EQ(yarn__csv_scan_unquoted(buffer, sizeof(buffer)), at);
+            ASSERT_EQ(yarn__csv_scan_unquoted(buffer, at), at); /* not found */
+        }
+    }
+
+    for (size_t at = 0; at < sizeof(buffer); ++at) {
+        memset(buffer, ',', sizeof(buffer));
+        for (size_t i = 0; i < sizeof(buffer); i += 3) buffer[i] = '\n';
+        buffer[at] = '"';
+
+        int expect_lines = 0;
+        for (size_t i = 0; i < at; ++i) expect_lines += (buffer[i] == '\n');
+
+        int lines = 0;
+        ASSERT_EQ(yarn__csv_scan_quoted(buffer, sizeof(buffer), &lines), at);
+        ASSERT_EQ(lines, expect_lines);
+    }
+}
+
 struct Allocator {
     yarn_allocator t;
 };
@@ -250,4 +495,1329 @@ UTEST_F(Allocator, another_chunk) {
     }
 }
 
+static char *read_entire_file(const char *file_name, size_t *bytes_read) {
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp) return 0;
+
+    fseek(fp, 0, SEEK_END);
+    size_t filesize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char *result = (char *)calloc(filesize + 1, 1);
+    size_t read = fread(result, 1, filesize, fp);
+    fclose(fp);
+
+    *bytes_read = read;
+    return result;
+}
+
+UTEST(lazy_string_table, matches_eager_table) {
+    size_t size = 0;
+    char *csv = read_entire_file("yarn-c/SuperVariables/SuperVariables.csv", &size);
+    ASSERT_TRUE(csv != 0);
+
+    yarn_string_table *eager = yarn_create_string_table();
+    yarn_string_table *lazy  = yarn_create_string_table();
+    yarn_string_table *lru   = yarn_create_string_table();
+    lazy->lazy = 1;
+    lru->lazy  = 1;
+    lru->lazy_cache_lines = 2;
+
+    ASSERT_TRUE(yarn__load_string_table(eager, csv, size + 1));
+    ASSERT_TRUE(yarn__load_string_table(lazy,  csv, size + 1));
+    ASSERT_TRUE(yarn__load_string_table(lru,   csv, size + 1));
+    EXPECT_FALSE(yarn__load_string_table(lazy, csv, size + 1)); /* only once */
+
+    /* twice, so the second round goes through decoded / evicted texts. */
+    for (int round = 0; round < 2; ++round) {
+        char *key = 0;
+        yarn_parsed_entry entry = {0};
+        yarn_kvforeach(&eager->table, &key, &entry) {
+            EXPECT_STREQ(yarn_get_line_text(lazy, key), entry.text);
+            EXPECT_STREQ(yarn_get_line_text(lru, key), entry.text);
+        }
+    }
+    EXPECT_EQ(lru->lazy_used, 2);
+    EXPECT_TRUE(yarn_get_line_text(lazy, "line:missing") == 0);
+
+    yarn_destroy_string_table(eager);
+    yarn_destroy_string_table(lazy);
+    yarn_destroy_string_table(lru);
+    free(csv); /* lazy tables borrow it until here. */
+}
+
+UTEST(lazy_string_table, unescapes_on_demand) {
+    const char csv[] = "id,text,file,node,lineNumber\n"
+                       "line:a,\"say \"\"hi\"\", ok\",f,Start,1\n"
+                       "line:b,plain,f,Start,2\n"
+                       "line:c,\"\",f,Start,3";
+    yarn_string_table *lru = yarn_create_string_table();
+    lru->lazy = 1;
+    lru->lazy_cache_lines = 1;
+    ASSERT_TRUE(yarn__load_string_table(lru, (char *)csv, sizeof(csv)));
+
+    EXPECT_STREQ(yarn_get_line_text(lru, "line:a"), "say \"hi\", ok");
+    EXPECT_STREQ(yarn_get_line_text(lru, "line:b"), "plain");
+    EXPECT_STREQ(yarn_get_line_text(lru, "line:c"), "");
+    EXPECT_STREQ(yarn_get_line_text(lru, "line:a"), "say \"hi\", ok");
+    yarn_destroy_string_table(lru);
+}
+
+UTEST(locale_manager, switches_within_budget) {
+    const char en[] = "id,text,file,node,lineNumber\nline:a,hello,f,Start,1\n";
+    const char fr[] = "id,text,file,node,lineNumber\nline:a,bonjour,f,Start,1\n";
+    const char de[] = "id,text,file,node,lineNumber\nline:a,hallo,f,Start,1\n";
+
+    yarn_variable_storage storage = yarn_create_default_storage();
+    yarn_dialogue *dialogue = yarn_create_dialogue(storage);
+
+    /* measure one table, and allow two of them. */
+    yarn_locale_manager *probe = yarn_create_locale_manager(0);
+    ASSERT_TRUE(yarn_add_locale(probe, "en", en, sizeof(en)));
+    ASSERT_TRUE(yarn_load_locale(probe, "en"));
+    size_t one_table = probe->resident_bytes;
+    yarn_destroy_locale_manager(probe);
+
+    yarn_locale_manager *locales = yarn_create_locale_manager(one_table * 2 + one_table / 2);
+    ASSERT_TRUE(yarn_add_locale(locales, "en", en, sizeof(en)));
+    ASSERT_TRUE(yarn_add_locale(locales, "fr", fr, sizeof(fr)));
+    ASSERT_TRUE(yarn_add_locale(locales, "de", de, sizeof(de)));
+    EXPECT_FALSE(yarn_add_locale(locales, "de", de, sizeof(de)));
+    EXPECT_FALSE(yarn_switch_locale(locales, dialogue, "jp"));
+
+    ASSERT_TRUE(yarn_switch_locale(locales, dialogue, "en"));
+    EXPECT_STREQ(yarn_get_line_text(dialogue->strings, "line:a"), "hello");
+    EXPECT_STREQ(dialogue->strings->locale, "en");
+
+    ASSERT_TRUE(yarn_load_locale(locales, "fr"));
+    ASSERT_TRUE(yarn_switch_locale(locales, dialogue, "fr"));
+    EXPECT_STREQ(yarn_get_line_text(dialogue->strings, "line:a"), "bonjour");
+    EXPECT_TRUE(yarn_get_locale_table(locales, "en") != 0);
+
+    /* third one doesn't fit: least recently used (en) goes, current (fr) stays. */
+    ASSERT_TRUE(yarn_load_locale(locales, "de"));
+    EXPECT_TRUE(yarn_get_locale_table(locales, "en") == 0);
+    EXPECT_TRUE(yarn_get_locale_table(locales, "fr") == dialogue->strings);
+    EXPECT_LE(locales->resident_bytes, locales->memory_budget);
+
+    EXPECT_FALSE(yarn_unload_locale(locales, "fr"));
+    ASSERT_TRUE(yarn_switch_locale(locales, dialogue, "en"));
+    EXPECT_STREQ(yarn_get_line_text(dialogue->strings, "line:a"), "hello");
+
+    /* line on screen keeps its table resident, even past the budget. */
+    yarn_line shown = {0};
+    shown.id         = "line:a";
+    shown.line_index = -1;
+    yarn_string_table *en_table = dialogue->strings;
+    const yarn_formatted_line *formatted = yarn_acquire_formatted_line(en_table, &shown);
+    ASSERT_TRUE(yarn_load_locale(locales, "de"));
+    ASSERT_TRUE(yarn_switch_locale(locales, dialogue, "fr"));
+    EXPECT_TRUE(yarn_get_locale_table(locales, "en") == en_table);
+    EXPECT_FALSE(yarn_unload_locale(locales, "en"));
+    EXPECT_STREQ(formatted->text, "hello");
+    yarn_release_formatted_line(en_table, formatted);
+    EXPECT_TRUE(yarn_unload_locale(locales, "en"));
+    EXPECT_LE(locales->resident_bytes, locales->memory_budget);
+
+    /* tables that grew since they were loaded are measured again. */
+    yarn_locale_manager *growing = yarn_create_locale_manager(0);
+    growing->format_cache_lines = 4;
+    ASSERT_TRUE(yarn_add_locale(growing, "en", en, sizeof(en)));
+    ASSERT_TRUE(yarn_add_locale(growing, "fr", fr, sizeof(fr)));
+    ASSERT_TRUE(yarn_load_locale(growing, "en"));
+    size_t loaded = growing->resident_bytes;
+
+    yarn_line line = {0};
+    line.id         = "line:a";
+    line.line_index = -1;
+    yarn_string_table *table = yarn_get_locale_table(growing, "en");
+    yarn_release_formatted_line(table, yarn_acquire_formatted_line(table, &line));
+    ASSERT_TRUE(yarn_load_locale(growing, "fr"));
+    EXPECT_GT(growing->locales.entries[0].bytes, loaded);
+    yarn_destroy_locale_manager(growing);
+
+    yarn_destroy_locale_manager(locales);
+    yarn_destroy_dialogue(dialogue);
+    yarn_destroy_default_storage(storage);
+}
+
+static void expect_same_tables(int *utest_result, yarn_string_table *expected, yarn_string_table *actual) {
+    EXPECT_EQ(actual->table.used, expected->table.used);
+
+    char *key = 0;
+    yarn_parsed_entry entry = {0}, other = {0};
+    yarn_kvforeach(&expected->table, &key, &entry) {
+        ASSERT_NE(yarn_kvget(&actual->table, key, &other), -1);
+        EXPECT_STREQ(other.text, entry.text);
+        EXPECT_STREQ(yarn_get_interned_string(actual, other.node), yarn_get_interned_string(expected, entry.node));
+        EXPECT_EQ(other.line_number, entry.line_number);
+    }
+}
+
+UTEST(string_table_feed, any_chunk_size) {
+    const char csv[] = "id,text,file,node,lineNumber\r\n"
+                       "line:a,\"a \"\"quoted\"\", multi\r\nline\",f.yarn,Start,1\r\n"
+                       "line:b,plain,f.yarn,Start,2\r\n"
+                       "line:c,\"\"\"\"\"\",f.yarn,Other,3";
+
+    yarn_string_table *whole = yarn_create_string_table();
+    ASSERT_TRUE(yarn__load_string_table(whole, (char *)csv, sizeof(csv)));
+
+    for (size_t chunk = 1; chunk < sizeof(csv); ++chunk) {
+        yarn_string_table *fed = yarn_create_string_table();
+        for (size_t at = 0; at < sizeof(csv) - 1; at += chunk) {
+            size_t left = sizeof(csv) - 1 - at;
+            ASSERT_TRUE(yarn_string_table_feed(fed, csv + at, left < chunk ? left : chunk));
+        }
+        ASSERT_TRUE(yarn_string_table_finish(fed));
+        expect_same_tables(utest_result, whole, fed);
+        yarn_destroy_string_table(fed);
+    }
+
+    yarn_destroy_string_table(whole);
+}
+
+UTEST(string_table_feed, matches_whole_load) {
+    size_t size = 0;
+    char *csv = read_entire_file("yarn-c/SuperVariables/SuperVariables.csv", &size);
+    ASSERT_TRUE(csv != 0);
+
+    yarn_string_table *whole = yarn_create_string_table();
+    yarn_string_table *fed   = yarn_create_string_table();
+    ASSERT_TRUE(yarn__load_string_table(whole, csv, size + 1));
+
+    for (size_t at = 0; at < size; at += 7) {
+        ASSERT_TRUE(yarn_string_table_feed(fed, csv + at, (size - at) < 7 ? (size - at) : 7));
+    }
+    ASSERT_TRUE(yarn_string_table_finish(fed));
+    expect_same_tables(utest_result, whole, fed);
+
+    /* unfinished feed is dropped with the table. */
+    yarn_string_table *unfinished = yarn_create_string_table();
+    ASSERT_TRUE(yarn_string_table_feed(unfinished, csv, size / 2));
+    yarn_destroy_string_table(unfinished);
+
+    yarn_destroy_string_table(whole);
+    yarn_destroy_string_table(fed);
+    free(csv);
+}
+
+UTEST(compressed_string_table, codec_round_trip) {
+    enum { N = 3 * 4096 };
+    static uint8_t raw[N], packed[N + N / 255 + 16], unpacked[N];
+
+    /* repetitive with long (overlapping) matches, then texty, then noise. */
+    for (int i = 0; i < N / 3; ++i) raw[i] = (uint8_t)"abc"[i % 3];
+    for (int i = N / 3; i < 2 * N / 3; ++i) raw[i] = (uint8_t)"Character 3: line number "[i % 25] + (i / 1000);
+    uint32_t seed = 12345;
+    for (int i = 2 * N / 3; i < N; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        raw[i] = (uint8_t)(seed >> 16);
+    }
+
+    size_t lengths[] = { 0, 1, 3, 4, 5, 16, 300, N / 3, N };
+    for (size_t l = 0; l < YARN_LEN(lengths); ++l) {
+        size_t size = yarn__lz_compress(raw, lengths[l], packed);
+        ASSERT_LE(size, yarn__lz_bound(lengths[l]));
+        memset(unpacked, 0, sizeof(unpacked));
+        ASSERT_TRUE(yarn__lz_decompress(packed, size, unpacked, lengths[l]));
+        EXPECT_EQ(memcmp(unpacked, raw, lengths[l]), 0);
+    }
+    EXPECT_LT(yarn__lz_compress(raw, N / 3, packed), (size_t)64);
+
+    /* truncated block is rejected, not overrun. */
+    size_t size = yarn__lz_compress(raw, N, packed);
+    EXPECT_FALSE(yarn__lz_decompress(packed, size - 1, unpacked, N));
+}
+
+UTEST(compressed_string_table, matches_eager_table) {
+    /* enough lines for several blocks, more than the block cache holds. */
+    size_t capacity = 256 * 1024, size = 0;
+    char *csv = (char *)malloc(capacity);
+    size += sprintf(csv, "id,text,file,node,lineNumber\n");
+    for (int i = 0; i < 3000; ++i) {
+        if (i % 3 == 0) size += sprintf(csv + size, "line:%d,\"Sally: \"\"line\"\", number %d\",f.yarn,Node%d,%d\n", i, i, i / 10, i);
+        else            size += sprintf(csv + size, "line:%d,Ship: plain line number %d,f.yarn,Node%d,%d\n", i, i, i / 10, i);
+    }
+
+    yarn_string_table *eager      = yarn_create_string_table();
+    yarn_string_table *compressed = yarn_create_string_table();
+    yarn_string_table *fed        = yarn_create_string_table();
+    compressed->compress = 1;
+    fed->compress        = 1;
+
+    ASSERT_TRUE(yarn__load_string_table(eager,      csv, size + 1));
+    ASSERT_TRUE(yarn__load_string_table(compressed, csv, size + 1));
+    for (size_t at = 0; at < size; at += 1000) {
+        ASSERT_TRUE(yarn_string_table_feed(fed, csv + at, (size - at) < 1000 ? (size - at) : 1000));
+    }
+    ASSERT_TRUE(yarn_string_table_finish(fed));
+    EXPECT_GT(compressed->text_blocks.used, (size_t)YARN_TEXT_BLOCK_CACHE);
+    EXPECT_LT(compressed->compressed_text.used, size / 2);
+
+    for (int round = 0; round < 2; ++round) {
+        char *key = 0;
+        yarn_parsed_entry entry = {0};
+        yarn_kvforeach(&eager->table, &key, &entry) {
+            EXPECT_STREQ(yarn_get_line_text(compressed, key), entry.text);
+            EXPECT_STREQ(yarn_get_line_text(fed, key), entry.text);
+        }
+    }
+    EXPECT_TRUE(yarn_get_line_text(compressed, "line:missing") == 0);
+
+    yarn_string_table *both = yarn_create_string_table();
+    both->compress = 1;
+    both->lazy     = 1;
+    EXPECT_FALSE(yarn__load_string_table(both, csv, size + 1));
+
+    yarn_destroy_string_table(both);
+    yarn_destroy_string_table(eager);
+    yarn_destroy_string_table(compressed);
+    yarn_destroy_string_table(fed);
+    free(csv);
+}
+
+UTEST(frozen_string_table, finds_every_line_in_one_probe) {
+    size_t capacity = 256 * 1024, size = 0;
+    char *csv = (char *)malloc(capacity);
+    size += sprintf(csv, "id,text,file,node,lineNumber\n");
+    for (int i = 0; i < 3001; ++i) {
+        size += sprintf(csv + size, "line:%08x,text %d,f.yarn,Node%d,%d\n", i * 2654435761u, i, i / 10, i);
+    }
+
+    yarn_string_table *table  = yarn_create_string_table();
+    yarn_string_table *frozen = yarn_create_string_table();
+    frozen->compress = 1;
+    ASSERT_TRUE(yarn__load_string_table(table,  csv, size + 1));
+    ASSERT_TRUE(yarn__load_string_table(frozen, csv, size + 1));
+    ASSERT_TRUE(yarn_freeze_string_table(frozen));
+    ASSERT_EQ(frozen->frozen.n_lines, (uint32_t)3001);
+
+    /* minimal: every line owns exactly one slot. */
+    char *seen = (char *)calloc(frozen->table.capacity, 1);
+    for (uint32_t s = 0; s < frozen->frozen.n_lines; ++s) {
+        EXPECT_FALSE(seen[frozen->frozen.slots[s]]);
+        seen[frozen->frozen.slots[s]] = 1;
+    }
+    free(seen);
+
+    char *key = 0;
+    yarn_parsed_entry entry = {0};
+    yarn_kvforeach(&table->table, &key, &entry) {
+        EXPECT_STREQ(yarn_get_line_text(frozen, key), entry.text);
+    }
+    EXPECT_TRUE(yarn_get_line_text(frozen, "line:missing") == 0);
+    EXPECT_TRUE(yarn_get_line_text(frozen, "") == 0);
+
+    EXPECT_FALSE(yarn__load_string_table(frozen, csv, size + 1));
+    EXPECT_FALSE(yarn_string_table_feed(frozen, csv, size));
+
+    yarn_destroy_string_table(table);
+    yarn_destroy_string_table(frozen);
+    free(csv);
+}
+
+UTEST(format_line, into_caller_buffer) {
+    char csv[] = "id,text,file,node,lineNumber\n"
+                 "line:a,{0} has {1} coins.,f,Start,1\n"
+                 "line:b,no substitution,f,Start,2\n"
+                 "line:c,{x} {9} {} {1,f,Start,3\n";
+    yarn_string_table *table = yarn_create_string_table();
+    ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+
+    yarn_value values[] = { yarn_string("Sally"), yarn_float(12) };
+    yarn_line line = {0};
+    line.id = "line:a";
+    line.line_index = -1;
+    line.substitutions   = values;
+    line.n_substitutions = 2;
+
+    /* character right after `}` is kept. */
+    char buffer[64];
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, sizeof(buffer)), 19);
+    EXPECT_STREQ(buffer, "Sally has 12 coins.");
+
+    /* measuring, then cut short like snprintf. */
+    EXPECT_EQ(yarn_format_line_into(table, &line, 0, 0), 19);
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, 8), 19);
+    EXPECT_STREQ(buffer, "Sally h");
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, 20), 19);
+    EXPECT_STREQ(buffer, "Sally has 12 coins.");
+
+    char *allocated = yarn_convert_to_displayable_line(table, &line);
+    EXPECT_STREQ(allocated, "Sally has 12 coins.");
+    yarn_destroy_displayable_line(allocated);
+
+    line.id = "line:b";
+    line.n_substitutions = 0;
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, 4), 15);
+    EXPECT_STREQ(buffer, "no ");
+
+    /* what isn't a placeholder stays as it is. */
+    line.id = "line:c";
+    line.n_substitutions = 2;
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, sizeof(buffer)), 13);
+    EXPECT_STREQ(buffer, "{x} {9} {} {1");
+
+    line.id = "line:missing";
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, sizeof(buffer)), -1);
+
+    yarn_destroy_string_table(table);
+}
+
+UTEST(format_line, compiled_templates) {
+    char csv[] = "id,text,file,node,lineNumber\n"
+                 "line:a,{0} has {1} coins.,f,Start,1\n"
+                 "line:b,no substitution,f,Start,2\n"
+                 "line:c,{x} {1} {,f,Start,3\n";
+
+    for (int compress = 0; compress < 2; ++compress) {
+        yarn_string_table *table = yarn_create_string_table();
+        table->compress = compress;
+        ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+
+        yarn_parsed_entry entry;
+        ASSERT_NE(yarn_kvget(&table->table, "line:a", &entry), -1);
+        ASSERT_TRUE(entry.format != 0);
+        EXPECT_EQ(entry.format->n_segments, 4u);
+        EXPECT_EQ(entry.format->literal_length, 12u); /* " has ", " coins." */
+        EXPECT_EQ(entry.format->segments[0].slot, 0);
+        EXPECT_EQ(entry.format->segments[1].slot, -1);
+        EXPECT_EQ(entry.format->segments[2].slot, 1);
+        EXPECT_EQ(entry.format->segments[3].slot, -1);
+
+        ASSERT_NE(yarn_kvget(&table->table, "line:b", &entry), -1);
+        EXPECT_TRUE(entry.format == 0);
+
+        /* malformed ones are literal; `{1}` is still a slot. */
+        ASSERT_NE(yarn_kvget(&table->table, "line:c", &entry), -1);
+        ASSERT_TRUE(entry.format != 0);
+        EXPECT_EQ(entry.format->n_segments, 3u);
+
+        yarn_value values[] = { yarn_string("Sally"), yarn_float(12) };
+        yarn_line line = {0};
+        line.id = "line:a";
+        line.line_index = -1;
+        line.substitutions   = values;
+        line.n_substitutions = 2;
+
+        char buffer[64];
+        EXPECT_EQ(yarn_format_line_into(table, &line, buffer, sizeof(buffer)), 19);
+        EXPECT_STREQ(buffer, "Sally has 12 coins.");
+        EXPECT_EQ(yarn_format_line_into(table, &line, buffer, 10), 19);
+        EXPECT_STREQ(buffer, "Sally has");
+
+        line.id = "line:c";
+        EXPECT_EQ(yarn_format_line_into(table, &line, buffer, sizeof(buffer)), 8);
+        EXPECT_STREQ(buffer, "{x} 12 {");
+
+        /* slot with no substitution is written as is. */
+        line.n_substitutions = 1;
+        char *allocated = yarn_convert_to_displayable_line(table, &line);
+        EXPECT_STREQ(allocated, "{x} {1} {");
+        yarn_destroy_displayable_line(allocated);
+
+        yarn_destroy_string_table(table);
+    }
+}
+
+UTEST(format_line, markup_spans) {
+    char csv[] = "id,text,file,node,lineNumber\n"
+                 "line:a,\"Sally: I have [b]{0}[/b] [wave size=2 speed=1.5 name=\"\"big one\"\"]coins[/wave]!\",f,Start,1\n"
+                 "line:b,\"wait [pause=500/] now, \\[not markup\\] [nomarkup][b][/nomarkup]\",f,Start,2\n"
+                 "line:c,\"[i]open [u]both[/] [oops\",f,Start,3\n"
+                 "line:d,plain line,f,Start,4\n";
+
+    for (int compress = 0; compress < 2; ++compress) {
+        yarn_string_table *table = yarn_create_string_table();
+        table->markup   = 1;
+        table->compress = compress;
+        ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+
+        yarn_value values[] = { yarn_float(12) };
+        yarn_line line = {0};
+        line.id = "line:a";
+        line.line_index = -1;
+        line.substitutions   = values;
+        line.n_substitutions = 1;
+
+        char buffer[128];
+        yarn_markup_span spans[8];
+        int n_spans = 0;
+        EXPECT_EQ(yarn_format_line_markup_into(table, &line, buffer, sizeof(buffer), spans, 8, &n_spans), 23);
+        EXPECT_STREQ(buffer, "Sally: I have 12 coins!");
+        ASSERT_EQ(n_spans, 3);
+
+        /* implicit character attribute goes first. */
+        EXPECT_STREQ(spans[0].attribute->name, "character");
+        EXPECT_EQ(spans[0].position, 0u);
+        EXPECT_EQ(spans[0].length, 7u);
+
+        /* `b` covers the substitution, `wave` is moved by it. */
+        EXPECT_STREQ(spans[1].attribute->name, "b");
+        EXPECT_EQ(spans[1].position, 14u);
+        EXPECT_EQ(spans[1].length, 2u);
+        EXPECT_STREQ(spans[2].attribute->name, "wave");
+        EXPECT_EQ(spans[2].position, 17u);
+        EXPECT_EQ(spans[2].length, 5u);
+
+        const yarn_line_markup *markup = yarn_get_line_markup(table, &line);
+        ASSERT_TRUE(markup != 0);
+        EXPECT_EQ(markup->n_properties, 4u);
+        EXPECT_STREQ(markup->properties[spans[0].attribute->first_property].value, "Sally");
+        yarn_markup_property *properties = &markup->properties[spans[2].attribute->first_property];
+        ASSERT_EQ(spans[2].attribute->n_properties, 3u);
+        EXPECT_EQ(properties[0].type, YARN_MARKUP_INTEGER);
+        EXPECT_EQ(properties[0].number, 2.0f);
+        EXPECT_EQ(properties[1].type, YARN_MARKUP_FLOAT);
+        EXPECT_STREQ(properties[2].value, "big one");
+        EXPECT_EQ(properties[2].type, YARN_MARKUP_STRING);
+
+        /* self closing eats the space after it; escaped and nomarkup brackets are text. */
+        line.id = "line:b";
+        EXPECT_EQ(yarn_format_line_markup_into(table, &line, buffer, sizeof(buffer), spans, 8, &n_spans), 26);
+        EXPECT_STREQ(buffer, "wait now, [not markup] [b]");
+        ASSERT_EQ(n_spans, 2);
+        EXPECT_STREQ(spans[0].attribute->name, "pause");
+        EXPECT_EQ(spans[0].position, 5u);
+        EXPECT_EQ(spans[0].length, 0u);
+        EXPECT_STREQ(spans[1].attribute->name, "nomarkup");
+        EXPECT_EQ(spans[1].length, 3u);
+
+        /* `[/]` closes both; broken marker is text. */
+        line.id = "line:c";
+        EXPECT_EQ(yarn_format_line_markup_into(table, &line, buffer, sizeof(buffer), spans, 8, &n_spans), 15);
+        EXPECT_STREQ(buffer, "open both [oops");
+        ASSERT_EQ(n_spans, 2);
+        EXPECT_EQ(spans[0].length, 9u);
+        EXPECT_EQ(spans[1].position, 5u);
+        EXPECT_EQ(spans[1].length, 4u);
+
+        line.id = "line:d";
+        EXPECT_TRUE(yarn_get_line_markup(table, &line) == 0);
+        EXPECT_EQ(yarn_format_line_markup_into(table, &line, buffer, sizeof(buffer), spans, 8, &n_spans), 10);
+        EXPECT_EQ(n_spans, 0);
+
+        yarn_destroy_string_table(table);
+    }
+}
+
+UTEST(format_line, format_functions) {
+    char csv[] = "id,text,file,node,lineNumber\n"
+                 "line:select,\"Select: [select value={0} male=\"\"he\"\" female=\"\"she\"\" other=\"\"they\"\"/]\",f,Start,1\n"
+                 "line:plural,\"[plural value={0} one=\"\"% coin\"\" other=\"\"% coins\"\"/] left\",f,Start,2\n"
+                 "line:ordinal,\"Mae: I came [b][ordinal value={0} one=\"\"%st\"\" two=\"\"%nd\"\" few=\"\"%rd\"\" other=\"\"%th\"\"/][/b]!\",f,Start,3\n"
+                 "line:broken,\"[select male=\"\"he\"\"/] {0}\",f,Start,4\n"
+                 "line:nomarkup,\"[nomarkup][plural value={0} one=\"\"coin\"\"/][/nomarkup] {0}\",f,Start,5\n";
+
+    yarn_string_table *table = yarn_create_string_table();
+    table->markup = 1;
+    ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+
+    yarn_value value = yarn_none();
+    yarn_line line = {0};
+    line.line_index = -1;
+    line.substitutions   = &value;
+    line.n_substitutions = 1;
+
+    char buffer[64];
+    line.id = "line:select";
+    value = yarn_string("female");
+    EXPECT_EQ(yarn_format_line_into(table, &line, buffer, sizeof(buffer)), 11);
+    EXPECT_STREQ(buffer, "Select: she");
+    value = yarn_string("robot");
+    yarn_format_line_into(table, &line, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "Select: they");
+
+    line.id = "line:plural";
+    value = yarn_float(1);
+    yarn_format_line_into(table, &line, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "1 coin left");
+    value = yarn_string("1.0");
+    yarn_format_line_into(table, &line, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "1.0 coins left");
+
+    /* markup around the function moves with what it becomes. */
+    const char *ordinals[][2] = { {"1", "1st"}, {"2", "2nd"}, {"3", "3rd"}, {"4", "4th"}, {"11", "11th"}, {"22", "22nd"}, {"113", "113th"} };
+    line.id = "line:ordinal";
+    for (int i = 0; i < 7; ++i) {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "Mae: I came %s!", ordinals[i][1]);
+        value = yarn_string((char *)ordinals[i][0]);
+
+        yarn_markup_span spans[4];
+        int n_spans = 0;
+        EXPECT_EQ(yarn_format_line_markup_into(table, &line, buffer, sizeof(buffer), spans, 4, &n_spans), (int)strlen(expected));
+        EXPECT_STREQ(buffer, expected);
+        ASSERT_EQ(n_spans, 2);
+        EXPECT_STREQ(spans[1].attribute->name, "b");
+        EXPECT_EQ(spans[1].position, 12u);
+        EXPECT_EQ(spans[1].length, (uint32_t)strlen(ordinals[i][1]));
+    }
+
+    /* function without value stays as text. */
+    line.id = "line:broken";
+    value = yarn_string("x");
+    yarn_format_line_into(table, &line, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "[select male=\"he\"/] x");
+
+    /* function in nomarkup is text too; placeholders still aren't. */
+    line.id = "line:nomarkup";
+    yarn_format_line_into(table, &line, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "[plural value=x one=\"coin\"/] x");
+
+    /* other locales. */
+    table->plurals = yarn_find_plural_rules("ru-RU");
+    line.id = "line:plural";
+    value = yarn_float(21);
+    yarn_format_line_into(table, &line, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "21 coin left");
+
+    const yarn_plural_rules *ru = yarn_find_plural_rules("ru");
+    EXPECT_EQ(yarn_plural_category(ru, "3", 0), YARN_PLURAL_FEW);
+    EXPECT_EQ(yarn_plural_category(ru, "12", 0), YARN_PLURAL_MANY);
+    EXPECT_EQ(yarn_plural_category(ru, "1.5", 0), YARN_PLURAL_OTHER);
+    const yarn_plural_rules *pl = yarn_find_plural_rules("pl");
+    EXPECT_EQ(yarn_plural_category(pl, "22", 0), YARN_PLURAL_FEW);
+    EXPECT_EQ(yarn_plural_category(pl, "12", 0), YARN_PLURAL_MANY);
+    const yarn_plural_rules *ar = yarn_find_plural_rules("ar_EG");
+    EXPECT_EQ(yarn_plural_category(ar, "0", 0), YARN_PLURAL_ZERO);
+    EXPECT_EQ(yarn_plural_category(ar, "105", 0), YARN_PLURAL_FEW);
+    EXPECT_EQ(yarn_plural_category(ar, "111", 0), YARN_PLURAL_MANY);
+    EXPECT_EQ(yarn_plural_category(yarn_find_plural_rules("fr"), "0", 0), YARN_PLURAL_ONE);
+    EXPECT_EQ(yarn_plural_category(yarn_find_plural_rules("it"), "8", 1), YARN_PLURAL_MANY);
+    EXPECT_EQ(yarn_plural_category(yarn_find_plural_rules("xx"), "1", 0), YARN_PLURAL_OTHER);
+    EXPECT_EQ(yarn_plural_category(yarn_find_plural_rules(0), "coins", 0), YARN_PLURAL_OTHER);
+
+    yarn_destroy_string_table(table);
+}
+
+UTEST(format_line, cached_lines) {
+    char csv[] = "id,text,file,node,lineNumber\n"
+                 "line:a,[b]{0}[/b] has {1} coins.,f,Start,1\n"
+                 "line:b,plain,f,Start,2\n";
+    yarn_string_table *table = yarn_create_string_table();
+    table->markup = 1;
+    table->format_cache_lines = 2;
+    ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+
+    char sally[] = "Sally";
+    yarn_value values[] = { yarn_string(sally), yarn_float(12) };
+    yarn_line line = {0};
+    line.id = "line:a";
+    line.line_index = -1;
+    line.substitutions   = values;
+    line.n_substitutions = 2;
+
+    const yarn_formatted_line *first = yarn_acquire_formatted_line(table, &line);
+    ASSERT_TRUE(first);
+    EXPECT_STREQ(first->text, "Sally has 12 coins.");
+    EXPECT_EQ(first->length, 19);
+    ASSERT_EQ(first->n_spans, 1);
+    EXPECT_EQ(first->spans[0].position, 0u);
+    EXPECT_EQ(first->spans[0].length, 5u);
+
+    /* same line, equal values (even from another buffer): same entry. */
+    char other_sally[] = "Sally";
+    values[0] = yarn_string(other_sally);
+    const yarn_formatted_line *again = yarn_acquire_formatted_line(table, &line);
+    EXPECT_TRUE(again == first);
+    yarn_release_formatted_line(table, again);
+
+    values[1] = yarn_float(13);
+    const yarn_formatted_line *thirteen = yarn_acquire_formatted_line(table, &line);
+    EXPECT_TRUE(thirteen != first);
+    EXPECT_STREQ(thirteen->text, "Sally has 13 coins.");
+    yarn_release_formatted_line(table, thirteen);
+    EXPECT_EQ(table->format_used, 2);
+
+    /* third line drops the least recently used one, but it's still acquired. */
+    yarn_line plain = {0};
+    plain.id = "line:b";
+    plain.line_index = -1;
+    const yarn_formatted_line *b = yarn_acquire_formatted_line(table, &plain);
+    EXPECT_STREQ(b->text, "plain");
+    EXPECT_EQ(b->n_spans, 0);
+    yarn_release_formatted_line(table, b);
+    EXPECT_EQ(table->format_used, 2);
+    EXPECT_STREQ(first->text, "Sally has 12 coins.");
+    yarn_release_formatted_line(table, first);
+
+    values[1] = yarn_float(12);
+    const yarn_formatted_line *refreshed = yarn_acquire_formatted_line(table, &line);
+    EXPECT_STREQ(refreshed->text, "Sally has 12 coins.");
+    yarn_release_formatted_line(table, refreshed);
+
+    plain.id = "line:missing";
+    EXPECT_TRUE(yarn_acquire_formatted_line(table, &plain) == 0);
+
+    /* growing the limit keeps what's cached; lowering it drops the least recently used. */
+    table->format_cache_lines = 40;
+    values[1] = yarn_float(13);
+    yarn_release_formatted_line(table, yarn_acquire_formatted_line(table, &line));
+    EXPECT_EQ(table->n_format_buckets, 64u);
+    EXPECT_EQ(table->format_used, 3);
+    values[1] = yarn_float(12);
+    table->format_cache_lines = 1;
+    refreshed = yarn_acquire_formatted_line(table, &line);
+    EXPECT_EQ(table->n_format_buckets, 16u);
+    EXPECT_EQ(table->format_used, 1);
+    EXPECT_TRUE(refreshed == yarn_acquire_formatted_line(table, &line));
+    yarn_release_formatted_line(table, refreshed);
+
+    /* loading would leave spans of acquired lines dangling. */
+    EXPECT_FALSE(yarn_string_table_feed(table, csv, sizeof(csv)));
+    yarn_release_formatted_line(table, refreshed);
+
+    /* without cache, every acquire formats anew. */
+    table->format_cache_lines = 0;
+    const yarn_formatted_line *x = yarn_acquire_formatted_line(table, &line);
+    const yarn_formatted_line *y = yarn_acquire_formatted_line(table, &line);
+    EXPECT_TRUE(x != y);
+    EXPECT_STREQ(y->text, "Sally has 12 coins.");
+    EXPECT_EQ(table->format_used, 0);
+    EXPECT_TRUE(table->format_buckets == 0);
+    yarn_release_formatted_line(table, x);
+    yarn_release_formatted_line(table, y);
+
+    yarn_destroy_string_table(table);
+}
+
+UTEST(format_number, shortest_round_trip) {
+    struct { float value; const char *text; } cases[] = {
+        { 3.0f, "3" }, { -3.0f, "-3" }, { 0.0f, "0" }, { 0.1f, "0.1" }, { 1.5f, "1.5" },
+        { 0.0001f, "0.0001" }, { 1e-6f, "1E-06" }, { 1e15f, "1E+15" },
+        { 123456.7f, "123456.7" }, { 123456789.0f, "123456790" },
+        { FLT_MAX, "3.4028235E+38" }, { 1.4e-45f, "1E-45" },
+    };
+    char buffer[32];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        yarn_format_number(cases[i].value, buffer, sizeof(buffer));
+        EXPECT_STREQ(buffer, cases[i].text);
+    }
+    yarn_format_number(NAN, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "NaN");
+    yarn_format_number(-INFINITY, buffer, sizeof(buffer));
+    EXPECT_STREQ(buffer, "-Infinity");
+
+    /* clips like snprintf. */
+    EXPECT_EQ(yarn_format_number(123.25f, buffer, 4), 6);
+    EXPECT_STREQ(buffer, "123");
+
+    /* every pattern reads back as the same float. */
+    uint32_t seed = 7;
+    for (int i = 0; i < 100000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t bits = seed ^ (seed >> 13);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0) continue;
+        yarn_format_number(value, buffer, sizeof(buffer));
+        float back = strtof(buffer, 0);
+        ASSERT_EQ(memcmp(&back, &value, sizeof(value)), 0);
+    }
+
+    yarn_value v = { YARN_VALUE_FLOAT };
+    v.values.v_float = 42;
+    char *text = yarn_tostring(v);
+    EXPECT_STREQ(text, "42");
+    yarn_free_tostring(text);
+}
+
+struct Chapters {
+    yarn_variable_storage storage;
+    yarn_dialogue *dialogue;
+};
+
+UTEST_F_SETUP(Chapters) {
+    utest_fixture->storage  = yarn_create_default_storage();
+    utest_fixture->dialogue = yarn_create_dialogue(utest_fixture->storage);
+    utest_fixture->dialogue->log_debug = 0;
+    utest_fixture->dialogue->log_error = 0;
+    utest_fixture->dialogue->node_start_handler = 0;
+}
+
+UTEST_F_TEARDOWN(Chapters) {
+    yarn_destroy_dialogue(utest_fixture->dialogue);
+    yarn_destroy_default_storage(utest_fixture->storage);
+}
+
+static int load_chapter_file(yarn_dialogue *dialogue, const char *name, const char *path) {
+    size_t size = 0;
+    char *bytes = read_entire_file(path, &size);
+    if (!bytes) return 0;
+
+    int r = yarn_load_chapter(dialogue, name, bytes, size);
+    free(bytes);
+    return r;
+}
+
+UTEST_F(Chapters, merged_node_index) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+    ASSERT_TRUE(load_chapter_file(dialogue, "example", "yarn-c/Example/Example.yarnc"));
+    ASSERT_TRUE(load_chapter_file(dialogue, "options", "yarn-c/Options/Options.yarnc"));
+    EXPECT_EQ(dialogue->chapters.used, 2);
+
+    EXPECT_NE(yarn_set_node(dialogue, "B"), -1);
+    EXPECT_EQ(dialogue->current_chapter, 1);
+    EXPECT_TRUE(dialogue->program == dialogue->chapters.entries[1].program);
+
+    EXPECT_NE(yarn_set_node(dialogue, "LearnMore"), -1);
+    EXPECT_EQ(dialogue->current_chapter, 0);
+
+    /* prefix of an existing node must not match. */
+    EXPECT_EQ(yarn_set_node(dialogue, "Learn"), -1);
+}
+
+UTEST_F(Chapters, conflicting_node_names) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+    ASSERT_TRUE(load_chapter_file(dialogue, "example", "yarn-c/Example/Example.yarnc"));
+
+    /* both defines `Start`. */
+    EXPECT_FALSE(load_chapter_file(dialogue, "basic", "yarn-c/Basic/Basic.yarnc"));
+    EXPECT_FALSE(load_chapter_file(dialogue, "example", "yarn-c/Options/Options.yarnc"));
+    EXPECT_EQ(dialogue->chapters.used, 1);
+
+    ASSERT_TRUE(yarn_unload_chapter(dialogue, "example"));
+    EXPECT_EQ(dialogue->chapters.used, 0);
+    EXPECT_FALSE(yarn_kvhas(&dialogue->node_index, "Start"));
+
+    ASSERT_TRUE(load_chapter_file(dialogue, "basic", "yarn-c/Basic/Basic.yarnc"));
+    EXPECT_NE(yarn_set_node(dialogue, "Start"), -1);
+}
+
+UTEST_F(Chapters, unload_reindexes) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+    ASSERT_TRUE(load_chapter_file(dialogue, "example", "yarn-c/Example/Example.yarnc"));
+    ASSERT_TRUE(load_chapter_file(dialogue, "options", "yarn-c/Options/Options.yarnc"));
+
+    ASSERT_TRUE(yarn_unload_chapter(dialogue, "example"));
+    EXPECT_FALSE(yarn_unload_chapter(dialogue, "example"));
+
+    EXPECT_EQ(yarn_set_node(dialogue, "Start"), -1);
+    EXPECT_NE(yarn_set_node(dialogue, "C"), -1);
+    EXPECT_EQ(dialogue->current_chapter, 0);
+}
+
+UTEST_F(Chapters, bound_line_indexes) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+    size_t size = 0;
+    char *csv = read_entire_file("yarn-c/Example/Example.csv", &size);
+    ASSERT_TRUE(csv != 0);
+
+    yarn_string_table *table = yarn_create_string_table();
+    ASSERT_TRUE(yarn_load_string_table(table, csv, size + 1));
+    ASSERT_TRUE(yarn_bind_string_table(dialogue, table));
+    EXPECT_TRUE(dialogue->strings == table);
+
+    /* bound as it loads. */
+    ASSERT_TRUE(load_chapter_file(dialogue, "example", "yarn-c/Example/Example.yarnc"));
+    ASSERT_GT(dialogue->line_ids.used, 0);
+    EXPECT_EQ(table->bound_lines.used, dialogue->line_ids.used);
+
+    /* every line instruction points at its own id. */
+    yarn_chapter *chapter = &dialogue->chapters.entries[0];
+    for (size_t n = 0; n < chapter->program->n_nodes; ++n) {
+        Yarn__Node *node = chapter->program->nodes[n]->value;
+        for (size_t i = 0; i < node->n_instructions; ++i) {
+            int index = chapter->line_indexes[n][i];
+            if (node->instructions[i]->opcode == YARN__INSTRUCTION__OP_CODE__RUN_LINE) {
+                ASSERT_NE(index, -1);
+                EXPECT_STREQ(dialogue->line_ids.entries[index], node->instructions[i]->operands[0]->string_value);
+            } else if (node->instructions[i]->opcode != YARN__INSTRUCTION__OP_CODE__ADD_OPTION) {
+                EXPECT_EQ(index, -1);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < dialogue->line_ids.used; ++i) {
+        EXPECT_STREQ(yarn_get_line_text_by_index(table, (int)i), yarn_get_line_text(table, dialogue->line_ids.entries[i]));
+    }
+
+    /* index is only trusted when id is the dialogue's own; otherwise id wins. */
+    yarn_line line = {0};
+    line.id = dialogue->line_ids.entries[1];
+    line.line_index = 0;
+    char *text = yarn_convert_to_displayable_line(table, &line);
+    EXPECT_STREQ(text, yarn_get_line_text(table, dialogue->line_ids.entries[1]));
+    yarn_destroy_displayable_line(text);
+
+    /* lines of options aren't in example's csv: reported once, at bind. */
+    ASSERT_TRUE(load_chapter_file(dialogue, "options", "yarn-c/Options/Options.yarnc"));
+    yarn_string_table *other = yarn_create_string_table();
+    ASSERT_TRUE(yarn_load_string_table(other, csv, size + 1));
+    EXPECT_FALSE(yarn_bind_string_table(dialogue, other));
+    EXPECT_EQ(other->bound_lines.used, dialogue->line_ids.used);
+    EXPECT_EQ(other->bound_lines.entries[dialogue->line_ids.used - 1].bucket, -1);
+    EXPECT_TRUE(yarn_get_line_text_by_index(other, (int)dialogue->line_ids.used - 1) == 0);
+
+    /* more lines move buckets around: binding is dropped. */
+    ASSERT_TRUE(yarn_load_string_table(table, csv, size + 1));
+    EXPECT_EQ(table->bound_lines.used, 0);
+    EXPECT_TRUE(table->bound_to == 0);
+
+    yarn_destroy_string_table(table);
+    yarn_destroy_string_table(other);
+    free(csv);
+}
+
+static yarn_value command_args[8];
+static int  command_calls;
+static int  command_n_args;
+static char command_text[64];
+
+static void record_command(yarn_dialogue *dialogue, yarn_value *args, int n_args) {
+    command_calls++;
+    command_n_args = n_args;
+    for (int i = 0; i < n_args && i < 8; ++i) {
+        command_args[i] = args[i];
+        /* strings only live during the call. */
+        if (args[i].type == YARN_VALUE_STRING) {
+            size_t length = strlen(args[i].values.v_string) + 1;
+            command_args[i].values.v_string = (char *)malloc(length);
+            memcpy(command_args[i].values.v_string, args[i].values.v_string, length);
+        }
+    }
+    yarn_continue(dialogue);
+}
+
+static void record_command_text(yarn_dialogue *dialogue, char *command) {
+    snprintf(command_text, sizeof(command_text), "%s", command);
+    yarn_continue(dialogue);
+}
+
+static void ignore_node(yarn_dialogue *dialogue, char *node_name) {}
+static void ignore_dialogue(yarn_dialogue *dialogue) {}
+static void ignore_lines(yarn_dialogue *dialogue, char **ids, int ids_count) {}
+
+static Yarn__Instruction *command_instruction(Yarn__Instruction__OpCode opcode, Yarn__Operand *a, Yarn__Operand *b) {
+    Yarn__Instruction *inst = (Yarn__Instruction *)calloc(1, sizeof(Yarn__Instruction));
+    yarn__instruction__init(inst);
+    inst->opcode     = opcode;
+    inst->n_operands = (a != 0) + (b != 0);
+    inst->operands   = (Yarn__Operand **)calloc(2, sizeof(void *));
+    inst->operands[0] = a;
+    inst->operands[1] = b;
+    return inst;
+}
+
+static Yarn__Operand *command_operand(int value_case, const char *s, float f) {
+    Yarn__Operand *op = (Yarn__Operand *)calloc(1, sizeof(Yarn__Operand));
+    yarn__operand__init(op);
+    op->value_case = (Yarn__Operand__ValueCase)value_case;
+    if (s) op->string_value = (char *)s;
+    else   op->float_value  = f;
+    return op;
+}
+
+UTEST_F(Chapters, registered_commands) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+
+    #define STR(s) command_operand(YARN__OPERAND__VALUE_STRING_VALUE, s, 0)
+    #define NUM(f) command_operand(YARN__OPERAND__VALUE_FLOAT_VALUE, 0, f)
+    Yarn__Instruction *instructions[] = {
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_FLOAT, NUM(7), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_STRING, STR("big"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_COMMAND, STR("move  Sally {0} -4.5 \"two \\\"words\" true {1}px {5}"), NUM(2)),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_COMMAND, STR("say \"a b\"c d"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_FLOAT, NUM(1.5f), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_COMMAND, STR("shake {0} now"), NUM(1)),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_COMMAND, STR("wait 1 2"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__STOP, 0, 0),
+    };
+    #undef STR
+    #undef NUM
+
+    Yarn__Node node;
+    yarn__node__init(&node);
+    node.name           = (char *)"Start";
+    node.n_instructions = sizeof(instructions) / sizeof(instructions[0]);
+    node.instructions   = instructions;
+
+    Yarn__Program__NodesEntry entry;
+    yarn__program__nodes_entry__init(&entry);
+    entry.key   = node.name;
+    entry.value = &node;
+    Yarn__Program__NodesEntry *entries[] = { &entry };
+
+    Yarn__Program program;
+    yarn__program__init(&program);
+    program.name    = (char *)"Commands";
+    program.n_nodes = 1;
+    program.nodes   = entries;
+
+    size_t size = yarn__program__get_packed_size(&program);
+    uint8_t *bytes = (uint8_t *)malloc(size);
+    yarn__program__pack(&program, bytes);
+    for (size_t i = 0; i < node.n_instructions; ++i) {
+        for (size_t o = 0; o < instructions[i]->n_operands; ++o) free(instructions[i]->operands[o]);
+        free(instructions[i]->operands);
+        free(instructions[i]);
+    }
+
+    ASSERT_TRUE(yarn_load_chapter(dialogue, "commands", bytes, size));
+    free(bytes);
+
+    yarn_command *move = dialogue->chapters.entries[0].commands[0][2];
+    ASSERT_TRUE(move);
+    EXPECT_STREQ(move->name, "move");
+    EXPECT_EQ(move->n_args, 7);
+    EXPECT_EQ(move->args[1].kind, YARN_COMMAND_ARG_SUBSTITUTION);
+    EXPECT_EQ(move->args[4].kind, YARN_COMMAND_ARG_VALUE);
+    EXPECT_EQ(move->args[5].kind, YARN_COMMAND_ARG_TEXT);
+    EXPECT_TRUE(dialogue->chapters.entries[0].commands[0][0] == 0);
+
+    /* what follows a closing quote stays in the token. */
+    yarn_command *say = dialogue->chapters.entries[0].commands[0][3];
+    ASSERT_TRUE(say);
+    EXPECT_EQ(say->n_args, 2);
+    EXPECT_STREQ(say->args[0].value.values.v_string, "a bc");
+    EXPECT_STREQ(say->args[1].value.values.v_string, "d");
+
+    EXPECT_TRUE(yarn_register_command(dialogue, "move", record_command, 7));
+    EXPECT_FALSE(yarn_register_command(dialogue, "move", record_command, 7));
+    EXPECT_TRUE(yarn_register_command(dialogue, "wait", record_command, 1));
+    dialogue->command_handler           = record_command_text;
+    dialogue->node_start_handler        = ignore_node;
+    dialogue->node_complete_handler     = ignore_node;
+    dialogue->dialogue_complete_handler = ignore_dialogue;
+    dialogue->prepare_for_lines_handler = ignore_lines;
+
+    command_calls = 0;
+    EXPECT_NE(yarn_set_node(dialogue, "Start"), -1);
+    yarn_continue(dialogue);
+
+    /* move ran with typed arguments, shake fell back to text, wait had wrong arity. */
+    EXPECT_EQ(command_calls, 1);
+    EXPECT_EQ(command_n_args, 7);
+    EXPECT_STREQ(command_args[6].values.v_string, "{5}");
+    EXPECT_EQ(command_args[0].type, YARN_VALUE_STRING);
+    EXPECT_STREQ(command_args[0].values.v_string, "Sally");
+    EXPECT_EQ(command_args[1].type, YARN_VALUE_FLOAT);
+    EXPECT_EQ(command_args[1].values.v_float, 7);
+    EXPECT_EQ(command_args[2].type, YARN_VALUE_FLOAT);
+    EXPECT_EQ(command_args[2].values.v_float, -4.5f);
+    EXPECT_STREQ(command_args[3].values.v_string, "two \"words");
+    EXPECT_EQ(command_args[4].type, YARN_VALUE_BOOL);
+    EXPECT_STREQ(command_args[5].values.v_string, "bigpx");
+    EXPECT_STREQ(command_text, "shake 1.5 now");
+    EXPECT_EQ(dialogue->stack_ptr, 0);
+
+    for (int i = 0; i < command_n_args; ++i) {
+        if (command_args[i].type == YARN_VALUE_STRING) free(command_args[i].values.v_string);
+    }
+}
+
+/* loads program of n_nodes nodes, node i made of instructions[i] (and frees them). */
+static int load_built_nodes(yarn_dialogue *dialogue, const char **names, Yarn__Instruction ***instructions, size_t *n_instructions, size_t n_nodes) {
+    Yarn__Node                 nodes[8];
+    Yarn__Program__NodesEntry  entries[8];
+    Yarn__Program__NodesEntry *entry_ptrs[8];
+    assert(n_nodes <= 8);
+
+    for (size_t n = 0; n < n_nodes; ++n) {
+        yarn__node__init(&nodes[n]);
+        nodes[n].name           = (char *)names[n];
+        nodes[n].n_instructions = n_instructions[n];
+        nodes[n].instructions   = instructions[n];
+
+        yarn__program__nodes_entry__init(&entries[n]);
+        entries[n].key   = nodes[n].name;
+        entries[n].value = &nodes[n];
+        entry_ptrs[n]    = &entries[n];
+    }
+
+    Yarn__Program program;
+    yarn__program__init(&program);
+    program.name    = (char *)"Built";
+    program.n_nodes = n_nodes;
+    program.nodes   = entry_ptrs;
+
+    size_t size = yarn__program__get_packed_size(&program);
+    uint8_t *bytes = (uint8_t *)malloc(size);
+    yarn__program__pack(&program, bytes);
+    for (size_t n = 0; n < n_nodes; ++n) {
+        for (size_t i = 0; i < n_instructions[n]; ++i) {
+            for (size_t o = 0; o < instructions[n][i]->n_operands; ++o) free(instructions[n][i]->operands[o]);
+            free(instructions[n][i]->operands);
+            free(instructions[n][i]);
+        }
+    }
+
+    int r = yarn_load_chapter(dialogue, "built", bytes, size);
+    free(bytes);
+    return r;
+}
+
+static yarn_line delivered_line;
+
+static void keep_line(yarn_dialogue *dialogue, yarn_line *line) {
+    delivered_line = *line;
+}
+
+UTEST_F(Chapters, typed_line_substitutions) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+
+    #define STR(s) command_operand(YARN__OPERAND__VALUE_STRING_VALUE, s, 0)
+    #define NUM(f) command_operand(YARN__OPERAND__VALUE_FLOAT_VALUE, 0, f)
+    Yarn__Instruction *instructions[] = {
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_FLOAT, NUM(3), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_STRING, STR("Sally"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_LINE, STR("line:a"), NUM(2)),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__STOP, 0, 0),
+    };
+    #undef STR
+    #undef NUM
+
+    const char *name = "Start";
+    Yarn__Instruction **nodes[] = { instructions };
+    size_t n_instructions = sizeof(instructions) / sizeof(instructions[0]);
+    ASSERT_TRUE(load_built_nodes(dialogue, &name, nodes, &n_instructions, 1));
+
+    dialogue->line_handler              = keep_line;
+    dialogue->node_start_handler        = ignore_node;
+    dialogue->node_complete_handler     = ignore_node;
+    dialogue->dialogue_complete_handler = ignore_dialogue;
+    dialogue->prepare_for_lines_handler = ignore_lines;
+    memset(&delivered_line, 0, sizeof(delivered_line));
+    EXPECT_NE(yarn_set_node(dialogue, "Start"), -1);
+    yarn_continue(dialogue);
+
+    /* values come as they were pushed; nothing is turned into text yet. */
+    ASSERT_EQ(delivered_line.n_substitutions, 2);
+    EXPECT_EQ(delivered_line.substitutions[0].type, YARN_VALUE_FLOAT);
+    EXPECT_EQ(delivered_line.substitutions[0].values.v_float, 3);
+    EXPECT_EQ(delivered_line.substitutions[1].type, YARN_VALUE_STRING);
+    EXPECT_EQ(dialogue->stack_ptr, 0);
+
+    char csv[] = "id,text,file,node,lineNumber\n"
+                 "line:a,{1} has {0} coins.,f,Start,1\n";
+    yarn_string_table *table = yarn_create_string_table();
+    ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+
+    char buffer[64];
+    EXPECT_EQ(yarn_format_line_into(table, &delivered_line, buffer, sizeof(buffer)), 18);
+    EXPECT_STREQ(buffer, "Sally has 3 coins.");
+    yarn_destroy_string_table(table);
+}
+
+static int prepared_ids = 0;
+static void count_prepared_lines(yarn_dialogue *dialogue, char **ids, int ids_count) {
+    prepared_ids = ids_count;
+}
+
+#define STR(s) command_operand(YARN__OPERAND__VALUE_STRING_VALUE, s, 0)
+
+/* A -> B -> C, each with its own lines. */
+static int load_jumping_nodes(yarn_dialogue *dialogue) {
+    Yarn__Instruction *a[] = {
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_LINE, STR("line:a1"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__ADD_OPTION, STR("line:a2"), STR("L0")),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_STRING, STR("B"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_NODE, 0, 0),
+    };
+    Yarn__Instruction *b[] = {
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_LINE, STR("line:b1"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__PUSH_STRING, STR("C"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_NODE, 0, 0),
+    };
+    Yarn__Instruction *c[] = {
+        command_instruction(YARN__INSTRUCTION__OP_CODE__RUN_LINE, STR("line:c1"), 0),
+        command_instruction(YARN__INSTRUCTION__OP_CODE__STOP, 0, 0),
+    };
+
+    const char *names[] = { "A", "B", "C" };
+    Yarn__Instruction **instructions[] = { a, b, c };
+    size_t n_instructions[] = { 4, 3, 2 };
+    return load_built_nodes(dialogue, names, instructions, n_instructions, 3);
+}
+
+#undef STR
+
+UTEST_F(Chapters, node_manifests) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+
+    ASSERT_TRUE(load_jumping_nodes(dialogue));
+    const yarn_node_manifest *a = yarn_get_node_manifest(dialogue, "A");
+    ASSERT_TRUE(a);
+    EXPECT_EQ(a->n_ids, 2);
+    EXPECT_EQ(a->n_own, 2);
+    EXPECT_STREQ(a->ids[1], "line:a2");
+    EXPECT_TRUE(yarn_get_node_manifest(dialogue, "D") == 0);
+    EXPECT_TRUE(yarn_unload_chapter(dialogue, "built"));
+
+    /* one jump ahead: own lines first, then the next node's. */
+    dialogue->manifest_depth = 1;
+    ASSERT_TRUE(load_jumping_nodes(dialogue));
+    a = yarn_get_node_manifest(dialogue, "A");
+    ASSERT_EQ(a->n_ids, 3);
+    EXPECT_EQ(a->n_own, 2);
+    EXPECT_STREQ(a->ids[0], "line:a1");
+    EXPECT_STREQ(a->ids[2], "line:b1");
+    EXPECT_EQ(yarn_get_node_manifest(dialogue, "C")->n_ids, 1);
+
+    /* prepare_for_lines doesn't depend on node_start_handler anymore. */
+    dialogue->node_start_handler        = 0;
+    dialogue->node_complete_handler     = ignore_node;
+    dialogue->dialogue_complete_handler = ignore_dialogue;
+    dialogue->prepare_for_lines_handler = count_prepared_lines;
+    prepared_ids = 0;
+
+    yarn_prefetch_queue *queue = yarn_create_prefetch_queue(2);
+    dialogue->prefetch = queue;
+    EXPECT_NE(yarn_set_node(dialogue, "B"), -1);
+    EXPECT_EQ(prepared_ids, 2);
+
+    yarn_prefetch_request request;
+    ASSERT_TRUE(yarn_prefetch_pop(queue, &request, 0));
+    EXPECT_STREQ(request.node_name, "B");
+    EXPECT_TRUE(request.manifest == yarn_get_node_manifest(dialogue, "B"));
+    yarn_prefetch_done(queue, &request);
+    EXPECT_FALSE(yarn_prefetch_pop(queue, &request, 0));
+
+    /* full queue drops the oldest. */
+    yarn_set_node(dialogue, "A");
+    yarn_set_node(dialogue, "B");
+    yarn_set_node(dialogue, "C");
+    ASSERT_TRUE(yarn_prefetch_pop(queue, &request, 0));
+    EXPECT_STREQ(request.node_name, "B");
+    yarn_prefetch_done(queue, &request);
+
+    /* a popped request only holds up unloading of its own chapter. */
+    ASSERT_TRUE(load_chapter_file(dialogue, "example", "yarn-c/Example/Example.yarnc"));
+    ASSERT_TRUE(yarn_prefetch_pop(queue, &request, 0));
+    EXPECT_STREQ(request.node_name, "C");
+    EXPECT_TRUE(yarn_unload_chapter(dialogue, "example"));
+    yarn_prefetch_done(queue, &request);
+    yarn_set_node(dialogue, "A");
+
+    /* unloading forgets requests of the chapter. */
+    EXPECT_TRUE(yarn_unload_chapter(dialogue, "built"));
+    EXPECT_FALSE(yarn_prefetch_pop(queue, &request, 0));
+
+    /* and so does replacing every chapter with a program. */
+    ASSERT_TRUE(load_jumping_nodes(dialogue));
+    yarn_set_node(dialogue, "A");
+    size_t size = 0;
+    char *bytes = read_entire_file("yarn-c/Example/Example.yarnc", &size);
+    ASSERT_TRUE(bytes);
+    ASSERT_TRUE(yarn_load_program(dialogue, bytes, size));
+    free(bytes);
+    EXPECT_FALSE(yarn_prefetch_pop(queue, &request, 0));
+
+    yarn_close_prefetch_queue(queue);
+    EXPECT_FALSE(yarn_prefetch_pop(queue, &request, 1));
+    dialogue->prefetch = 0;
+    yarn_destroy_prefetch_queue(queue);
+}
+
+UTEST_F(Chapters, memory_stats) {
+    yarn_dialogue *dialogue = utest_fixture->dialogue;
+    yarn_memory_stats empty, loaded, chapter;
+    ASSERT_TRUE(yarn_get_dialogue_memory_stats(dialogue, &empty));
+
+    ASSERT_TRUE(load_chapter_file(dialogue, "example", "yarn-c/Example/Example.yarnc"));
+    ASSERT_TRUE(yarn_get_dialogue_memory_stats(dialogue, &loaded));
+    ASSERT_TRUE(yarn_get_chapter_memory_stats(dialogue, "example", &chapter));
+
+    EXPECT_GT(loaded.total.bytes, empty.total.bytes);
+    EXPECT_GT(chapter.categories[YARN_MEMORY_INSTRUCTIONS].allocations, 0);
+    EXPECT_GT(chapter.categories[YARN_MEMORY_OPERANDS].bytes, 0);
+    EXPECT_GT(chapter.categories[YARN_MEMORY_STRINGS].bytes, 0);
+
+    /* categories add up to the total. */
+    size_t sum = 0;
+    for (int i = 0; i < YARN_MEMORY_CATEGORY_COUNT; ++i) sum += loaded.categories[i].bytes;
+    EXPECT_EQ(sum, loaded.total.bytes);
+
+    ASSERT_TRUE(yarn_unload_chapter(dialogue, "example"));
+    EXPECT_FALSE(yarn_get_chapter_memory_stats(dialogue, "example", &chapter));
+
+    yarn_memory_stats storage;
+    EXPECT_TRUE(yarn_get_storage_memory_stats(utest_fixture->storage, &storage));
+    EXPECT_GT(storage.categories[YARN_MEMORY_KVMAP].bytes, 0);
+
+    yarn_string_table *table = yarn_create_string_table();
+    yarn_memory_stats table_stats;
+    char csv[] = "id,text,file,node,lineNumber\nline:1,hello,a.yarn,Start,3\nline:2,Mae: [b]hi[/b] {0},a.yarn,Start,4\n";
+    ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+    ASSERT_TRUE(yarn_get_string_table_memory_stats(table, &table_stats));
+    EXPECT_GE(table_stats.categories[YARN_MEMORY_STRINGS].bytes, sizeof("hello"));
+    /* template of line:2: literal and placeholder. */
+    EXPECT_EQ(table_stats.categories[YARN_MEMORY_TEMPLATES].bytes, YARN__ARENA_SIZE(sizeof(yarn_line_template) + 2 * sizeof(yarn_template_segment)));
+    yarn_destroy_string_table(table);
+
+    /* markup and templates aren't strings. */
+    table = yarn_create_string_table();
+    table->markup = 1;
+    ASSERT_TRUE(yarn_load_string_table(table, csv, sizeof(csv)));
+    ASSERT_TRUE(yarn_get_string_table_memory_stats(table, &table_stats));
+    EXPECT_GT(table_stats.categories[YARN_MEMORY_TEMPLATES].allocations, 3u);
+    sum = 0;
+    for (int i = 0; i < YARN_MEMORY_CATEGORY_COUNT; ++i) sum += table_stats.categories[i].bytes;
+    EXPECT_EQ(sum, table_stats.total.bytes);
+    yarn_destroy_string_table(table);
+}
+
+static void expect_same_operand(int *utest_result, Yarn__Operand *actual, Yarn__Operand *expected) {
+    ASSERT_EQ(actual->value_case, expected->value_case);
+    switch(expected->value_case) {
+        case YARN__OPERAND__VALUE_STRING_VALUE: EXPECT_STREQ(actual->string_value, expected->string_value); break;
+        case YARN__OPERAND__VALUE_BOOL_VALUE:   EXPECT_EQ(actual->bool_value, expected->bool_value); break;
+        case YARN__OPERAND__VALUE_FLOAT_VALUE:  EXPECT_EQ(actual->float_value, expected->float_value); break;
+        default: break;
+    }
+}
+
+UTEST(decode_program, matches_protobuf_unpack) {
+    size_t size = 0;
+    char *bytes = read_entire_file("yarn-c/SuperVariables/SuperVariables.yarnc", &size);
+    ASSERT_TRUE(bytes);
+
+    Yarn__Program *expect = yarn__program__unpack(0, size, (const uint8_t *)bytes);
+    ASSERT_TRUE(expect);
+
+    yarn_chapter chapter = {0};
+    ASSERT_TRUE(yarn__decode_program(&chapter, (const uint8_t *)bytes, size, 4));
+
+    Yarn__Program *actual = chapter.program;
+    EXPECT_STREQ(actual->name, expect->name);
+    ASSERT_EQ(actual->n_initial_values, expect->n_initial_values);
+    ASSERT_EQ(actual->n_nodes, expect->n_nodes);
+
+    for (size_t i = 0; i < expect->n_initial_values; ++i) {
+        EXPECT_STREQ(actual->initial_values[i]->key, expect->initial_values[i]->key);
+        expect_same_operand(utest_result, actual->initial_values[i]->value, expect->initial_values[i]->value);
+    }
+
+    for (size_t i = 0; i < expect->n_nodes; ++i) {
+        Yarn__Node *e = expect->nodes[i]->value;
+        Yarn__Node *a = actual->nodes[i]->value;
+        EXPECT_STREQ(actual->nodes[i]->key, expect->nodes[i]->key);
+        EXPECT_STREQ(a->name, e->name);
+        ASSERT_EQ(a->n_instructions, e->n_instructions);
+        ASSERT_EQ(a->n_labels, e->n_labels);
+
+        for (size_t n = 0; n < e->n_labels; ++n) {
+            EXPECT_STREQ(a->labels[n]->key, e->labels[n]->key);
+            EXPECT_EQ(a->labels[n]->value, e->labels[n]->value);
+        }
+        for (size_t n = 0; n < e->n_instructions; ++n) {
+            EXPECT_EQ(a->instructions[n]->opcode, e->instructions[n]->opcode);
+            ASSERT_EQ(a->instructions[n]->n_operands, e->instructions[n]->n_operands);
+            for (size_t o = 0; o < e->instructions[n]->n_operands; ++o) {
+                expect_same_operand(utest_result, a->instructions[n]->operands[o], e->instructions[n]->operands[o]);
+            }
+        }
+    }
+
+    yarn__destroy_chapter(&chapter);
+    yarn__program__free_unpacked(expect, 0);
+
+    /* truncated buffer must fail, not crash. */
+    EXPECT_FALSE(yarn__decode_program(&chapter, (const uint8_t *)bytes, size / 2, 1));
+    EXPECT_EQ(chapter.n_allocators, 0);
+    free(bytes);
+}
+
 UTEST_MAIN();